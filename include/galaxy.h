@@ -60,7 +60,21 @@
 #define MIN_GALAXY_SEPARATION   1.4f
 #define MAX_GALAXY_SEPARATION   2.0f
 
-/* `particle_count` must not be less than `MIN_PARTICLES_PER_GALAXY * galaxy_count`. */
-Particle *MakeGalaxies(uint32_t particle_count, uint32_t galaxy_count);
+/*
+ *  Every galaxy gets some velocity around every other one. Groups of galaxies that are seen at an angle
+ *  under GALAXY_KICK_THETA radians act as a single galaxy, so that many galaxies do not take quadratic time.
+ */
+#define GALAXY_KICK_THETA       0.5f
+
+/*
+ * `particle_count` must not be less than `MIN_PARTICLES_PER_GALAXY * galaxy_count`.
+ * The result depends only on the arguments: the same SEED gives bit-identical particles on any number of threads.
+ * Particles are generated in parallel on all available CPUs, each from its own random stream keyed by SEED
+ * and its index.
+ */
+Particle *MakeGalaxies(uint32_t particle_count, uint32_t galaxy_count, uint64_t seed);
+
+/* The same as MakeGalaxies, but particles are generated by THREADS threads; 0 means all available. */
+Particle *MakeGalaxiesEx(uint32_t particle_count, uint32_t galaxy_count, uint64_t seed, uint32_t threads);
 
 #endif //NB_GALAXY_H
@@ -2,6 +2,7 @@
 #define NB_H
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <math.h>
 
 /* Gravitational constant; `g = NB_G * mass / dist^2`. */
@@ -57,19 +58,214 @@ _Static_assert(sizeof(Particle) % 16 == 0, "sizeof(Particle) must be a multiple
 /* The simulated world with fixed particle count. */
 typedef struct World World;
 
+/* Compute shader used by GPU simulation. */
+typedef enum GpuKernel {
+    GPU_KERNEL_DIRECT = 0,  // every invocation reads all particles with mass from the storage buffer
+    GPU_KERNEL_TILED,       // work group loads particles with mass into shared memory one tile at a time
+} GpuKernel;
+
+/*
+ * Integration scheme used by every kind of World update.
+ * Higher order schemes allow much larger time steps for the same energy error.
+ */
+typedef enum Integrator {
+    INTEGRATOR_EULER = 0,   // semi-implicit (symplectic) Euler, 1st order, one force evaluation per update
+    INTEGRATOR_LEAPFROG,    // kick-drift-kick leapfrog, 2nd order, one force evaluation per update
+    INTEGRATOR_FOREST_RUTH, // Forest-Ruth (Yoshida), 4th order, three force evaluations per update
+} Integrator;
+
+/* World parameters. Zero-initialized config is the default one. */
+typedef struct WorldConfig {
+    Integrator integrator;  // how particles are advanced in time
+    GpuKernel gpu_kernel;   // which compute shader GPU simulation uses
+    bool fast_math;         // whether CPU simulation trades a little precision for speed; see UpdateWorld_CPU
+    bool symmetric;         // whether CPU simulation computes each pair of particles with mass once; see UpdateWorld_CPU
+    uint32_t threads;       // how many threads CPU simulation uses; 0 means all available
+    bool pin_threads;       // whether every thread of CPU simulation, including the caller's, is pinned to its own CPU
+    uint32_t reorder_interval;  // reorder particles with ReorderWorld every this many updates; 0 means never
+} WorldConfig;
+
+/* Cumulative statistics of some phase of simulation. */
+typedef struct PhaseStats {
+    uint64_t count;     // how many times the phase was run
+    uint64_t ns;        // total time in nanoseconds
+} PhaseStats;
+
+/* Where the time of World updates went. Collection is always on and costs a few clock reads per update. */
+typedef struct WorldStats {
+    PhaseStats pack;            // copying particles into the SIMD-friendly layout of CPU simulation
+    PhaseStats unpack;          // copying particles back from the SIMD-friendly layout
+    PhaseStats cpu_tree;        // building Barnes-Hut tree, or FMM tree and its multipole expansions
+    PhaseStats cpu_accel;       // computing acceleration on CPU, one run per force evaluation
+    PhaseStats cpu_integrate;   // integrating on CPU, one run per integrator stage
+    PhaseStats upload;          // copying particles into host-visible GPU memory
+    PhaseStats gpu_dispatch;    // GPU compute time from timestamp queries, one run per stage; zero if unsupported
+    PhaseStats readback;        // copying particles from host-visible GPU memory, not counting the wait for GPU
+} WorldStats;
+
 /* Create World with SIZE particles copied from PS. */
 World *CreateWorld(const Particle *ps, uint32_t size);
 
+/* Create World with SIZE particles copied from PS and parameters from CFG; NULL CFG means the default config. */
+World *CreateWorldEx(const Particle *ps, uint32_t size, const WorldConfig *cfg);
+
 /* Destroy World. */
 void DestroyWorld(World *w);
 
-/* Get Particle array and its size. */
+/* Fill STATS with statistics collected since W was created. GPU statistics only include completed updates. */
+void GetWorldStats(World *w, WorldStats *stats);
+
+/*
+ * Get Particle array and its size. Waits for pending GPU updates.
+ * The array is not modified by the next update, so it can be read while that update is pending;
+ * the update may reorder it before it starts, see ReorderWorld.
+ */
 const Particle *GetWorldParticles(World *w, uint32_t *size);
 
-/* Perform N updates using CPU simulation. */
+/*
+ * Get ids of particles and their number: ids[i] is the index that the i-th particle of GetWorldParticles had
+ * in the array W was created from. Ids change when particles are reordered.
+ */
+const uint32_t *GetWorldParticleIds(World *w, uint32_t *size);
+
+/*
+ * Sort particles along the Morton curve, separately among particles with and without mass, so that particles
+ * close in space are close in memory, which makes every simulation more cache-friendly. With GPU simulation
+ * this waits for pending updates and copies particles to host and back.
+ */
+void ReorderWorld(World *w);
+
+/*
+ * Save all particles of W and their ids into snapshot file PATH, together with simulation TIME and time step DT,
+ * which World does not track itself. Waits for pending GPU updates. PATH is replaced only once the snapshot is
+ * complete, so it may be the file W was loaded from; a loaded world stops using that file, and arrays returned by
+ * GetWorldParticles and GetWorldParticleIds before the call are no longer valid.
+ * Snapshots are binary in the byte order of the machine that wrote them; see LoadWorld.
+ */
+void SaveWorld(World *w, const char *path, double time, float dt);
+
+/*
+ * Create World with particles of snapshot file PATH made by SaveWorld and parameters from CFG; NULL CFG means
+ * the default config. TIME and DT, unless NULL, receive the values passed to SaveWorld. The file is mapped
+ * into memory and particles are used where they are, so loading takes no time regardless of particle count:
+ * pages are read from disk when the first update touches them. Changes to particles stay in memory and never
+ * reach the file. Ids of particles are restored, and so is stored acceleration.
+ */
+World *LoadWorld(const char *path, const WorldConfig *cfg, double *time, float *dt);
+
+/*
+ * Perform N updates using CPU simulation. If the world was created with `fast_math` config,
+ * gravity is computed with approximate reciprocal square root, which is off by about 1e-6 per interaction.
+ *
+ * With `symmetric` config, gravity between two particles with mass is computed once and applied to both
+ * of them, which almost halves the work when most particles have mass. This needs symmetric softening
+ * `dist^2 + (r_i + r_j) / 2` instead of the default `dist^2 + r_target`, so results differ slightly;
+ * block time steps use the same softening, Barnes-Hut and GPU simulations keep the default one.
+ */
 void UpdateWorld_CPU(World *w, float dt, uint32_t n);
 
+/*
+ * Perform N updates the same way as UpdateWorld_CPU, but particles without mass are advanced BLOCK force
+ * evaluations at a time: particles with mass go through a block first while their positions are recorded,
+ * then particles without mass go through it in small groups that stay in cache, pulled by the recorded positions.
+ * Results are the same as of UpdateWorld_CPU; memory traffic is lower when particles without mass far outnumber
+ * those with mass, at the cost of `8 * BLOCK` bytes per particle with mass. An update is one force evaluation with
+ * Euler and leapfrog integrators and three with Forest-Ruth; BLOCK must be at least 1, typical values are 4 to 16.
+ */
+void UpdateWorld_TracerBlocks(World *w, float dt, uint32_t n, uint32_t block);
+
+/*
+ * Perform N updates using Barnes-Hut approximation on CPU.
+ * THETA is the opening angle: a group of particles of size S at distance D is treated as a single body if S/D < THETA.
+ * THETA of 0 gives the same result as UpdateWorld_CPU, typical values are 0.3 to 1.
+ */
+void UpdateWorld_BarnesHut(World *w, float dt, uint32_t n, float theta);
+
+/* Maximum ORDER of UpdateWorld_FMM. */
+#define NB_MAX_FMM_ORDER    12
+
+/*
+ * Perform N updates using the fast multipole method on CPU, which takes O(N) time per force evaluation.
+ * Gravity of every group of particles with mass is expanded into a series of ORDER around the group's center,
+ * and far groups interact through these series instead of particle by particle. THETA is the opening angle:
+ * groups within R1 and R2 of their centers, which are at distance D, interact through series if
+ * `(R1 + R2) / D < THETA`. Error falls roughly as THETA^ORDER; typical values are 4 to 8 for ORDER and
+ * 0.4 to 0.7 for THETA, and THETA of 0 gives the same result as UpdateWorld_CPU. ORDER must be at least 1.
+ * Softening only applies to particles that interact directly, far groups pull without it.
+ */
+void UpdateWorld_FMM(World *w, float dt, uint32_t n, uint32_t order, float theta);
+
+/* Maximum GRID of UpdateWorld_PM. */
+#define NB_MAX_PM_GRID      4096
+
+/*
+ * Perform N updates using the particle-mesh method on CPU, which takes O(N + GRID^2 log GRID) time per force
+ * evaluation. Mass of particles is spread over a grid of GRID x GRID nodes that covers all particles, potential
+ * is found with FFT, and every particle gets acceleration interpolated from the grid. GRID must be a power of 2
+ * from 8 to NB_MAX_PM_GRID. Forces are accurate between particles a few grid cells apart and smoothed at shorter
+ * distances, so this suits large-scale motion of many particles rather than close encounters.
+ */
+void UpdateWorld_PM(World *w, float dt, uint32_t n, uint32_t grid);
+
+/*
+ * Perform N updates using particle-particle particle-mesh method on CPU: UpdateWorld_PM with a long-range force
+ * that is smooth on the grid, and the rest of gravity summed directly between particles a few grid cells apart,
+ * which are found through a spatial hash. Forces are close to those of UpdateWorld_CPU at any distance, while
+ * the cost stays near-linear unless many particles crowd into a few grid cells. GRID is the same as of UpdateWorld_PM.
+ */
+void UpdateWorld_P3M(World *w, float dt, uint32_t n, uint32_t grid);
+
+/* Maximum GRID of UpdateWorld_Multigrid. */
+#define NB_MAX_MG_GRID      512
+
+/*
+ * Perform N updates using a multigrid solver of the gravitational potential on CPU, which takes O(N + GRID^3)
+ * time per force evaluation. Mass of particles is spread over a grid of GRID x GRID cells, potential is found
+ * in the space around that plane with isolated boundaries, and every particle gets acceleration interpolated
+ * from the grid. Each solve starts from the previous potential, so it is cheap while particles move little
+ * between force evaluations. GRID must be a power of 2 from 8 to NB_MAX_MG_GRID. Like UpdateWorld_PM, forces
+ * are accurate between particles a few grid cells apart and smoothed at shorter distances.
+ */
+void UpdateWorld_Multigrid(World *w, float dt, uint32_t n, uint32_t grid);
+
+/* Maximum LEVELS of UpdateWorld_BlockSteps. */
+#define NB_MAX_BLOCK_LEVELS 16
+
+/*
+ * Perform N updates using CPU simulation with individual, power-of-two time steps of particles.
+ * Each update of DT is split into 2^LEVELS substeps, and every particle uses step `DT / 2^k` with k <= LEVELS
+ * picked from its acceleration; particles close to massive bodies get small steps, while the rest are only
+ * drifted between their force evaluations. ETA is the accuracy parameter, typical values are 0.01 to 0.05.
+ * Integration is always kick-drift-kick leapfrog regardless of the configured integrator.
+ */
+void UpdateWorld_BlockSteps(World *w, float dt, uint32_t n, uint32_t levels, float eta);
+
+/*
+ * Tracing. If NB_TRACE environment variable is set to a file path, World functions record spans of their
+ * CPU phases and GPU commands, which are written to that file at exit as Chrome trace event JSON.
+ * Applications can add their own spans to the same timeline; both functions do nothing if tracing is disabled.
+ */
+
+/* Start of a span; pass the result to EndTraceSpan. */
+uint64_t BeginTraceSpan(void);
+
+/* Record span NAME of the calling thread from BEGIN until now. NAME must outlive the program, e.g. a literal. */
+void EndTraceSpan(const char *name, uint64_t begin);
+
 /* Perform N updates using GPU simulation. */
 void UpdateWorld_GPU(World *w, float dt, uint32_t n);
 
+/*
+ * Submit N updates to GPU simulation and return without waiting for them to complete.
+ * Returns a ticket for WaitWorld and PollWorld; tickets of later submissions are greater.
+ * Other World functions wait for pending updates when they need particle data.
+ */
+uint64_t UpdateWorld_GPU_Async(World *w, float dt, uint32_t n);
+
+/* Wait until GPU updates with TICKET and all previous tickets are complete. */
+void WaitWorld(World *w, uint64_t ticket);
+
+/* Whether GPU updates with TICKET and all previous tickets are complete; does not block. */
+bool PollWorld(World *w, uint64_t ticket);
+
 #endif //NB_H
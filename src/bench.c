@@ -7,68 +7,415 @@
 #include <nbody.h>
 #include <galaxy.h>
 
-#define US_PER_S    (1000 * 1000)
+#include "util.h"
+
+#define NS_PER_S    (1000 * 1000 * 1000)
 #define NS_PER_US   (1000)
 
 static void now(struct timespec *ts) {
     clock_gettime(CLOCK_MONOTONIC, ts);
 }
 
-static int64_t diff_us(struct timespec from, struct timespec to) {
-    return (to.tv_sec - from.tv_sec) * US_PER_S + (to.tv_nsec - from.tv_nsec) / NS_PER_US;
+static int64_t diff_ns(struct timespec from, struct timespec to) {
+    return (to.tv_sec - from.tv_sec) * NS_PER_S + (to.tv_nsec - from.tv_nsec);
 }
 
 #define UPDATE_STEP 1.f
-#define WARMUP_ITER 10
-#define BENCH_ITER  100
+#define BH_THETA    0.5f
+#define FMM_ORDER   6
+#define FMM_THETA   0.6f
+#define PM_GRID     256
+#define MG_GRID     64
+#define P3M_GRID    1024
+#define BLOCK_LEVELS    4
+#define BLOCK_ETA       0.05f
+#define TRACER_BLOCK    8
+#define GALAXY_SEED     11037   // fixed seed for reproducible benchmarks
+
+/*
+ * Floating point operations per pairwise interaction, by the usual convention for gravitational N-body codes.
+ * Square root and division are counted as several operations each; the exact count depends on the kernel.
+ */
+#define FLOP_PER_INTERACTION    20
 
-static int64_t bench(World *w, void (*update)(World *, float, uint32_t)) {
-    struct timespec start;
-    struct timespec end;
+/* Default particle counts. */
+static const uint32_t DEF_SIZES[] = {250, 500, 800, 1200, 2000, 4000, 10000, 20000, 50000, 100000};
+#define DEF_SIZES_LEN   (sizeof(DEF_SIZES) / sizeof(DEF_SIZES[0]))
 
-    update(w, UPDATE_STEP, WARMUP_ITER);
-    now(&start);
-    update(w, UPDATE_STEP, BENCH_ITER);
-    now(&end);
+#define MAX_SIZES   64
 
-    return diff_us(start, end) / BENCH_ITER;
+static void UpdateWorld_BH(World *w, float dt, uint32_t n) {
+    UpdateWorld_BarnesHut(w, dt, n, BH_THETA);
 }
 
-/* Must be sorted in ascending order. */
-static const int SIZES[] = {250, 500, 800, 1200, 2000, 4000, 10000, 20000, 50000, 100000};
-static const int SIZES_LEN = sizeof(SIZES) / sizeof(SIZES[0]);
+static void UpdateWorld_Fmm(World *w, float dt, uint32_t n) {
+    UpdateWorld_FMM(w, dt, n, FMM_ORDER, FMM_THETA);
+}
 
-int main(int argc, char **argv) {
-    srand(11037);   // fixed seed for reproducible benchmarks
+static void UpdateWorld_Pm(World *w, float dt, uint32_t n) {
+    UpdateWorld_PM(w, dt, n, PM_GRID);
+}
+
+static void UpdateWorld_P3m(World *w, float dt, uint32_t n) {
+    UpdateWorld_P3M(w, dt, n, P3M_GRID);
+}
+
+static void UpdateWorld_Mg(World *w, float dt, uint32_t n) {
+    UpdateWorld_Multigrid(w, dt, n, MG_GRID);
+}
+
+static void UpdateWorld_Block(World *w, float dt, uint32_t n) {
+    UpdateWorld_BlockSteps(w, dt, n, BLOCK_LEVELS, BLOCK_ETA);
+}
+
+static void UpdateWorld_Tracers(World *w, float dt, uint32_t n) {
+    UpdateWorld_TracerBlocks(w, dt, n, TRACER_BLOCK);
+}
+
+/* Simulation engine that can be benchmarked. */
+typedef struct Engine {
+    const char *name;
+    void (*update)(World *, float, uint32_t);
+    WorldConfig cfg;
+} Engine;
+
+static const Engine ENGINES[] = {
+        {.name = "cpu", .update = UpdateWorld_CPU},
+        {.name = "cpu-fast", .update = UpdateWorld_CPU, .cfg = {.fast_math = true}},
+        {.name = "cpu-sym", .update = UpdateWorld_CPU, .cfg = {.symmetric = true}},
+        {.name = "gpu", .update = UpdateWorld_GPU},
+        {.name = "gpu-tiled", .update = UpdateWorld_GPU, .cfg = {.gpu_kernel = GPU_KERNEL_TILED}},
+        {.name = "bh", .update = UpdateWorld_BH},
+        {.name = "fmm", .update = UpdateWorld_Fmm},
+        {.name = "pm", .update = UpdateWorld_Pm},
+        {.name = "p3m", .update = UpdateWorld_P3m},
+        {.name = "mg", .update = UpdateWorld_Mg},
+        {.name = "block", .update = UpdateWorld_Block},
+        {.name = "tracers", .update = UpdateWorld_Tracers},
+};
+#define ENGINES_LEN     (sizeof(ENGINES) / sizeof(ENGINES[0]))
+
+/* Integration scheme that can be benchmarked. */
+typedef struct IntegratorInfo {
+    const char *name;
+    Integrator integrator;
+    uint32_t evals;     // force evaluations per update
+} IntegratorInfo;
+
+static const IntegratorInfo INTEGRATORS[] = {
+        {.name = "euler", .integrator = INTEGRATOR_EULER, .evals = 1},
+        {.name = "leapfrog", .integrator = INTEGRATOR_LEAPFROG, .evals = 1},
+        {.name = "forest-ruth", .integrator = INTEGRATOR_FOREST_RUTH, .evals = 3},
+};
+#define INTEGRATORS_LEN (sizeof(INTEGRATORS) / sizeof(INTEGRATORS[0]))
 
-    bool use_cpu = true, use_gpu = true;
-    if (argc > 1) {
-        if (memcmp(argv[1], "--cpu", 5) == 0) use_gpu = false;
-        if (memcmp(argv[1], "--gpu", 5) == 0) use_cpu = false;
+/* Engines used when none are given. */
+static const char *DEF_ENGINES = "cpu,gpu,gpu-tiled,bh";
+
+typedef enum Format {
+    FORMAT_TABLE,
+    FORMAT_CSV,
+    FORMAT_JSON,
+} Format;
+
+/* Benchmark parameters. */
+typedef struct Options {
+    uint32_t sizes[MAX_SIZES];
+    uint32_t sizes_len;
+    uint32_t galaxies;
+    uint32_t warmup;        // number of updates before measuring
+    uint32_t steps;         // number of updates per repetition
+    uint32_t reps;          // number of repetitions
+    uint32_t threads;       // 0 means all available
+    bool pin;               // whether threads are pinned to CPUs
+    uint32_t reorder;       // reorder interval in updates; 0 means never
+    bool engines[ENGINES_LEN];
+    const IntegratorInfo *integrator;
+    Format format;
+} Options;
+
+/* Statistics of a single benchmark run; times are per update. */
+typedef struct Result {
+    uint32_t size;
+    uint32_t mass_len;
+    const char *engine;
+    double median_us, p10_us, p90_us;
+    double interactions;    // pairwise interactions per second, computed from median time
+    double gflops;          // estimated GFLOP/s, computed from median time
+} Result;
+
+static void PrintUsage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --sizes N[,N...]    particle counts (default: 250 to 100000)\n"
+            "  --galaxies N        number of galaxies (default: 2)\n"
+            "  --warmup N          updates before measuring (default: 10)\n"
+            "  --steps N           updates per repetition (default: 10)\n"
+            "  --reps N            repetitions (default: 10)\n"
+            "  --threads N         CPU simulation threads (default: all)\n"
+            "  --pin               pin every CPU simulation thread to its own CPU\n"
+            "  --engine E[,E...]   any of cpu, cpu-fast, cpu-sym, gpu, gpu-tiled,\n"
+            "                      bh, fmm, pm, p3m, mg, block, tracers (default: %s)\n"
+            "  --integrator I      euler, leapfrog or forest-ruth (default: euler)\n"
+            "  --reorder N         sort particles along Morton curve every N updates (default: never)\n"
+            "  --format F          table, csv or json (default: table)\n"
+            "  --cpu, --gpu, --bh  shortcuts for --engine cpu, --engine gpu,gpu-tiled and --engine bh\n",
+            prog, DEF_ENGINES);
+}
+
+/* Parse integer of at least MIN or exit. */
+static uint32_t ParseCount(const char *opt, const char *str, uint32_t min) {
+    char *end;
+    unsigned long val = strtoul(str, &end, 10);
+    if (*str < '0' || *str > '9' || *end != '\0' || val < min || val > UINT32_MAX) {
+        fprintf(stderr, "Invalid value of %s: '%s'\n", opt, str);
+        exit(EXIT_FAILURE);
     }
+    return (uint32_t)val;
+}
 
-    World *cpu_w = NULL, *gpu_w = NULL;
-    for (int i = 0; i < SIZES_LEN; i++) {
-        int world_size = SIZES[i];
-        Particle *particles = MakeGalaxies(world_size, 2);
+/* Parse comma-separated list of particle counts or exit. */
+static void ParseSizes(Options *opt, char *str) {
+    opt->sizes_len = 0;
+    for (char *tok = strtok(str, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        if (opt->sizes_len == MAX_SIZES) {
+            fprintf(stderr, "Too many sizes, at most %d are allowed\n", MAX_SIZES);
+            exit(EXIT_FAILURE);
+        }
+        opt->sizes[opt->sizes_len++] = ParseCount("--sizes", tok, 1);
+    }
+}
 
-        if (use_cpu) cpu_w = CreateWorld(particles, world_size);
-        if (use_gpu) gpu_w = CreateWorld(particles, world_size);
+/* Parse comma-separated list of engine names or exit. */
+static void ParseEngines(Options *opt, const char *list) {
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", list);
 
-        if (i == 0) {
-            printf("\t      N");
-            if (use_cpu) printf("\t    CPU");
-            if (use_gpu) printf("\t    GPU");
-            printf("\n");
+    memset(opt->engines, 0, sizeof(opt->engines));
+    for (char *tok = strtok(buf, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        bool found = false;
+        for (uint32_t e = 0; e < ENGINES_LEN; e++) {
+            if (strcmp(tok, ENGINES[e].name) == 0) {
+                opt->engines[e] = found = true;
+            }
+        }
+        if (!found) {
+            fprintf(stderr, "Unknown engine '%s'\n", tok);
+            exit(EXIT_FAILURE);
         }
+    }
+}
 
-        printf("\t%7d", world_size);
-        if (use_cpu) printf("\t%7ld", bench(cpu_w, UpdateWorld_CPU));
-        if (use_gpu) printf("\t%7ld", bench(gpu_w, UpdateWorld_GPU));
-        printf("\n");
+static Options ParseOptions(int argc, char **argv) {
+    Options opt = {
+            .galaxies = 2,
+            .warmup = 10,
+            .steps = 10,
+            .reps = 10,
+            .threads = 0,
+            .integrator = &INTEGRATORS[0],
+            .format = FORMAT_TABLE,
+    };
+    memcpy(opt.sizes, DEF_SIZES, sizeof(DEF_SIZES));
+    opt.sizes_len = DEF_SIZES_LEN;
+    ParseEngines(&opt, DEF_ENGINES);
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+        bool has_val = true;
+
+        if (strcmp(arg, "--cpu") == 0) {
+            ParseEngines(&opt, "cpu");
+            has_val = false;
+        } else if (strcmp(arg, "--gpu") == 0) {
+            ParseEngines(&opt, "gpu,gpu-tiled");
+            has_val = false;
+        } else if (strcmp(arg, "--bh") == 0) {
+            ParseEngines(&opt, "bh");
+            has_val = false;
+        } else if (strcmp(arg, "--pin") == 0) {
+            opt.pin = true;
+            has_val = false;
+        } else if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0) {
+            PrintUsage(argv[0]);
+            exit(EXIT_SUCCESS);
+        } else if (val == NULL) {
+            PrintUsage(argv[0]);
+            exit(EXIT_FAILURE);
+        } else if (strcmp(arg, "--sizes") == 0) {
+            ParseSizes(&opt, argv[i + 1]);
+        } else if (strcmp(arg, "--galaxies") == 0) {
+            opt.galaxies = ParseCount(arg, val, 1);
+        } else if (strcmp(arg, "--warmup") == 0) {
+            opt.warmup = ParseCount(arg, val, 0);
+        } else if (strcmp(arg, "--steps") == 0) {
+            opt.steps = ParseCount(arg, val, 1);
+        } else if (strcmp(arg, "--reps") == 0) {
+            opt.reps = ParseCount(arg, val, 1);
+        } else if (strcmp(arg, "--threads") == 0) {
+            opt.threads = ParseCount(arg, val, 1);
+        } else if (strcmp(arg, "--engine") == 0) {
+            ParseEngines(&opt, val);
+        } else if (strcmp(arg, "--reorder") == 0) {
+            opt.reorder = ParseCount(arg, val, 1);
+        } else if (strcmp(arg, "--integrator") == 0) {
+            opt.integrator = NULL;
+            for (uint32_t k = 0; k < INTEGRATORS_LEN; k++) {
+                if (strcmp(val, INTEGRATORS[k].name) == 0) opt.integrator = &INTEGRATORS[k];
+            }
+            if (opt.integrator == NULL) {
+                fprintf(stderr, "Unknown integrator '%s'\n", val);
+                exit(EXIT_FAILURE);
+            }
+        } else if (strcmp(arg, "--format") == 0) {
+            if (strcmp(val, "table") == 0) opt.format = FORMAT_TABLE;
+            else if (strcmp(val, "csv") == 0) opt.format = FORMAT_CSV;
+            else if (strcmp(val, "json") == 0) opt.format = FORMAT_JSON;
+            else {
+                fprintf(stderr, "Unknown format '%s'\n", val);
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            PrintUsage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        if (has_val) i++;
+    }
 
+    for (uint32_t s = 0; s < opt.sizes_len; s++) {
+        if (opt.sizes[s] < MIN_PARTICLES_PER_GALAXY * opt.galaxies) {
+            fprintf(stderr, "%u particles is too few for %u galaxies\n", opt.sizes[s], opt.galaxies);
+            exit(EXIT_FAILURE);
+        }
+    }
+    return opt;
+}
+
+static int CompareDouble(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* P-th percentile of LEN sorted values, interpolated linearly. */
+static double Percentile(const double *sorted, uint32_t len, double p) {
+    double pos = p * (len - 1);
+    uint32_t lo = (uint32_t)pos;
+    uint32_t hi = lo + 1 < len ? lo + 1 : lo;
+    return sorted[lo] + (pos - lo) * (sorted[hi] - sorted[lo]);
+}
+
+/* Benchmark ENGINE on SIZE particles of PS. */
+static Result Bench(const Options *opt, const Engine *engine, const Particle *ps, uint32_t size) {
+    WorldConfig cfg = engine->cfg;
+    cfg.threads = opt->threads;
+    cfg.pin_threads = opt->pin;
+    cfg.integrator = opt->integrator->integrator;
+    cfg.reorder_interval = opt->reorder;
+
+    World *w = CreateWorldEx(ps, size, &cfg);
+    if (opt->warmup > 0) {
+        engine->update(w, UPDATE_STEP, opt->warmup);
+    }
+
+    double *times = ALLOC(opt->reps, double);
+    ASSERT(times != NULL, "Failed to alloc %u times", opt->reps);
+    for (uint32_t r = 0; r < opt->reps; r++) {
+        struct timespec start, end;
+        now(&start);
+        engine->update(w, UPDATE_STEP, opt->steps);
+        now(&end);
+        times[r] = (double)diff_ns(start, end) / NS_PER_US / opt->steps;
+    }
+    DestroyWorld(w);
+    qsort(times, opt->reps, sizeof(double), CompareDouble);
+
+    uint32_t mass_len = 0;
+    for (uint32_t i = 0; i < size; i++) {
+        if (ps[i].mass > 0) mass_len++;
+    }
+
+    Result res = {
+            .size = size,
+            .mass_len = mass_len,
+            .engine = engine->name,
+            .median_us = Percentile(times, opt->reps, 0.5),
+            .p10_us = Percentile(times, opt->reps, 0.1),
+            .p90_us = Percentile(times, opt->reps, 0.9),
+    };
+    free(times);
+
+    // every particle interacts with every particle with mass once per force evaluation; for approximate engines
+    // this is the direct-sum equivalent rate
+    res.interactions = (double)size * mass_len * opt->integrator->evals / (res.median_us * 1e-6);
+    res.gflops = res.interactions * FLOP_PER_INTERACTION * 1e-9;
+    return res;
+}
+
+static void PrintHeader(const Options *opt) {
+    switch (opt->format) {
+        case FORMAT_TABLE:
+            printf("%9s  %-10s %12s %12s %12s %14s %10s\n",
+                   "N", "engine", "median, us", "p10, us", "p90, us", "interactions/s", "GFLOP/s");
+            break;
+        case FORMAT_CSV:
+            printf("size,mass_len,engine,median_us,p10_us,p90_us,interactions_per_s,gflops\n");
+            break;
+        case FORMAT_JSON:
+            printf("{\"galaxies\": %u, \"warmup\": %u, \"steps\": %u, \"reps\": %u, \"threads\": %u, "
+                   "\"integrator\": \"%s\", \"flop_per_interaction\": %d, \"results\": [",
+                   opt->galaxies, opt->warmup, opt->steps, opt->reps, opt->threads, opt->integrator->name,
+                   FLOP_PER_INTERACTION);
+            break;
+    }
+}
+
+static void PrintResult(const Options *opt, const Result *res, bool first) {
+    switch (opt->format) {
+        case FORMAT_TABLE:
+            printf("%9u  %-10s %12.1f %12.1f %12.1f %14.3e %10.2f\n",
+                   res->size, res->engine, res->median_us, res->p10_us, res->p90_us, res->interactions, res->gflops);
+            break;
+        case FORMAT_CSV:
+            printf("%u,%u,%s,%.3f,%.3f,%.3f,%.6e,%.4f\n",
+                   res->size, res->mass_len, res->engine, res->median_us, res->p10_us, res->p90_us,
+                   res->interactions, res->gflops);
+            break;
+        case FORMAT_JSON:
+            printf("%s\n  {\"size\": %u, \"mass_len\": %u, \"engine\": \"%s\", "
+                   "\"median_us\": %.3f, \"p10_us\": %.3f, \"p90_us\": %.3f, "
+                   "\"interactions_per_s\": %.6e, \"gflops\": %.4f}",
+                   first ? "" : ",", res->size, res->mass_len, res->engine,
+                   res->median_us, res->p10_us, res->p90_us, res->interactions, res->gflops);
+            break;
+    }
+    fflush(stdout);
+}
+
+static void PrintFooter(const Options *opt) {
+    if (opt->format == FORMAT_JSON) {
+        printf("\n]}\n");
+    }
+}
+
+int main(int argc, char **argv) {
+    Options opt = ParseOptions(argc, argv);
+    PrintHeader(&opt);
+
+    bool first = true;
+    for (uint32_t s = 0; s < opt.sizes_len; s++) {
+        uint32_t size = opt.sizes[s];
+        Particle *particles = MakeGalaxies(size, opt.galaxies, GALAXY_SEED);
+
+        for (uint32_t e = 0; e < ENGINES_LEN; e++) {
+            if (!opt.engines[e]) continue;
+
+            Result res = Bench(&opt, &ENGINES[e], particles, size);
+            PrintResult(&opt, &res, first);
+            first = false;
+        }
         free(particles);
-        if (use_cpu) DestroyWorld(cpu_w);
-        if (use_gpu) DestroyWorld(gpu_w);
     }
+
+    PrintFooter(&opt);
 }
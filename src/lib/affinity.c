@@ -0,0 +1,64 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#   define _GNU_SOURCE  // sched_getaffinity and CPU_* macros
+#endif
+
+#include "affinity.h"
+
+#include <stdbool.h>
+
+#if defined(__linux__)
+#   include <sched.h>
+#elif defined(_WIN32)
+#   define WIN32_LEAN_AND_MEAN
+#   include <windows.h>
+#endif
+
+/* Maximum number of remembered CPUs; the rest are never used for pinning. */
+#define MAX_CPUS    1024
+
+static struct Affinity {
+    bool init;
+    uint32_t len;           // number of remembered CPUs
+    uint16_t cpus[MAX_CPUS];    // OS numbers of remembered CPUs
+} affinity = {0};
+
+void InitAffinity(void) {
+    if (affinity.init) return;
+    affinity.init = true;
+
+#if defined(__linux__)
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) return;
+
+    for (int cpu = 0; cpu < CPU_SETSIZE && affinity.len < MAX_CPUS; cpu++) {
+        if (CPU_ISSET(cpu, &set)) affinity.cpus[affinity.len++] = (uint16_t)cpu;
+    }
+#elif defined(_WIN32)
+    DWORD_PTR process, system;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &process, &system)) return;
+
+    for (int cpu = 0; cpu < (int)(8 * sizeof(DWORD_PTR)); cpu++) {
+        if (process & ((DWORD_PTR)1 << cpu)) affinity.cpus[affinity.len++] = (uint16_t)cpu;
+    }
+#endif
+}
+
+uint32_t GetCpuCount(void) {
+    return affinity.len > 0 ? affinity.len : 1;
+}
+
+void PinThread(uint32_t k) {
+    if (affinity.len == 0) return;
+    uint16_t cpu = affinity.cpus[k % affinity.len];
+
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    (void)sched_setaffinity(0, sizeof(set), &set);
+#elif defined(_WIN32)
+    (void)SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu);
+#else
+    (void)cpu;
+#endif
+}
@@ -0,0 +1,21 @@
+#ifndef NB_AFFINITY_H
+#define NB_AFFINITY_H
+
+#include <stdint.h>
+
+/*
+ * Thread affinity on Linux and Windows; elsewhere threads are left to the OS scheduler.
+ * CPUs are numbered among those the process was allowed to run on when InitAffinity was first called,
+ * so that a process started with a restricted set of CPUs stays within it.
+ */
+
+/* Remember CPUs the process may run on. Must be called before any thread is pinned; later calls do nothing. */
+void InitAffinity(void);
+
+/* Number of remembered CPUs, or 1 if they are unknown. */
+uint32_t GetCpuCount(void);
+
+/* Pin the calling thread to the K-th remembered CPU, wrapping around if there are fewer of them. */
+void PinThread(uint32_t k);
+
+#endif //NB_AFFINITY_H
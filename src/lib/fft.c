@@ -0,0 +1,149 @@
+#include "fft.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <math.h>
+
+void MakeFftPlan(FftPlan *p, uint32_t n) {
+    ASSERT(n > 0 && (n & (n - 1)) == 0, "FFT size must be a power of 2, got %u", n);
+
+    p->n = n;
+    p->rev = ALLOC(n, uint32_t);
+    p->cos = ALLOC(n + 1, float);
+    p->sin = ALLOC(n + 1, float);
+    ASSERT(p->rev != NULL && p->cos != NULL && p->sin != NULL, "Failed to alloc FFT plan of %u points", n);
+
+    uint32_t bits = 0;
+    while ((1u << bits) < n) bits++;
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t r = 0;
+        for (uint32_t b = 0; b < bits; b++) {
+            r |= ((i >> b) & 1u) << (bits - 1 - b);
+        }
+        p->rev[i] = r;
+    }
+    for (uint32_t k = 0; k <= n; k++) {
+        double angle = 3.14159265358979323846 * k / n;
+        p->cos[k] = (float)cos(angle);
+        p->sin[k] = (float)sin(angle);
+    }
+}
+
+void FreeFftPlan(FftPlan *p) {
+    if (p != NULL) {
+        free(p->rev);
+        free(p->cos);
+        free(p->sin);
+        *p = (FftPlan){0};
+    }
+}
+
+void Fft(const FftPlan *p, float *re, float *im, uint32_t stride, uint32_t count, bool inverse) {
+    const uint32_t n = p->n;
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t j = p->rev[i];
+        if (i >= j) continue;
+
+        float *ar = re + (size_t)i * stride, *ai = im + (size_t)i * stride;
+        float *br = re + (size_t)j * stride, *bi = im + (size_t)j * stride;
+        for (uint32_t c = 0; c < count; c++) {
+            float tr = ar[c], ti = ai[c];
+            ar[c] = br[c];
+            ai[c] = bi[c];
+            br[c] = tr;
+            bi[c] = ti;
+        }
+    }
+
+    // butterflies of LEN points each; twiddle k of them is `exp(-+2 * pi * i * k / LEN)`
+    for (uint32_t len = 2; len <= n; len *= 2) {
+        uint32_t half = len / 2, step = 2 * n / len;
+
+        for (uint32_t k = 0; k < half; k++) {
+            float wr = p->cos[k * step];
+            float wi = inverse ? p->sin[k * step] : -p->sin[k * step];
+
+            for (uint32_t start = 0; start < n; start += len) {
+                float *ar = re + (size_t)(start + k) * stride, *ai = im + (size_t)(start + k) * stride;
+                float *br = ar + (size_t)half * stride, *bi = ai + (size_t)half * stride;
+
+                for (uint32_t c = 0; c < count; c++) {
+                    float tr = br[c] * wr - bi[c] * wi;
+                    float ti = br[c] * wi + bi[c] * wr;
+                    br[c] = ar[c] - tr;
+                    bi[c] = ai[c] - ti;
+                    ar[c] += tr;
+                    ai[c] += ti;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Real transforms pack 2N real values x into N complex values `z = x_even + i * x_odd`. Transform Z of z mixes
+ * transforms E and O of even and odd values: `E(k) = (Z(k) + conj(Z(N-k))) / 2`, `O(k) = -i * (Z(k) - conj(Z(N-k))) / 2`,
+ * and `X(k) = E(k) + W^k * O(k)` with `W = exp(-pi * i / N)`. Since E and O are transforms of real values,
+ * `X(N-k) = conj(E(k) - W^k * O(k))`, so points K and N-K are computed together in place.
+ */
+
+void FftReal(const FftPlan *p, float *re, float *im) {
+    const uint32_t n = p->n;
+    Fft(p, re, im, 1, 1, false);
+
+    float z0r = re[0], z0i = im[0];
+    re[0] = z0r + z0i;
+    im[0] = 0;
+    re[n] = z0r - z0i;
+    im[n] = 0;
+
+    for (uint32_t k = 1; k <= n / 2; k++) {
+        uint32_t j = n - k;
+        float a = re[k], b = im[k], c = re[j], d = im[j];
+
+        float er = 0.5f * (a + c), ei = 0.5f * (b - d);
+        float odd_r = 0.5f * (b + d), odd_i = -0.5f * (a - c);
+
+        // W^k * O
+        float wc = p->cos[k], ws = p->sin[k];
+        float tr = wc * odd_r + ws * odd_i;
+        float ti = wc * odd_i - ws * odd_r;
+
+        re[k] = er + tr;
+        im[k] = ei + ti;
+        re[j] = er - tr;
+        im[j] = -(ei - ti);
+    }
+}
+
+void FftRealInverse(const FftPlan *p, float *re, float *im) {
+    const uint32_t n = p->n;
+
+    // the same relations solved for E and O, doubled so that the round trip scales by 2N like other transforms
+    float x0 = re[0], xn = re[n];
+    re[0] = x0 + xn;
+    im[0] = x0 - xn;
+
+    for (uint32_t k = 1; k <= n / 2; k++) {
+        uint32_t j = n - k;
+        float a = re[k], b = im[k], c = re[j], d = im[j];
+
+        float er = a + c, ei = b - d;
+        float tr = a - c, ti = b + d;
+
+        // O = conj(W^k) * (W^k * O)
+        float wc = p->cos[k], ws = p->sin[k];
+        float odd_r = wc * tr - ws * ti;
+        float odd_i = wc * ti + ws * tr;
+
+        // Z(k) = E + i * O, Z(N-k) = conj(E) + i * conj(O)
+        re[k] = er - odd_i;
+        im[k] = ei + odd_r;
+        re[j] = er + odd_i;
+        im[j] = -ei + odd_r;
+    }
+
+    Fft(p, re, im, 1, 1, true);
+}
@@ -0,0 +1,48 @@
+#ifndef NB_FFT_H
+#define NB_FFT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Radix-2 fast Fourier transform. Complex numbers are kept as separate arrays of real and imaginary parts,
+ * and several transforms are done at once on interleaved data, so that the innermost loops are contiguous
+ * and easy for the compiler to vectorize. Transforms are not normalized: forward followed by inverse
+ * multiplies data by N.
+ */
+
+/* Precomputed data of transforms of N points. */
+typedef struct FftPlan {
+    uint32_t n;         // number of points, a power of 2
+    uint32_t *rev;      // bit-reversed index of every point
+    float *cos, *sin;   // cos and sin of `pi * k / N` for k <= N; transforms use every other one
+} FftPlan;
+
+/* Make plan of transforms of N points; N must be a power of 2. */
+void MakeFftPlan(FftPlan *p, uint32_t n);
+
+/* Free memory of P. */
+void FreeFftPlan(FftPlan *p);
+
+/*
+ * In-place transform of COUNT sequences of `p->n` complex points. Point k of sequence c is at `k * STRIDE + c`
+ * of RE and IM, so a single contiguous sequence has COUNT 1 and STRIDE 1, and columns of a row-major grid
+ * have STRIDE equal to the row length. Forward transform uses `exp(-2 * pi * i * j * k / N)`, inverse uses
+ * `exp(+2 * pi * i * j * k / N)`.
+ */
+void Fft(const FftPlan *p, float *re, float *im, uint32_t stride, uint32_t count, bool inverse);
+
+/*
+ * Transform of `2 * p->n` real values into `p->n + 1` complex points, the rest of which are conjugates of these.
+ * On input, RE and IM hold even and odd real values, each `p->n` long; on output they hold the points,
+ * and so must fit `p->n + 1` values.
+ */
+void FftReal(const FftPlan *p, float *re, float *im);
+
+/*
+ * Inverse of FftReal: `p->n + 1` complex points of RE and IM become even and odd real values.
+ * FftReal followed by FftRealInverse multiplies values by `2 * p->n`.
+ */
+void FftRealInverse(const FftPlan *p, float *re, float *im);
+
+#endif //NB_FFT_H
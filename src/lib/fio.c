@@ -2,8 +2,19 @@
 #include "util.h"
 
 #include <stdio.h>
+#include <string.h>
 #include <sys/stat.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <unistd.h>
+#   define FIO_MMAP
+#elif defined(_WIN32)
+#   define WIN32_LEAN_AND_MEAN
+#   include <windows.h>
+#endif
+
 #ifdef _WIN32
 #   define stat _stat
 #   define _CRT_SECURE_NO_DEPRECATE
@@ -28,3 +39,119 @@ void *FIO_ReadFile(const char *file, size_t *size) {
     *size = fs.st_size;
     return buf;
 }
+
+void FIO_WriteSnapshot(const char *path, const SnapshotHeader *h, const Particle *ps, const uint32_t *ids) {
+    // written next to PATH and moved over it when complete, so that PATH is never truncated: it may be mapped
+    // by a loaded world, and an interrupted save keeps the previous snapshot
+    size_t path_len = strlen(path);
+    char *tmp = ALLOC(path_len + sizeof(".tmp"), char);
+    ASSERT(tmp != NULL, "Failed to alloc %zu bytes for path", path_len + sizeof(".tmp"));
+    memcpy(tmp, path, path_len);
+    memcpy(tmp + path_len, ".tmp", sizeof(".tmp"));
+
+    FILE *f = fopen(tmp, "wb");
+    ASSERT(f != NULL, "Failed to open %s", tmp);
+
+    size_t len = h->total_len;
+    ASSERT(fwrite(h, sizeof(*h), 1, f) == 1, "Failed to write header of %s", tmp);
+    ASSERT(fwrite(ps, sizeof(Particle), len, f) == len, "Failed to write %zu particles into %s", len, tmp);
+    ASSERT(fwrite(ids, sizeof(uint32_t), len, f) == len, "Failed to write %zu ids into %s", len, tmp);
+    ASSERT(fclose(f) == 0, "Failed to close %s", tmp);
+
+#ifdef _WIN32
+    // rename does not replace existing files on Windows
+    ASSERT(MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING), "Failed to move %s to %s", tmp, path);
+#else
+    ASSERT(rename(tmp, path) == 0, "Failed to move %s to %s", tmp, path);
+#endif
+    free(tmp);
+}
+
+/* Map PATH into memory with copy-on-write pages, or read it where that is not supported. */
+static void *MapFile(const char *path, size_t *size) {
+#if defined(FIO_MMAP)
+    int fd = open(path, O_RDONLY);
+    ASSERT(fd >= 0, "Failed to open %s", path);
+
+    struct stat fs;
+    ASSERT(fstat(fd, &fs) == 0, "Failed to stat %s", path);
+    ASSERT(fs.st_size > 0, "Snapshot %s is empty", path);
+
+    void *data = mmap(NULL, (size_t)fs.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ASSERT(data != MAP_FAILED, "Failed to map %s", path);
+    ASSERT(close(fd) == 0, "Failed to close %s", path);
+
+    *size = (size_t)fs.st_size;
+    return data;
+#elif defined(_WIN32)
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    ASSERT(file != INVALID_HANDLE_VALUE, "Failed to open %s", path);
+
+    LARGE_INTEGER fs;
+    ASSERT(GetFileSizeEx(file, &fs) && fs.QuadPart > 0, "Failed to get size of %s", path);
+
+    HANDLE map = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    ASSERT(map != NULL, "Failed to create mapping of %s", path);
+    void *data = MapViewOfFile(map, FILE_MAP_COPY, 0, 0, 0);
+    ASSERT(data != NULL, "Failed to map %s", path);
+
+    // the view keeps the mapping open
+    CloseHandle(map);
+    CloseHandle(file);
+
+    *size = (size_t)fs.QuadPart;
+    return data;
+#else
+    return FIO_ReadFile(path, size);
+#endif
+}
+
+/* Unmap DATA of SIZE bytes returned by MapFile. */
+static void UnmapFile(void *data, size_t size) {
+#if defined(FIO_MMAP)
+    ASSERT(munmap(data, size) == 0, "Failed to unmap %zu bytes", size);
+#elif defined(_WIN32)
+    (void)size;
+    ASSERT(UnmapViewOfFile(data), "Failed to unmap %zu bytes", size);
+#else
+    (void)size;
+    free(data);
+#endif
+}
+
+void FIO_MapSnapshot(const char *path, Snapshot *s) {
+    size_t size;
+    void *data = MapFile(path, &size);
+
+    SnapshotHeader h;
+    ASSERT(size >= sizeof(h), "Snapshot %s is too short for a header", path);
+    memcpy(&h, data, sizeof(h));
+
+    ASSERT(memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic)) == 0, "%s is not a snapshot", path);
+    ASSERT(h.version == SNAPSHOT_VERSION, "Snapshot %s has version %u, expected %u", path, h.version, SNAPSHOT_VERSION);
+    ASSERT(h.particle_size == sizeof(Particle), "Snapshot %s has particles of %u bytes, expected %zu",
+           path, h.particle_size, sizeof(Particle));
+    ASSERT(h.header_size >= sizeof(h) && h.header_size % 16 == 0, "Snapshot %s has bad header size %u",
+           path, h.header_size);
+    ASSERT(h.mass_len <= h.total_len, "Snapshot %s has %u particles with mass out of %u",
+           path, h.mass_len, h.total_len);
+
+    size_t need = h.header_size + (size_t)h.total_len * (sizeof(Particle) + sizeof(uint32_t));
+    ASSERT(size >= need, "Snapshot %s has %zu bytes, %u particles need %zu", path, size, h.total_len, need);
+
+    char *bytes = data;
+    *s = (Snapshot){
+            .header = h,
+            .particles = (Particle *)(bytes + h.header_size),
+            .ids = (uint32_t *)(bytes + h.header_size + (size_t)h.total_len * sizeof(Particle)),
+            .data = data,
+            .size = size,
+    };
+}
+
+void FIO_UnmapSnapshot(Snapshot *s) {
+    if (s != NULL && s->data != NULL) {
+        UnmapFile(s->data, s->size);
+        *s = (Snapshot){0};
+    }
+}
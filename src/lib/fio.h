@@ -1,9 +1,67 @@
 #ifndef NB_FIO_H
 #define NB_FIO_H
 
+#include <nbody.h>
 #include <stddef.h>
+#include <stdint.h>
 
 /* Fully read PATH as binary file and return its content. Content length (in bytes) is stored in SIZE. */
 void *FIO_ReadFile(const char *path, size_t *size);
 
+/* First bytes of every snapshot file. */
+#define SNAPSHOT_MAGIC      "NBODYSNP"
+
+/* Version of the snapshot layout; files of other versions are rejected. */
+#define SNAPSHOT_VERSION    1
+
+/* Snapshot flag: stored acceleration was computed from stored positions. */
+#define SNAPSHOT_ACC_VALID  1u
+
+/*
+ * Header of a snapshot file. It is followed by TOTAL_LEN particles, those with mass first, starting at
+ * HEADER_SIZE bytes, and then by their ids. All numbers are in the byte order of the machine that wrote them.
+ */
+typedef struct SnapshotHeader {
+    char magic[8];          // SNAPSHOT_MAGIC without the terminating zero
+    uint32_t version;       // SNAPSHOT_VERSION
+    uint32_t header_size;   // size of the header in bytes; particles start at this offset
+    uint32_t particle_size; // sizeof(Particle), so that files of another layout are rejected
+    uint32_t total_len;     // number of particles
+    uint32_t mass_len;      // number of particles with mass
+    uint32_t flags;         // SNAPSHOT_* flags
+    double time;            // simulation time
+    float dt;               // time step
+    uint32_t reserved;      // zero
+} SnapshotHeader;
+
+#if __STDC_VERSION__ >= 201112L
+// particles that follow must stay aligned to 16 bytes, the same as in memory
+_Static_assert(sizeof(SnapshotHeader) % 16 == 0, "sizeof(SnapshotHeader) must be a multiple of 16");
+#endif
+
+/* Snapshot file mapped into memory. */
+typedef struct Snapshot {
+    SnapshotHeader header;  // copy of the header
+    Particle *particles;    // particles inside the mapping
+    uint32_t *ids;          // ids of particles inside the mapping
+    void *data;             // the mapping
+    size_t size;            // size of the mapping in bytes
+} Snapshot;
+
+/*
+ * Write snapshot with header H, particles PS and their IDS into PATH, replacing its content. The snapshot is
+ * written into PATH with ".tmp" appended and then moved over PATH, which is never truncated.
+ */
+void FIO_WriteSnapshot(const char *path, const SnapshotHeader *h, const Particle *ps, const uint32_t *ids);
+
+/*
+ * Map snapshot file PATH into memory and check its header. Pages are copy-on-write: particles can be modified
+ * in memory without changing the file, and are only read from disk when first accessed. Where memory mapping
+ * is not supported, the file is read into memory instead.
+ */
+void FIO_MapSnapshot(const char *path, Snapshot *s);
+
+/* Unmap snapshot S. */
+void FIO_UnmapSnapshot(Snapshot *s);
+
 #endif //NB_FIO_H
@@ -0,0 +1,487 @@
+#include "fmm.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* Maximum number of bodies in a leaf; leaves bigger than those of Barnes-Hut tree make fewer expansions. */
+#define FMM_LEAF_CAPACITY   32
+
+/*
+ * Interactions with target nodes of at most this many bodies are postponed and shared between threads;
+ * bigger target nodes are handled by a single thread, but there are few of them.
+ */
+#define FMM_GROUP_SIZE      256
+
+/* Index of coefficient (A, B); coefficients are sorted by degree `A + B`, and by B within the same degree. */
+static inline uint32_t CoefIndex(uint32_t a, uint32_t b) {
+    uint32_t n = a + b;
+    return n * (n + 1) / 2 + b;
+}
+
+/* Fill OUT with `V^k / k!` for k from 0 to ORDER. */
+static inline void ScaledPowers(double v, uint32_t order, double *out) {
+    out[0] = 1;
+    for (uint32_t k = 1; k <= order; k++) {
+        out[k] = out[k - 1] * v / k;
+    }
+}
+
+/* Make sure per-node arrays of F fit the nodes of its tree. */
+static void ReserveNodes(Fmm *f) {
+    uint32_t len = f->tree.node_len;
+    if (len > f->node_cap) {
+        free(f->center);
+        free(f->radius);
+        free(f->mass_count);
+        free(f->depth);
+        free(f->by_depth);
+
+        // the next trees are about the same size, a little extra space saves reallocating every time
+        uint32_t cap = len + len / 4;
+        f->center = ALLOC(cap, V2);
+        f->radius = ALLOC(cap, float);
+        f->mass_count = ALLOC(cap, uint32_t);
+        f->depth = ALLOC(cap, uint8_t);
+        f->by_depth = ALLOC(cap, uint32_t);
+        ASSERT(f->center != NULL && f->radius != NULL && f->mass_count != NULL && f->depth != NULL
+               && f->by_depth != NULL, "Failed to alloc FMM data of %u nodes", cap);
+
+        f->node_cap = cap;
+    }
+
+    size_t coef_len = (size_t)len * f->coef_len;
+    if (coef_len > f->coef_cap) {
+        free(f->multipole);
+        free(f->local);
+
+        size_t cap = coef_len + coef_len / 4;
+        f->multipole = ALLOC(cap, double);
+        f->local = ALLOC(cap, double);
+        ASSERT(f->multipole != NULL && f->local != NULL, "Failed to alloc FMM expansions of %zu coefficients", cap);
+
+        f->coef_cap = cap;
+    }
+}
+
+/* Make sure per-body arrays of F fit COUNT bodies. */
+static void ReserveBodies(Fmm *f, uint32_t count) {
+    if (count <= f->body_cap) return;
+
+    free(f->r);
+    free(f->ax);
+    free(f->ay);
+
+    f->r = ALLOC(count, float);
+    f->ax = ALLOC(count, float);
+    f->ay = ALLOC(count, float);
+    ASSERT(f->r != NULL && f->ax != NULL && f->ay != NULL, "Failed to alloc FMM bodies for %u particles", count);
+
+    f->body_cap = count;
+}
+
+/* Sort nodes of F by depth. */
+static void SortByDepth(Fmm *f) {
+    const Quadtree *t = &f->tree;
+    uint32_t count[QT_MAX_DEPTH + 2] = {0};
+
+    // children always come after their parent
+    f->depth[0] = 0;
+    f->max_depth = 0;
+    for (uint32_t i = 0; i < t->node_len; i++) {
+        uint8_t d = f->depth[i];
+        if (t->nodes[i].child != 0) {
+            for (uint32_t q = 0; q < 4; q++) {
+                f->depth[t->nodes[i].child + q] = d + 1;
+            }
+        }
+        if (d > f->max_depth) f->max_depth = d;
+        count[d + 1]++;
+    }
+
+    for (uint32_t d = 0; d <= QT_MAX_DEPTH; d++) {
+        count[d + 1] += count[d];
+    }
+    memcpy(f->depth_start, count, sizeof(count));
+    for (uint32_t i = 0; i < t->node_len; i++) {
+        f->by_depth[count[f->depth[i]]++] = i;
+    }
+}
+
+/*
+ * Multipole expansion of node I: M(a, b) is the sum of `m * dx^a * dy^b / (a! * b!)` over its bodies with mass,
+ * where (dx, dy) is the center of the node relative to a body. Expansions of children must be known.
+ * Also clears everything that FmmAccel accumulates.
+ */
+static void Upward(Fmm *f, uint32_t i, uint32_t mass_len) {
+    const Quadtree *t = &f->tree;
+    const QuadNode *n = &t->nodes[i];
+    const uint32_t order = f->order;
+
+    // dipole moment around center of mass is zero, which makes expansions of the same order more accurate
+    V2 center = n->com;
+    f->center[i] = center;
+    f->radius[i] = MagV2(V2_FROM(fabsf(center.x - n->center.x) + n->half, fabsf(center.y - n->center.y) + n->half));
+
+    double *m = &f->multipole[(size_t)i * f->coef_len];
+    memset(m, 0, f->coef_len * sizeof(double));
+    memset(&f->local[(size_t)i * f->coef_len], 0, f->coef_len * sizeof(double));
+
+    if (n->child == 0) {
+        // bodies with mass have lower indices and their order is kept, so they come first
+        uint32_t end = n->first;
+        while (end < n->first + n->count && t->idx[end] < mass_len) end++;
+        f->mass_count[i] = end - n->first;
+
+        for (uint32_t k = n->first; k < end; k++) {
+            double px[NB_MAX_FMM_ORDER + 1], py[NB_MAX_FMM_ORDER + 1];
+            ScaledPowers(center.x - t->x[k], order, px);
+            ScaledPowers(center.y - t->y[k], order, py);
+
+            for (uint32_t deg = 0; deg <= order; deg++) {
+                for (uint32_t b = 0; b <= deg; b++) {
+                    m[CoefIndex(deg - b, b)] += t->m[k] * px[deg - b] * py[b];
+                }
+            }
+        }
+        for (uint32_t k = n->first; k < n->first + n->count; k++) {
+            f->ax[k] = f->ay[k] = 0;
+        }
+        return;
+    }
+
+    f->mass_count[i] = 0;
+    for (uint32_t q = 0; q < 4; q++) {
+        uint32_t c = n->child + q;
+        f->mass_count[i] += f->mass_count[c];
+        if (f->mass_count[c] == 0) continue;
+
+        // `(s + d)^k / k!` expanded with binomial theorem, where S is the node's center relative to the child's
+        const double *cm = &f->multipole[(size_t)c * f->coef_len];
+        double sx[NB_MAX_FMM_ORDER + 1], sy[NB_MAX_FMM_ORDER + 1];
+        ScaledPowers(center.x - f->center[c].x, order, sx);
+        ScaledPowers(center.y - f->center[c].y, order, sy);
+
+        for (uint32_t deg = 0; deg <= order; deg++) {
+            for (uint32_t kb = 0; kb <= deg; kb++) {
+                uint32_t ka = deg - kb;
+                double sum = 0;
+                for (uint32_t ja = 0; ja <= ka; ja++) {
+                    for (uint32_t jb = 0; jb <= kb; jb++) {
+                        sum += sx[ka - ja] * sy[kb - jb] * cm[CoefIndex(ja, jb)];
+                    }
+                }
+                m[CoefIndex(ka, kb)] += sum;
+            }
+        }
+    }
+}
+
+/* Arguments of the loops over nodes of one depth. */
+typedef struct FmmLoop {
+    Fmm *f;
+    ParticleSoA *soa;
+    uint32_t mass_len;
+    float theta;
+    uint32_t first;     // position in BY_DEPTH that item 0 of the loop is
+} FmmLoop;
+
+static void UpwardChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const FmmLoop *l = ctx;
+    (void)tid;
+    for (uint32_t k = l->first + from; k < l->first + to; k++) {
+        Upward(l->f, l->f->by_depth[k], l->mass_len);
+    }
+}
+
+void BuildFmm(Fmm *f, Pool *pool, const ParticleSoA *soa, uint32_t count, uint32_t mass_len, uint32_t order) {
+    ASSERT(order >= 1 && order <= NB_MAX_FMM_ORDER, "FMM order must be from 1 to %d, got %u",
+           NB_MAX_FMM_ORDER, order);
+
+    // building the tree is sequential
+    f->tree.leaf_cap = FMM_LEAF_CAPACITY;
+    BuildQuadtree(&f->tree, soa, count);
+
+    f->order = order;
+    f->coef_len = FMM_COEF_LEN(order);
+    ReserveNodes(f);
+    ReserveBodies(f, count);
+    SortByDepth(f);
+
+    for (uint32_t k = 0; k < count; k++) {
+        f->r[k] = soa->r[f->tree.idx[k]];
+    }
+
+    // expansions of children are needed by their parents, so levels go from the deepest one up
+    FmmLoop l = {.f = f, .mass_len = mass_len};
+    for (uint32_t d = f->max_depth + 1; d > 0; d--) {
+        l.first = f->depth_start[d - 1];
+        PoolFor(pool, "fmm upward", f->depth_start[d] - l.first, 16, UpwardChunk, &l);
+    }
+}
+
+/*
+ * Derivatives of `1 / dist` at (X, Y): D(a, b) is `d^(a+b) / dx^a dy^b (1 / dist)`. They follow from
+ * `dist^2 * grad(1 / dist) + (x, y) / dist = 0` differentiated n - 1 times, where n = a + b:
+ * `n * dist^2 * D(a, b) = -(2n - 1) * (a * x * D(a-1, b) + b * y * D(a, b-1))
+ *                         - (n - 1) * (a * (a-1) * D(a-2, b) + b * (b-1) * D(a, b-2))`.
+ */
+static void Derivatives(double x, double y, uint32_t order, double *d) {
+    double u = x * x + y * y;
+    d[0] = 1 / sqrt(u);
+
+    for (uint32_t n = 1; n <= order; n++) {
+        for (uint32_t b = 0; b <= n; b++) {
+            uint32_t a = n - b;
+            double first = 0, second = 0;
+            if (a >= 1) first += a * x * d[CoefIndex(a - 1, b)];
+            if (b >= 1) first += b * y * d[CoefIndex(a, b - 1)];
+            if (a >= 2) second += a * (a - 1) * d[CoefIndex(a - 2, b)];
+            if (b >= 2) second += b * (b - 1) * d[CoefIndex(a, b - 2)];
+
+            d[CoefIndex(a, b)] = -((2 * n - 1) * first + (n - 1) * second) / (n * u);
+        }
+    }
+}
+
+/*
+ * Add multipole expansion of SOURCE to local expansion of TARGET. Local expansion L(n) is the n-th derivative
+ * of potential at the node's center; Taylor series of `1 / dist` of every body around the offset R between
+ * centers give `L(n) = sum of M(k) * D(k + n)(R)` over k with `|k + n| <= ORDER`.
+ */
+static void M2L(Fmm *f, uint32_t target, uint32_t source) {
+    const uint32_t order = f->order;
+    V2 r = SubV2(f->center[target], f->center[source]);
+
+    double d[FMM_COEF_LEN(NB_MAX_FMM_ORDER)];
+    Derivatives(r.x, r.y, order, d);
+
+    const double *m = &f->multipole[(size_t)source * f->coef_len];
+    double *l = &f->local[(size_t)target * f->coef_len];
+
+    for (uint32_t deg = 0; deg <= order; deg++) {
+        for (uint32_t nb = 0; nb <= deg; nb++) {
+            // M(k) of the same degree are contiguous, and so are D(k + n)
+            double sum = 0;
+            for (uint32_t kdeg = 0; kdeg <= order - deg; kdeg++) {
+                const double *mk = &m[CoefIndex(kdeg, 0)];
+                const double *dk = &d[CoefIndex(kdeg + deg - nb, nb)];
+                for (uint32_t kb = 0; kb <= kdeg; kb++) {
+                    sum += mk[kb] * dk[kb];
+                }
+            }
+            l[CoefIndex(deg - nb, nb)] += sum;
+        }
+    }
+}
+
+/* Add gravity of bodies with mass of SOURCE to bodies of TARGET, the same way as CpuKernel.accel. */
+static void P2P(Fmm *f, uint32_t target, uint32_t source) {
+    const Quadtree *t = &f->tree;
+    const QuadNode *nt = &t->nodes[target], *ns = &t->nodes[source];
+    uint32_t from = ns->first, to = ns->first + f->mass_count[source];
+
+    for (uint32_t k = nt->first; k < nt->first + nt->count; k++) {
+        float px = t->x[k], py = t->y[k], radius = f->r[k];
+        float ax = 0, ay = 0;
+
+        for (uint32_t j = from; j < to; j++) {
+            float dx = t->x[j] - px;
+            float dy = t->y[j] - py;
+
+            float r2 = dx * dx + dy * dy + radius;
+            float r1 = sqrtf(r2);
+            float g = t->m[j] / (r1 * r2);
+
+            ax += dx * g;
+            ay += dy * g;
+        }
+        f->ax[k] += NB_G * ax;
+        f->ay[k] += NB_G * ay;
+    }
+}
+
+/* Append interaction of TARGET and SOURCE to postponed ones. */
+static void PushPair(Fmm *f, uint32_t target, uint32_t source) {
+    if (f->pair_len == f->pair_cap) {
+        uint32_t cap = f->pair_cap == 0 ? 256 : 2 * f->pair_cap;
+        FmmPair *pairs = realloc(f->pairs, cap * sizeof(FmmPair));
+        uint32_t *groups = realloc(f->groups, (cap + 1) * sizeof(uint32_t));
+        ASSERT(pairs != NULL && groups != NULL, "Failed to realloc %u FMM interactions", cap);
+
+        f->pairs = pairs;
+        f->groups = groups;
+        f->pair_cap = cap;
+    }
+    f->pairs[f->pair_len++] = (FmmPair){.target = target, .source = source};
+}
+
+/*
+ * Dual tree traversal: add gravity of bodies of SOURCE to bodies of TARGET, through expansions if the nodes are
+ * far enough from each other, directly if both are leaves, otherwise through the children of the bigger node.
+ * If DEFER is true, interactions with small enough targets are postponed instead.
+ */
+static void Interact(Fmm *f, uint32_t target, uint32_t source, float theta, bool defer) {
+    const QuadNode *nt = &f->tree.nodes[target], *ns = &f->tree.nodes[source];
+    if (nt->count == 0 || f->mass_count[source] == 0) return;
+
+    if (defer && nt->count <= FMM_GROUP_SIZE) {
+        PushPair(f, target, source);
+        return;
+    }
+
+    V2 r = SubV2(f->center[source], f->center[target]);
+    if (f->radius[target] + f->radius[source] < theta * MagV2(r)) {
+        M2L(f, target, source);
+        return;
+    }
+
+    bool target_leaf = nt->child == 0, source_leaf = ns->child == 0;
+    if (target_leaf && source_leaf) {
+        P2P(f, target, source);
+    } else if (source_leaf || (!target_leaf && nt->half >= ns->half)) {
+        for (uint32_t q = 0; q < 4; q++) {
+            Interact(f, nt->child + q, source, theta, defer);
+        }
+    } else {
+        for (uint32_t q = 0; q < 4; q++) {
+            Interact(f, target, ns->child + q, theta, defer);
+        }
+    }
+}
+
+static int ComparePairs(const void *a, const void *b) {
+    const FmmPair *x = a, *y = b;
+    if (x->target != y->target) return x->target < y->target ? -1 : 1;
+    return (x->source > y->source) - (x->source < y->source);
+}
+
+/* Sort postponed interactions by target and find where every target's interactions start. */
+static void GroupPairs(Fmm *f) {
+    f->group_len = 0;
+    if (f->pair_len == 0) return;
+
+    qsort(f->pairs, f->pair_len, sizeof(FmmPair), ComparePairs);
+    for (uint32_t k = 0; k < f->pair_len; k++) {
+        if (k == 0 || f->pairs[k].target != f->pairs[k - 1].target) {
+            f->groups[f->group_len++] = k;
+        }
+    }
+    f->groups[f->group_len] = f->pair_len;
+}
+
+/*
+ * Pass local expansion of node I to its children, or evaluate it at the bodies of a leaf and store their
+ * acceleration into SOA. Local expansion of the node's parent must already be passed to it.
+ */
+static void Downward(Fmm *f, ParticleSoA *soa, uint32_t i) {
+    const Quadtree *t = &f->tree;
+    const QuadNode *n = &t->nodes[i];
+    const uint32_t order = f->order;
+    const double *l = &f->local[(size_t)i * f->coef_len];
+
+    if (n->count == 0) return;
+
+    if (n->child == 0) {
+        // acceleration is the gradient of potential, whose derivatives are one degree higher
+        for (uint32_t k = n->first; k < n->first + n->count; k++) {
+            double ex[NB_MAX_FMM_ORDER + 1], ey[NB_MAX_FMM_ORDER + 1];
+            ScaledPowers(t->x[k] - f->center[i].x, order, ex);
+            ScaledPowers(t->y[k] - f->center[i].y, order, ey);
+
+            double gx = 0, gy = 0;
+            for (uint32_t deg = 0; deg < order; deg++) {
+                for (uint32_t b = 0; b <= deg; b++) {
+                    uint32_t a = deg - b;
+                    gx += l[CoefIndex(a + 1, b)] * ex[a] * ey[b];
+                    gy += l[CoefIndex(a, b + 1)] * ex[a] * ey[b];
+                }
+            }
+
+            uint32_t p = t->idx[k];
+            soa->ax[p] = (float)(NB_G * gx) + f->ax[k];
+            soa->ay[p] = (float)(NB_G * gy) + f->ay[k];
+        }
+        return;
+    }
+
+    for (uint32_t q = 0; q < 4; q++) {
+        uint32_t c = n->child + q;
+        if (t->nodes[c].count == 0) continue;
+
+        // Taylor series of every derivative around the child's center, with offset S from the node's center
+        double *cl = &f->local[(size_t)c * f->coef_len];
+        double sx[NB_MAX_FMM_ORDER + 1], sy[NB_MAX_FMM_ORDER + 1];
+        ScaledPowers(f->center[c].x - f->center[i].x, order, sx);
+        ScaledPowers(f->center[c].y - f->center[i].y, order, sy);
+
+        for (uint32_t deg = 0; deg <= order; deg++) {
+            for (uint32_t jb = 0; jb <= deg; jb++) {
+                uint32_t ja = deg - jb;
+                double sum = 0;
+                for (uint32_t edeg = 0; edeg <= order - deg; edeg++) {
+                    for (uint32_t eb = 0; eb <= edeg; eb++) {
+                        sum += sx[edeg - eb] * sy[eb] * l[CoefIndex(ja + edeg - eb, jb + eb)];
+                    }
+                }
+                cl[CoefIndex(ja, jb)] += sum;
+            }
+        }
+    }
+}
+
+static void GroupChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const FmmLoop *l = ctx;
+    Fmm *f = l->f;
+    (void)tid;
+    for (uint32_t g = from; g < to; g++) {
+        for (uint32_t k = f->groups[g]; k < f->groups[g + 1]; k++) {
+            Interact(f, f->pairs[k].target, f->pairs[k].source, l->theta, false);
+        }
+    }
+}
+
+static void DownwardChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const FmmLoop *l = ctx;
+    (void)tid;
+    for (uint32_t k = l->first + from; k < l->first + to; k++) {
+        Downward(l->f, l->soa, l->f->by_depth[k]);
+    }
+}
+
+void FmmAccel(Fmm *f, Pool *pool, ParticleSoA *soa, float theta) {
+    // interactions with big targets are found and computed by one thread, the rest are postponed
+    f->pair_len = 0;
+    Interact(f, 0, 0, theta, true);
+    GroupPairs(f);
+
+    // every group only writes to its target's subtree, and subtrees of different groups do not overlap
+    FmmLoop l = {.f = f, .soa = soa, .theta = theta};
+    PoolFor(pool, "fmm pairs", f->group_len, 1, GroupChunk, &l);
+
+    // local expansions of parents are needed by their children, so levels go from the root down
+    for (uint32_t d = 0; d <= f->max_depth; d++) {
+        l.first = f->depth_start[d];
+        PoolFor(pool, "fmm downward", f->depth_start[d + 1] - l.first, 16, DownwardChunk, &l);
+    }
+}
+
+void FreeFmm(Fmm *f) {
+    if (f != NULL) {
+        FreeQuadtree(&f->tree);
+        free(f->multipole);
+        free(f->local);
+        free(f->center);
+        free(f->radius);
+        free(f->mass_count);
+        free(f->depth);
+        free(f->by_depth);
+        free(f->r);
+        free(f->ax);
+        free(f->ay);
+        free(f->pairs);
+        free(f->groups);
+        *f = (Fmm){0};
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef NB_FMM_H
+#define NB_FMM_H
+
+#include <nbody.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "pool.h"
+#include "quadtree.h"
+#include "sim_cpu.h"
+
+/*
+ * Fast multipole method. Gravity `NB_G * m / dist^2` is the gradient of potential `m / dist`, which is not
+ * harmonic in the plane, so expansions are Cartesian Taylor series in (x, y) rather than complex power series.
+ * A coefficient (a, b) belongs to `dx^a * dy^b`; expansions of order P have every (a, b) with `a + b <= P`.
+ */
+
+/* Number of coefficients of an expansion of ORDER. */
+#define FMM_COEF_LEN(ORDER)     (((ORDER) + 1) * ((ORDER) + 2) / 2)
+
+/* Interaction of two nodes whose evaluation is postponed, so that threads can share it. */
+typedef struct FmmPair {
+    uint32_t target;    // node whose bodies get acceleration
+    uint32_t source;    // node whose bodies with mass pull them
+} FmmPair;
+
+/*
+ * FMM over a quadtree of all particles. Particles without mass are only targets: nodes without mass are never
+ * sources, and since building the tree keeps the order of bodies, bodies with mass come first in every node.
+ * Memory is reused between builds; zero-initialized FMM is empty.
+ */
+typedef struct Fmm {
+    Quadtree tree;          // tree over all particles
+    uint32_t order;         // order of expansions
+    uint32_t coef_len;      // coefficients per expansion
+    double *multipole;      // moments of bodies with mass of every node around its center, COEF_LEN per node
+    double *local;          // derivatives of potential of far nodes at every node's center, COEF_LEN per node
+    V2 *center;             // center of expansions of every node: its center of mass, if it has mass
+    float *radius;          // distance from center of every node to its farthest corner
+    uint32_t *mass_count;   // number of bodies with mass of every node
+    uint8_t *depth;         // depth of every node
+    uint32_t *by_depth;     // nodes sorted by depth
+    uint32_t depth_start[QT_MAX_DEPTH + 2]; // nodes of depth D are by_depth[depth_start[D] .. depth_start[D + 1])
+    uint32_t max_depth;     // depth of the deepest node
+    uint32_t node_cap;      // capacity of per-node arrays other than expansions
+    size_t coef_cap;        // capacity of MULTIPOLE and LOCAL in coefficients
+    float *r, *ax, *ay;     // radius and acceleration of bodies in tree order
+    uint32_t body_cap;      // capacity of per-body arrays
+    FmmPair *pairs;         // postponed interactions, sorted by target node
+    uint32_t *groups;       // pairs of the k-th target node are pairs[groups[k] .. groups[k + 1])
+    uint32_t pair_len;      // number of postponed interactions
+    uint32_t group_len;     // number of target nodes with postponed interactions
+    uint32_t pair_cap;      // capacity of PAIRS and GROUPS
+} Fmm;
+
+/*
+ * Build tree of F over the first COUNT particles of SOA, the first MASS_LEN of which have mass,
+ * and compute multipole expansions of ORDER. Building the tree is sequential, expansions are computed on POOL.
+ */
+void BuildFmm(Fmm *f, Pool *pool, const ParticleSoA *soa, uint32_t count, uint32_t mass_len, uint32_t order);
+
+/*
+ * Set acceleration of the particles of SOA that F was built over. Two nodes with centers at distance D,
+ * whose bodies are within R1 and R2 of their centers, interact through expansions if `(R1 + R2) / D < THETA`,
+ * otherwise directly or through their children. Only direct interactions are softened, the same way as
+ * in CpuKernel.accel. Interactions with big nodes are found by the caller, the rest of the work is shared on POOL.
+ */
+void FmmAccel(Fmm *f, Pool *pool, ParticleSoA *soa, float theta);
+
+/* Free memory of F. */
+void FreeFmm(Fmm *f);
+
+#endif //NB_FMM_H
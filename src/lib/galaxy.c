@@ -1,8 +1,12 @@
 #include "galaxy.h"
+#include "affinity.h"
+#include "pool.h"
+#include "quadtree.h"
 #include "util.h"
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <math.h>
 
 typedef struct GalaxyData {
@@ -12,23 +16,316 @@ typedef struct GalaxyData {
     uint32_t offset;        // first index of this galaxy's particles from global particle array
     float min_dist;         // minimum distance between the core and particles
     float max_dist;         // maximum distance between the core and particles
+    float spiral_offsets[MAX_SPIRALS];  // angle of every spiral
+    uint32_t spiral_count;  // number of spirals
+    float spiral_angle;     // angle between neighbouring spirals
+    float b, t0, t1;        // spirals are `r(t) = b * t` from angle T0 to T1
 } GalaxyData;
 
+/* How many particles a worker generates at a time. */
+#define GALAXY_CHUNK    1024
+
+/*
+ * Counter-based random numbers: the N-th number of stream (SEED, KEY) is a function of SEED, KEY and N alone,
+ * so particles get the same values no matter which thread generates them or in what order.
+ * Each stream is a SplitMix64 sequence that starts at a state derived from SEED and KEY.
+ */
+typedef struct Rng {
+    uint64_t state;
+} Rng;
+
+/* Keys of streams: galaxy setup uses a single one, and every particle has its own, keyed by its index. */
+#define SETUP_KEY       0
+#define PARTICLE_KEY(I) (1 + (uint64_t)(I))
+
+/* SplitMix64 finalizer; a bijection that spreads every bit of X over the whole result. */
+static uint64_t Mix(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9u;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBu;
+    return x ^ (x >> 31);
+}
+
+/* Stream KEY of generator SEED. */
+static Rng MakeRng(uint64_t seed, uint64_t key) {
+    return (Rng){.state = Mix(seed ^ Mix(key + 0x9E3779B97F4A7C15u))};
+}
+
+/* Next 64 random bits of RNG. */
+static uint64_t RandBits(Rng *rng) {
+    rng->state += 0x9E3779B97F4A7C15u;
+    return Mix(rng->state);
+}
+
 /* Random float in range [MIN, MAX). */
-static float RandFloat(double min, double max) {
-    return (float)(min + (max - min) * rand() / RAND_MAX);
+static float RandFloat(Rng *rng, double min, double max) {
+    double unit = (double)(RandBits(rng) >> 11) / 9007199254740992.0;   // 53 random bits over 2^53
+    return (float)(min + (max - min) * unit);
 }
 
 /* Random uint32_t in range [MIN, MAX). */
-static uint32_t RandUInt(uint32_t min, uint32_t max) {
-    return min + ((uint32_t)rand() % (max - min));
+static uint32_t RandUInt(Rng *rng, uint32_t min, uint32_t max) {
+    return min + (uint32_t)(((RandBits(rng) >> 32) * (max - min)) >> 32);
+}
+
+static bool RandBool(Rng *rng) {
+    return RandBits(rng) >> 63;
+}
+
+/*
+ * Spatial hash of placed galaxy cores. Cells are squares no smaller than the largest separation any two galaxies
+ * need, so galaxies too close to a point are in its cell or the 8 around it. Cells are hashed into buckets,
+ * since galaxies spread over an area that is not known in advance.
+ */
+typedef struct CoreGrid {
+    float cell;         // side of cells
+    uint32_t mask;      // number of buckets minus 1; the number is a power of 2
+    uint32_t *head;     // first galaxy of every bucket; NO_CORE if there is none
+    uint32_t *next;     // next galaxy of the same bucket after every galaxy
+} CoreGrid;
+
+/* End of a bucket. */
+#define NO_CORE     UINT32_MAX
+
+/* Empty grid for COUNT galaxies of GALAXIES, whose sizes are already known. */
+static void MakeCoreGrid(CoreGrid *g, const GalaxyData *galaxies, uint32_t count) {
+    float max_dist = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        max_dist = fmaxf(max_dist, galaxies[i].max_dist);
+    }
+
+    uint32_t buckets = 1;
+    while (buckets < 2 * count) buckets *= 2;
+
+    g->cell = MIN_GALAXY_SEPARATION * 2 * max_dist;
+    g->mask = buckets - 1;
+    g->head = ALLOC(buckets, uint32_t);
+    g->next = ALLOC(count, uint32_t);
+    ASSERT(g->head != NULL && g->next != NULL, "Failed to alloc grid of %u galaxies", count);
+
+    for (uint32_t b = 0; b < buckets; b++) {
+        g->head[b] = NO_CORE;
+    }
+}
+
+static void FreeCoreGrid(CoreGrid *g) {
+    free(g->head);
+    free(g->next);
+}
+
+/* Cell coordinate of X. */
+static int32_t CellOf(const CoreGrid *g, float x) {
+    return (int32_t)floorf(x / g->cell);
+}
+
+/* Bucket of cell (CX, CY). */
+static uint32_t BucketOf(const CoreGrid *g, int32_t cx, int32_t cy) {
+    uint32_t h = (uint32_t)cx * 0x9E3779B1u ^ (uint32_t)cy * 0x85EBCA77u;
+    return (h ^ (h >> 16)) & g->mask;
 }
 
-static bool RandBool() {
-    return rand() & 1;
+/* Add the core of galaxy I, which is placed, to G. */
+static void InsertCore(CoreGrid *g, const GalaxyData *galaxies, uint32_t i) {
+    V2 pos = galaxies[i].core->pos;
+    uint32_t b = BucketOf(g, CellOf(g, pos.x), CellOf(g, pos.y));
+    g->next[i] = g->head[b];
+    g->head[b] = i;
 }
 
-Particle *MakeGalaxies(uint32_t particle_count, uint32_t galaxy_count) {
+/* Whether galaxy I at its current position is too close to any galaxy in G but PARENT. */
+static bool Collides(const CoreGrid *g, const GalaxyData *galaxies, uint32_t i, uint32_t parent) {
+    GalaxyData galaxy = galaxies[i];
+    int32_t cx = CellOf(g, galaxy.core->pos.x);
+    int32_t cy = CellOf(g, galaxy.core->pos.y);
+
+    // neighbour cells may share a bucket, then some galaxies are checked twice
+    for (int32_t y = cy - 1; y <= cy + 1; y++) {
+        for (int32_t x = cx - 1; x <= cx + 1; x++) {
+            for (uint32_t j = g->head[BucketOf(g, x, y)]; j != NO_CORE; j = g->next[j]) {
+                if (j == parent) continue;
+                GalaxyData other = galaxies[j];
+
+                float other_min_sep = MIN_GALAXY_SEPARATION * (galaxy.max_dist + other.max_dist);
+                float other_sq_dist = SqMagV2(SubV2(galaxy.core->pos, other.core->pos));
+
+                // other galaxy is too close to the chosen position
+                if (other_sq_dist < other_min_sep * other_min_sep) return true;
+            }
+        }
+    }
+    return false;
+}
+
+/*
+ * Sum of `W * (dy, -dx) / dist^1.5` over bodies of T with weights W at (dx, dy) from POS, other than one at POS.
+ * A node is approximated by its weighted center if POS is outside of it and `node size / distance < GALAXY_KICK_THETA`.
+ */
+static V2 KickSum(const Quadtree *t, V2 pos) {
+    const float theta_sq = GALAXY_KICK_THETA * GALAXY_KICK_THETA;
+    float sx = 0, sy = 0;
+
+    // every visited node pushes at most 4 children, so the stack never exceeds 3 nodes per level plus 4
+    uint32_t stack[4 * QT_MAX_DEPTH + 4];
+    uint32_t top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        const QuadNode *n = &t->nodes[stack[--top]];
+        if (n->mass <= 0) continue;
+
+        float dx = n->com.x - pos.x;
+        float dy = n->com.y - pos.y;
+        float dist_sq = dx * dx + dy * dy;
+        float size = 2.f * n->half;
+        bool outside = fabsf(pos.x - n->center.x) > n->half || fabsf(pos.y - n->center.y) > n->half;
+
+        if (outside && size * size < theta_sq * dist_sq) {
+            // far enough to treat the whole node as a single body
+            float dist = sqrtf(dist_sq);
+            float f = n->mass / (dist * sqrtf(dist));
+            sx += dy * f;
+            sy -= dx * f;
+        } else if (n->child == 0) {
+            for (uint32_t k = n->first; k < n->first + n->count; k++) {
+                float bx = t->x[k] - pos.x;
+                float by = t->y[k] - pos.y;
+                float d2 = bx * bx + by * by;
+                if (d2 == 0) continue;
+
+                float d = sqrtf(d2);
+                float f = t->m[k] / (d * sqrtf(d));
+                sx += by * f;
+                sy -= bx * f;
+            }
+        } else {
+            for (uint32_t q = 0; q < 4; q++) {
+                stack[top++] = n->child + q;
+            }
+        }
+    }
+    return V2_FROM(sx, sy);
+}
+
+/* Arguments of the loop of Kick. */
+typedef struct KickLoop {
+    GalaxyData *galaxies;
+    Quadtree tree;
+} KickLoop;
+
+static void KickChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const KickLoop *l = ctx;
+    const float scale = 0.3f * sqrtf(NB_G);
+    (void)tid;
+
+    for (uint32_t i = from; i < to; i++) {
+        Particle *core = l->galaxies[i].core;
+        V2 sum = KickSum(&l->tree, core->pos);
+        core->vel = AddV2(core->vel, ScaleV2(sum, scale));
+    }
+}
+
+/*
+ * Give every galaxy core a fraction of "orbital speed" (won't actually work as orbital speed) around every other one,
+ * `0.3 * sqrt(NB_G * mass / dist)` across the direction to it. The speed is linear in the square root of mass,
+ * so cores are put in a quadtree with that as their mass, and far groups of them act as a single one.
+ */
+static void Kick(Pool *pool, GalaxyData *galaxies, uint32_t count) {
+    ParticleSoA cores;
+    AllocParticleSoA(&cores, count);
+    for (uint32_t i = 0; i < count; i++) {
+        cores.x[i] = galaxies[i].core->pos.x;
+        cores.y[i] = galaxies[i].core->pos.y;
+        cores.m[i] = sqrtf(galaxies[i].core->mass);
+    }
+
+    KickLoop l = {.galaxies = galaxies, .tree = {0}};
+    BuildQuadtree(&l.tree, &cores, count);
+
+    // tree walks differ in length, which stealing evens out
+    PoolFor(pool, "galaxy kick", count, 16, KickChunk, &l);
+
+    FreeQuadtree(&l.tree);
+    FreeParticleSoA(&cores);
+}
+
+/* Arguments of the loop that creates particles. */
+typedef struct ParticleLoop {
+    const GalaxyData *galaxies;
+    uint32_t galaxy_count;
+    uint64_t seed;
+} ParticleLoop;
+
+/* Create particle J > 0 of GALAXY from its own random stream. */
+static void MakeParticle(const GalaxyData *galaxy, uint32_t j, uint64_t seed) {
+    Particle *p = &galaxy->particles[j];
+    Particle core = *galaxy->core;
+    *p = (Particle){0};
+    Rng rng = MakeRng(seed, PARTICLE_KEY(galaxy->offset + j));
+
+    // difference between minimum and maximum distance
+    // used to decide whether particle is massless or not
+    float dist_range = galaxy->max_dist - galaxy->min_dist;
+
+    // initial angle and distance
+    float t = RandFloat(&rng, galaxy->t0, galaxy->t1);
+    float r = galaxy->b * t;
+
+    // add some randomness to make the spiral look more natural
+    // non-uniform distribution is used to make sure spirals keep their shape
+    float t_offset = RandFloat(&rng, 0, 0.6f * sqrtf(galaxy->spiral_angle));
+    float r_offset = RandFloat(&rng, 0, 0.6f * sqrtf(fminf(galaxy->b, r - galaxy->min_dist)));
+
+    float dist = r + (RandBool(&rng) ? -1.f : 1.f) * (r_offset * r_offset);
+    float ang = t + (RandBool(&rng) ? -1.f : 1.f) * (t_offset * t_offset);
+
+    // convert polar coordinates to cartesian
+    float spiral_offset = galaxy->spiral_offsets[RandUInt(&rng, 0, galaxy->spiral_count)];
+    float dx = dist * cosf(ang + spiral_offset);
+    float dy = dist * sinf(ang + spiral_offset);
+
+    p->pos.x = core.pos.x + dx;
+    p->pos.y = core.pos.y + dy;
+
+    // the farther away from the core, the higher the chance of a particle being massless
+    if (RandFloat(&rng, 0.f, 1.f) < (dist - galaxy->min_dist) / dist_range) {
+        p->radius = 0.5f;
+        p->mass = 0.f;
+    } else {
+        p->radius = RandFloat(&rng, NP_MIN_R, NP_MAX_R);
+        p->mass = NP_R_TO_M(p->radius);
+    }
+
+    // give the particle orbital velocity
+    float speed = sqrtf(NB_G * core.mass / dist);
+    p->vel.x = core.vel.x + speed * (dy / dist);
+    p->vel.y = core.vel.y + speed * (-dx / dist);
+}
+
+/* Create particles [FROM, TO) of the whole array; cores are already made. */
+static void ParticleChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const ParticleLoop *l = ctx;
+    (void)tid;
+
+    // the last galaxy that starts at or before FROM; offsets are increasing
+    uint32_t lo = 0, hi = l->galaxy_count;
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (l->galaxies[mid].offset <= from) lo = mid;
+        else hi = mid;
+    }
+
+    for (uint32_t i = from, g = lo; i < to; i++) {
+        while (g + 1 < l->galaxy_count && l->galaxies[g + 1].offset <= i) g++;
+
+        const GalaxyData *galaxy = &l->galaxies[g];
+        if (i > galaxy->offset) MakeParticle(galaxy, i - galaxy->offset, l->seed);
+    }
+}
+
+Particle *MakeGalaxies(uint32_t particle_count, uint32_t galaxy_count, uint64_t seed) {
+    return MakeGalaxiesEx(particle_count, galaxy_count, seed, 0);
+}
+
+Particle *MakeGalaxiesEx(uint32_t particle_count, uint32_t galaxy_count, uint64_t seed, uint32_t threads) {
     ASSERT(particle_count >= galaxy_count * MIN_PARTICLES_PER_GALAXY,
            "Need at least %u particles to make %u galaxies, called with %u",
            galaxy_count * MIN_PARTICLES_PER_GALAXY, galaxy_count, particle_count);
@@ -39,6 +336,11 @@ Particle *MakeGalaxies(uint32_t particle_count, uint32_t galaxy_count) {
     GalaxyData *galaxies = ALLOC(galaxy_count, GalaxyData);
     ASSERT(galaxies != NULL, "Failed to alloc %u galaxies", galaxy_count);
 
+    InitAffinity();
+    Pool *pool = CreatePool(threads > 0 ? threads : GetCpuCount(), false);
+
+    Rng rng = MakeRng(seed, SETUP_KEY);
+
     // how many particles can be randomly distributed between galaxies
     uint32_t rand_range = particle_count - galaxy_count * MIN_PARTICLES_PER_GALAXY;
 
@@ -49,7 +351,7 @@ Particle *MakeGalaxies(uint32_t particle_count, uint32_t galaxy_count) {
             // the last galaxy gets all that's left
             size = rand_range;
         } else {
-            size = RandUInt(0, 1 + rand_range);
+            size = RandUInt(&rng, 0, 1 + rand_range);
             rand_range -= size;
         }
 
@@ -66,7 +368,7 @@ Particle *MakeGalaxies(uint32_t particle_count, uint32_t galaxy_count) {
 
     // randomize core and calculate galaxy radius
     for (uint32_t i = 0; i < galaxy_count; i++) {
-        float core_radius = RandFloat(GC_MIN_R, GC_MAX_R);
+        float core_radius = RandFloat(&rng, GC_MIN_R, GC_MAX_R);
         float size_root = sqrtf((float)galaxies[i].size);
 
         galaxies[i].min_dist = core_radius * MIN_PARTICLE_DIST_CR_F;
@@ -79,13 +381,17 @@ Particle *MakeGalaxies(uint32_t particle_count, uint32_t galaxy_count) {
     }
 
     // randomize galaxy position; first galaxy is always stationary at (0, 0)
+    CoreGrid grid;
+    MakeCoreGrid(&grid, galaxies, galaxy_count);
+    InsertCore(&grid, galaxies, 0);
+
     for (uint32_t i = 1; i < galaxy_count; i++) {
         GalaxyData galaxy = galaxies[i];
         bool collision = true;
 
         while (collision) {
             // choose a random initialized galaxy as a starting point
-            uint32_t parent_idx = RandUInt(0, i);
+            uint32_t parent_idx = RandUInt(&rng, 0, i);
             GalaxyData parent = galaxies[parent_idx];
 
             // find minimum and maximum distance
@@ -93,72 +399,32 @@ Particle *MakeGalaxies(uint32_t particle_count, uint32_t galaxy_count) {
             float max_sep = MAX_GALAXY_SEPARATION * (galaxy.max_dist + parent.max_dist);
 
             // choose a random point within a circle
-            float dist = sqrtf(RandFloat(min_sep * min_sep, max_sep * max_sep));
-            float angle = RandFloat(0, 2 * PI);
+            float dist = sqrtf(RandFloat(&rng, min_sep * min_sep, max_sep * max_sep));
+            float angle = RandFloat(&rng, 0, 2 * PI);
 
             galaxy.core->pos.x = parent.core->pos.x + dist * cosf(angle);
             galaxy.core->pos.y = parent.core->pos.y + dist * sinf(angle);
 
             // check if new position collides with any previous galaxy
-            collision = false;
-            for (uint32_t j = 0; j < i; j++) {
-                if (j == parent_idx) continue;
-                GalaxyData other = galaxies[j];
-
-                float other_min_sep = MIN_GALAXY_SEPARATION * (galaxy.max_dist + other.max_dist);
-                float other_sq_dist = SqMagV2(SubV2(galaxy.core->pos, other.core->pos));
-
-                if (other_sq_dist < other_min_sep * other_min_sep) {
-                    // other galaxy is too close to the chosen position
-                    collision = true;
-                    break;
-                }
-            }
+            collision = Collides(&grid, galaxies, i, parent_idx);
         }
+        InsertCore(&grid, galaxies, i);
     }
+    FreeCoreGrid(&grid);
 
     // give galaxies some velocity to avoid head-on collision
-    for (uint32_t i = 1; i < galaxy_count; i++) {
-        Particle *a = galaxies[i].core;
-
-        for (uint32_t j = 0; j < i; j++) {
-            if (i == j) continue;
-            Particle *b = galaxies[j].core;
-
-            V2 a_to_b = SubV2(b->pos, a->pos);      // vector from a to b
-            float dist = MagV2(a_to_b);             // distance between a adn b
-            V2 unit = ScaleV2(a_to_b, 1.f / dist);  // unit vector
-
-            // calculate a fraction of "orbital speed" (won't actually work as orbital speed)
-            float speed_a = 0.3f * sqrtf(NB_G * b->mass / dist);
-            float speed_b = 0.3f * sqrtf(NB_G * a->mass / dist);
-
-            V2 dv_a = ScaleV2(V2_FROM(unit.y, -unit.x), speed_a);
-            V2 dv_b = ScaleV2(V2_FROM(-unit.y, unit.x), speed_b);
+    Kick(pool, galaxies, galaxy_count);
 
-            a->vel = AddV2(a->vel, dv_a);
-            b->vel = AddV2(b->vel, dv_b);
-        }
-    }
-
-    // create particles
+    // make spirals of every galaxy, which its particles only read
     for (uint32_t i = 0; i < galaxy_count; i++) {
-        GalaxyData galaxy = galaxies[i];
-        Particle core = *galaxy.core;
-
-        // difference between minimum and maximum distance
-        // used to decide whether particle is massless or not
-        float dist_range = galaxy.max_dist - galaxy.min_dist;
+        GalaxyData *galaxy = &galaxies[i];
+        float initial_offset = RandFloat(&rng, 0, 2 * PI);  // to make each galaxy's spirals have different rotations
 
-        // make spirals for the galaxy
-        float spiral_offsets[MAX_SPIRALS];              // offset of each spiral
-        float initial_offset = RandFloat(0, 2 * PI);    // to make each galaxy's spirals have different rotations
+        galaxy->spiral_count = RandUInt(&rng, MIN_SPIRALS, 1 + MAX_SPIRALS);
+        galaxy->spiral_angle = 2 * PI / (float)galaxy->spiral_count;
 
-        uint32_t spiral_count = RandUInt(MIN_SPIRALS, 1 + MAX_SPIRALS);
-        float spiral_angle_dist = 2 * PI / (float)spiral_count;
-
-        for (uint32_t j = 0; j < spiral_count; j++) {
-            spiral_offsets[j] = initial_offset + (float)j * spiral_angle_dist;
+        for (uint32_t j = 0; j < galaxy->spiral_count; j++) {
+            galaxy->spiral_offsets[j] = initial_offset + (float)j * galaxy->spiral_angle;
         }
 
         /*
@@ -171,51 +437,16 @@ Particle *MakeGalaxies(uint32_t particle_count, uint32_t galaxy_count) {
          *      2.  start with angle T0 at distance R0 = `galaxy.min_dist`;
          *          (R0 == r(T0) == b * T0  =>  T0 == R0 / b)
          */
-        float t1 = 2 * PI;
-        float b = galaxy.max_dist / t1;
-        float t0 = galaxy.min_dist / b;
-
-        // start at 1 because first particle is the core
-        for (uint32_t j = 1; j < galaxy.size; j++) {
-            Particle *p = &galaxy.particles[j];
-            *p = (Particle){0};
-
-            // initial angle and distance
-            float t = RandFloat(t0, t1);
-            float r = b * t;
-
-            // add some randomness to make the spiral look more natural
-            // non-uniform distribution is used to make sure spirals keep their shape
-            float t_offset = RandFloat(0, 0.6f * sqrtf(spiral_angle_dist));
-            float r_offset = RandFloat(0, 0.6f * sqrtf(fminf(b, r - galaxy.min_dist)));
-
-            float dist = r + (RandBool() ? -1.f : 1.f) * (r_offset * r_offset);
-            float ang = t + (RandBool() ? -1.f : 1.f) * (t_offset * t_offset);
-
-            // convert polar coordinates to cartesian
-            float spiral_offset = spiral_offsets[RandUInt(0, spiral_count)];
-            float dx = dist * cosf(ang + spiral_offset);
-            float dy = dist * sinf(ang + spiral_offset);
-
-            p->pos.x = core.pos.x + dx;
-            p->pos.y = core.pos.y + dy;
-
-            // the farther away from the core, the higher the chance of a particle being massless
-            if (RandFloat(0.f, 1.f) < (dist - galaxy.min_dist) / dist_range) {
-                p->radius = 0.5f;
-                p->mass = 0.f;
-            } else {
-                p->radius = RandFloat(NP_MIN_R, NP_MAX_R);
-                p->mass = NP_R_TO_M(p->radius);
-            }
-
-            // give the particle orbital velocity
-            float speed = sqrtf(NB_G * core.mass / dist);
-            p->vel.x = core.vel.x + speed * (dy / dist);
-            p->vel.y = core.vel.y + speed * (-dx / dist);
-        }
+        galaxy->t1 = 2 * PI;
+        galaxy->b = galaxy->max_dist / galaxy->t1;
+        galaxy->t0 = galaxy->min_dist / galaxy->b;
     }
 
+    // create particles of all galaxies in a single loop
+    ParticleLoop l = {.galaxies = galaxies, .galaxy_count = galaxy_count, .seed = seed};
+    PoolFor(pool, "galaxy particles", particle_count, GALAXY_CHUNK, ParticleChunk, &l);
+
+    DestroyPool(pool);
     free(galaxies);
     return particles;
 }
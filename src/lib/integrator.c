@@ -0,0 +1,67 @@
+#include "integrator.h"
+#include "util.h"
+
+/*
+ * Forest-Ruth coefficient `1 / (2 - 2^(1/3))`. One update is
+ * `D(θ/2) K(θ) D((1-θ)/2) K(1-2θ) D((1-θ)/2) K(θ) D(θ/2)`, where D is drift and K is kick.
+ */
+#define FR_THETA        1.35120719195965763f
+#define FR_HALF_THETA   0.675603595979828817f
+#define FR_OUTER_DRIFT  (-0.175603595979828817f)   // (1 - θ) / 2
+#define FR_INNER_KICK   (-1.70241438391931527f)    // 1 - 2θ
+
+Schedule MakeSchedule(Integrator integrator, uint32_t n, bool acc_valid) {
+    ASSERT_DBG(n > 0, "Schedule of 0 updates is not allowed");
+    Schedule s = {.n = n};
+
+    switch (integrator) {
+        case INTEGRATOR_LEAPFROG:
+            // K(1/2) D(1) K(1/2); the last kick of an update and the first kick of the next one are merged
+            s.head[0] = (Stage){.kick = 0.5f, .drift = 1.f, .accel = !acc_valid};
+            s.body[0] = (Stage){.kick = 1.f, .drift = 1.f, .accel = true};
+            s.tail[0] = (Stage){.kick = 0.5f, .drift = 0.f, .accel = true};
+            s.head_len = s.body_len = s.tail_len = 1;
+            break;
+        case INTEGRATOR_FOREST_RUTH:
+            // the last drift of an update and the first drift of the next one are merged
+            s.head[0] = (Stage){.kick = 0.f, .drift = FR_HALF_THETA, .accel = false};
+            s.body[0] = (Stage){.kick = FR_THETA, .drift = FR_OUTER_DRIFT, .accel = true};
+            s.body[1] = (Stage){.kick = FR_INNER_KICK, .drift = FR_OUTER_DRIFT, .accel = true};
+            s.body[2] = (Stage){.kick = FR_THETA, .drift = FR_THETA, .accel = true};
+            s.tail[0] = s.body[0];
+            s.tail[1] = s.body[1];
+            s.tail[2] = (Stage){.kick = FR_THETA, .drift = FR_HALF_THETA, .accel = true};
+            s.head_len = 1;
+            s.body_len = s.tail_len = 3;
+            break;
+        case INTEGRATOR_EULER:
+        default:
+            s.body[0] = (Stage){.kick = 1.f, .drift = 1.f, .accel = true};
+            s.tail[0] = s.body[0];
+            s.head_len = 0;
+            s.body_len = s.tail_len = 1;
+            break;
+    }
+    return s;
+}
+
+uint32_t ScheduleLength(const Schedule *s) {
+    return s->head_len + (s->n - 1) * s->body_len + s->tail_len;
+}
+
+Stage GetStage(const Schedule *s, uint32_t k) {
+    if (k < s->head_len) return s->head[k];
+    k -= s->head_len;
+
+    uint32_t body_total = (s->n - 1) * s->body_len;
+    if (k < body_total) return s->body[k % s->body_len];
+    k -= body_total;
+
+    ASSERT_DBG(k < s->tail_len, "Stage index is out of bounds");
+    return s->tail[k];
+}
+
+bool ScheduleLeavesAccValid(const Schedule *s) {
+    // positions do not change after the last force evaluation
+    return s->tail[s->tail_len - 1].drift == 0;
+}
@@ -0,0 +1,45 @@
+#ifndef NB_INTEGRATOR_H
+#define NB_INTEGRATOR_H
+
+#include <nbody.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Every integrator is a sequence of stages, which both CPU and GPU simulations run one after another.
+ * A stage optionally sets acceleration from current positions, then does `vel += kick * acc * dt`
+ * followed by `pos += drift * vel * dt`.
+ */
+typedef struct Stage {
+    float kick;     // velocity step as a fraction of dt
+    float drift;    // position step as a fraction of dt
+    bool accel;     // whether acceleration is computed before the kick; otherwise the stored one is used
+} Stage;
+
+/*
+ * Stages of N updates: HEAD, then N - 1 times BODY, then TAIL.
+ * Adjacent stages of consecutive updates are merged where possible, so that e.g. N leapfrog updates
+ * need N force evaluations rather than 2N.
+ */
+typedef struct Schedule {
+    Stage head[1], body[3], tail[3];
+    uint32_t head_len, body_len, tail_len;
+    uint32_t n;     // number of updates
+} Schedule;
+
+/*
+ * Schedule of N > 0 updates using INTEGRATOR. ACC_VALID tells whether stored acceleration of particles
+ * was computed from their current positions; integrators that start with a kick need it.
+ */
+Schedule MakeSchedule(Integrator integrator, uint32_t n, bool acc_valid);
+
+/* Total number of stages of S. */
+uint32_t ScheduleLength(const Schedule *s);
+
+/* K-th stage of S, K < ScheduleLength(S). */
+Stage GetStage(const Schedule *s, uint32_t k);
+
+/* Whether stored acceleration is computed from final positions after all stages of S. */
+bool ScheduleLeavesAccValid(const Schedule *s);
+
+#endif //NB_INTEGRATOR_H
@@ -0,0 +1,77 @@
+#include "morton.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <float.h>
+#include <math.h>
+
+/* Spread the lower 16 bits of V so that there is a zero bit between every two of them. */
+static uint32_t Spread(uint32_t v) {
+    v &= 0xFFFF;
+    v = (v | (v << 8)) & 0x00FF00FF;
+    v = (v | (v << 4)) & 0x0F0F0F0F;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+uint32_t MortonCode(uint32_t x, uint32_t y) {
+    return Spread(x) | (Spread(y) << 1);
+}
+
+void MortonOrder(const Particle *ps, uint32_t len, uint32_t *order) {
+    if (len == 0) return;
+
+    float min_x = FLT_MAX, min_y = FLT_MAX, max_x = -FLT_MAX, max_y = -FLT_MAX;
+    for (uint32_t i = 0; i < len; i++) {
+        if (ps[i].pos.x < min_x) min_x = ps[i].pos.x;
+        if (ps[i].pos.y < min_y) min_y = ps[i].pos.y;
+        if (ps[i].pos.x > max_x) max_x = ps[i].pos.x;
+        if (ps[i].pos.y > max_y) max_y = ps[i].pos.y;
+    }
+
+    // the same scale for both axes keeps the curve's cells square
+    float side = fmaxf(max_x - min_x, max_y - min_y);
+    float scale = side > 0 ? 65535.f / side : 0.f;
+
+    uint32_t *keys = ALLOC(2 * len, uint32_t);
+    uint32_t *tmp = ALLOC(len, uint32_t);
+    ASSERT(keys != NULL && tmp != NULL, "Failed to alloc Morton keys of %u particles", len);
+
+    for (uint32_t i = 0; i < len; i++) {
+        uint32_t qx = (uint32_t)((ps[i].pos.x - min_x) * scale);
+        uint32_t qy = (uint32_t)((ps[i].pos.y - min_y) * scale);
+        keys[i] = MortonCode(qx, qy);
+        order[i] = i;
+    }
+
+    // LSD radix sort of (key, index) pairs, 8 bits per pass; every pass is stable
+    uint32_t *src_keys = keys, *dst_keys = keys + len;
+    uint32_t *src = order, *dst = tmp;
+
+    for (uint32_t shift = 0; shift < 32; shift += 8) {
+        uint32_t count[257] = {0};
+        for (uint32_t i = 0; i < len; i++) {
+            count[((src_keys[i] >> shift) & 0xFF) + 1]++;
+        }
+        for (int b = 0; b < 256; b++) {
+            count[b + 1] += count[b];
+        }
+        for (uint32_t i = 0; i < len; i++) {
+            uint32_t at = count[(src_keys[i] >> shift) & 0xFF]++;
+            dst_keys[at] = src_keys[i];
+            dst[at] = src[i];
+        }
+
+        // after an even number of passes the result is back in ORDER
+        uint32_t *swap = src_keys;
+        src_keys = dst_keys;
+        dst_keys = swap;
+        swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    free(keys);
+    free(tmp);
+}
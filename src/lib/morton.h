@@ -0,0 +1,16 @@
+#ifndef NB_MORTON_H
+#define NB_MORTON_H
+
+#include <nbody.h>
+#include <stdint.h>
+
+/* Interleave the lower 16 bits of X and Y into a 32-bit Morton code; bits of X go to even positions. */
+uint32_t MortonCode(uint32_t x, uint32_t y);
+
+/*
+ * Fill ORDER with indices of LEN particles of PS sorted along the Morton curve over their bounding box,
+ * so that particles close in space are close in ORDER. The sort is stable.
+ */
+void MortonOrder(const Particle *ps, uint32_t len, uint32_t *order);
+
+#endif //NB_MORTON_H
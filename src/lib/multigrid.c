@@ -0,0 +1,577 @@
+#include "multigrid.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+/* Span of a newly placed grid relative to the span of particles. */
+#define MG_PADDING          1.5f
+
+/* Gauss-Seidel sweeps before and after coarse correction, and on the coarsest level. */
+#define MG_PRE_SWEEPS       2
+#define MG_POST_SWEEPS      2
+#define MG_COARSE_SWEEPS    32
+
+/* The solve stops when the largest residual falls under this fraction of the largest right-hand side. */
+#define MG_TOLERANCE        1e-4f
+
+/* Maximum number of V-cycles per solve. */
+#define MG_MAX_CYCLES       16
+
+/* How many particles a worker interpolates acceleration of at a time. */
+#define MG_CHUNK            256
+
+/* How many rows of nodes a worker processes at a time; rows of the coarsest levels fit a single chunk. */
+#define MG_ROWS             16
+
+#define MG_PI               3.14159265358979323846f
+
+/* Number of nodes of a level with N cells per side. */
+static inline size_t LevelNodes(uint32_t n) {
+    return (size_t)(n + 1) * (n + 1) * (n / 2 + 1);
+}
+
+/* Index of node (I, J, K) of level L. */
+static inline size_t NodeIndex(const MgLevel *l, uint32_t i, uint32_t j, uint32_t k) {
+    size_t s = l->n + 1;
+    return ((size_t)k * s + j) * s + i;
+}
+
+/* Number of blocks per side of a grid of N cells per side. */
+static inline uint32_t BlockCount(uint32_t n) {
+    return n < MG_BLOCKS ? n : MG_BLOCKS;
+}
+
+static void FreeLevels(Multigrid *mg) {
+    for (uint32_t l = 0; l < mg->level_len; l++) {
+        free(mg->levels[l].phi);
+        free(mg->levels[l].rhs);
+        free(mg->levels[l].res);
+    }
+    mg->level_len = 0;
+}
+
+/* Make sure MG fits a grid of GRID cells per side and THREADS grids of mass. */
+static void Reserve(Multigrid *mg, uint32_t grid, int threads) {
+    if (grid != mg->grid) {
+        FreeLevels(mg);
+        free(mg->gx);
+        free(mg->gy);
+
+        // zeroed memory is the boundary of coarse levels and the right-hand side off the plane
+        for (uint32_t n = grid; n >= 4; n /= 2) {
+            MgLevel *l = &mg->levels[mg->level_len++];
+            size_t len = LevelNodes(n);
+            *l = (MgLevel){
+                    .n = n,
+                    .phi = calloc(len, sizeof(float)),
+                    .rhs = calloc(len, sizeof(float)),
+                    .res = calloc(len, sizeof(float)),
+            };
+            ASSERT(l->phi != NULL && l->rhs != NULL && l->res != NULL, "Failed to alloc multigrid level of %zu nodes", len);
+        }
+
+        size_t plane = (size_t)(grid + 1) * (grid + 1);
+        mg->gx = ALLOC(plane, float);
+        mg->gy = ALLOC(plane, float);
+        ASSERT(mg->gx != NULL && mg->gy != NULL, "Failed to alloc multigrid plane of %zu nodes", plane);
+
+        mg->grid = grid;
+        mg->placed = false;
+
+        // grids of mass have the old size
+        free(mg->mass);
+        mg->mass = NULL;
+        mg->threads = 0;
+    }
+    if (threads > mg->threads) {
+        free(mg->mass);
+        free(mg->bounds);
+        free(mg->maxes);
+
+        size_t len = (size_t)threads * (grid + 1) * (grid + 1);
+        mg->mass = ALLOC(len, float);
+        mg->bounds = ALLOC(4 * threads, float);
+        mg->maxes = ALLOC(threads, float);
+        ASSERT(mg->mass != NULL && mg->bounds != NULL && mg->maxes != NULL,
+               "Failed to alloc %d multigrid planes of %u cells", threads, grid);
+
+        mg->threads = threads;
+    }
+}
+
+/* Arguments of the loops of MultigridAccel. */
+typedef struct MgLoop {
+    Multigrid *mg;
+    ParticleSoA *soa;
+    uint32_t count, mass_len;
+    int slices;         // number of slices of particles, one per plane of mass
+    MgLevel *level;     // level of loops over rows of nodes
+    MgLevel *coarse;    // the next coarser level, for restriction and prolongation
+    uint32_t color;     // color of smoothing
+} MgLoop;
+
+/* Rows of nodes of level L, each of interior nodes with the same (j, k); row R is (1 + R % (N - 1), R / (N - 1)). */
+static inline uint32_t RowCount(const MgLevel *l) {
+    return l->n / 2 * (l->n - 1);
+}
+
+/* Run loop FN over LEN items, whose chunks keep the largest value of their worker in MAXES; return the largest. */
+static float LoopMax(Pool *pool, const char *name, uint32_t len, uint32_t chunk, PoolFn fn, MgLoop *l) {
+    Multigrid *mg = l->mg;
+    for (int t = 0; t < l->slices; t++) {
+        mg->maxes[t] = 0;
+    }
+    PoolFor(pool, name, len, chunk, fn, l);
+
+    float max = 0;
+    for (int t = 0; t < l->slices; t++) {
+        max = fmaxf(max, mg->maxes[t]);
+    }
+    return max;
+}
+
+/* One red-black Gauss-Seidel half-sweep over nodes of the level with `(i + j + k) % 2 == COLOR`. */
+static void SmoothChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const MgLoop *lp = ctx;
+    MgLevel *l = lp->level;
+    const uint32_t n = l->n, color = lp->color;
+    const size_t s = n + 1, plane = s * s;
+    const float h2 = l->h * l->h;
+    (void)tid;
+
+    for (uint32_t r = from; r < to; r++) {
+        uint32_t k = r / (n - 1), j = 1 + r % (n - 1);
+        float *p = l->phi + NodeIndex(l, 0, j, k);
+        const float *f = l->rhs + NodeIndex(l, 0, j, k);
+
+        // the plane mirrors nodes above it
+        const float *above = p + plane, *below = k > 0 ? p - plane : above;
+        const float *north = p + s, *south = p - s;
+
+        for (uint32_t i = 1 + ((j + k + color) & 1); i < n; i += 2) {
+            p[i] = (p[i - 1] + p[i + 1] + north[i] + south[i] + above[i] + below[i] - h2 * f[i]) / 6;
+        }
+    }
+}
+
+/* Red-black Gauss-Seidel sweeps over level L. */
+static void Smooth(Pool *pool, MgLoop *lp, MgLevel *l, uint32_t sweeps) {
+    lp->level = l;
+    for (uint32_t k = 0; k < sweeps; k++) {
+        for (lp->color = 0; lp->color < 2; lp->color++) {
+            PoolFor(pool, "mg smooth", RowCount(l), MG_ROWS, SmoothChunk, lp);
+        }
+    }
+}
+
+/* Compute residual of the level, and keep the largest absolute residual of the worker. */
+static void ResidualChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const MgLoop *lp = ctx;
+    MgLevel *l = lp->level;
+    const uint32_t n = l->n;
+    const size_t s = n + 1, plane = s * s;
+    const float inv_h2 = 1.f / (l->h * l->h);
+    float max = 0;
+
+    for (uint32_t r = from; r < to; r++) {
+        uint32_t k = r / (n - 1), j = 1 + r % (n - 1);
+        size_t at = NodeIndex(l, 0, j, k);
+        const float *p = l->phi + at, *f = l->rhs + at;
+        const float *above = p + plane, *below = k > 0 ? p - plane : above;
+        const float *north = p + s, *south = p - s;
+        float *res = l->res + at;
+
+        for (uint32_t i = 1; i < n; i++) {
+            float lap = (p[i - 1] + p[i + 1] + north[i] + south[i] + above[i] + below[i] - 6 * p[i]) * inv_h2;
+            res[i] = f[i] - lap;
+            max = fmaxf(max, fabsf(res[i]));
+        }
+    }
+    lp->mg->maxes[tid] = fmaxf(lp->mg->maxes[tid], max);
+}
+
+/* Compute residual of level L; returns the largest absolute residual. */
+static float Residual(Pool *pool, MgLoop *lp, MgLevel *l) {
+    lp->level = l;
+    return LoopMax(pool, "mg residual", RowCount(l), MG_ROWS, ResidualChunk, lp);
+}
+
+/* Full-weighting restriction of residual of the level into right-hand side of the coarse level; clears the latter. */
+static void RestrictChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    static const float w[3] = {0.25f, 0.5f, 0.25f};
+    const MgLoop *lp = ctx;
+    const MgLevel *f = lp->level;
+    MgLevel *c = lp->coarse;
+    const uint32_t n = c->n;
+    (void)tid;
+
+    for (uint32_t r = from; r < to; r++) {
+        uint32_t k = r / (n - 1), j = 1 + r % (n - 1);
+        float *rhs = c->rhs + NodeIndex(c, 0, j, k);
+        float *phi = c->phi + NodeIndex(c, 0, j, k);
+
+        for (uint32_t i = 1; i < n; i++) {
+            float sum = 0;
+            for (int dz = -1; dz <= 1; dz++) {
+                // the plane mirrors nodes above it
+                uint32_t fk = (uint32_t)abs(2 * (int)k + dz);
+                for (int dy = -1; dy <= 1; dy++) {
+                    const float *row = f->res + NodeIndex(f, 2 * i, 2 * j + dy, fk);
+                    sum += w[dz + 1] * w[dy + 1] * (0.25f * row[-1] + 0.5f * row[0] + 0.25f * row[1]);
+                }
+            }
+            rhs[i] = sum;
+            phi[i] = 0;
+        }
+    }
+}
+
+/* Add trilinear interpolation of correction of the coarse level to potential of the level. */
+static void ProlongChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const MgLoop *lp = ctx;
+    MgLevel *f = lp->level;
+    const MgLevel *c = lp->coarse;
+    const uint32_t n = f->n;
+    (void)tid;
+
+    for (uint32_t r = from; r < to; r++) {
+        uint32_t k = r / (n - 1), j = 1 + r % (n - 1);
+        float *phi = f->phi + NodeIndex(f, 0, j, k);
+
+        // odd fine nodes are halfway between two coarse ones, even nodes coincide with one, which is taken twice
+        const float *c00 = c->phi + NodeIndex(c, 0, j / 2, k / 2);
+        const float *c01 = c->phi + NodeIndex(c, 0, (j + 1) / 2, k / 2);
+        const float *c10 = c->phi + NodeIndex(c, 0, j / 2, (k + 1) / 2);
+        const float *c11 = c->phi + NodeIndex(c, 0, (j + 1) / 2, (k + 1) / 2);
+
+        for (uint32_t i = 1; i < n; i++) {
+            uint32_t i0 = i / 2, i1 = (i + 1) / 2;
+            phi[i] += 0.125f * (c00[i0] + c00[i1] + c01[i0] + c01[i1] + c10[i0] + c10[i1] + c11[i0] + c11[i1]);
+        }
+    }
+}
+
+/* V-cycle from level L down. */
+static void VCycle(Multigrid *mg, Pool *pool, MgLoop *lp, uint32_t l) {
+    MgLevel *lv = &mg->levels[l];
+
+    if (l + 1 == mg->level_len) {
+        Smooth(pool, lp, lv, MG_COARSE_SWEEPS);
+        return;
+    }
+
+    Smooth(pool, lp, lv, MG_PRE_SWEEPS);
+    (void)Residual(pool, lp, lv);
+
+    lp->level = lv;
+    lp->coarse = lv + 1;
+    PoolFor(pool, "mg restrict", RowCount(lv + 1), MG_ROWS, RestrictChunk, lp);
+
+    VCycle(mg, pool, lp, l + 1);
+
+    lp->level = lv;
+    lp->coarse = lv + 1;
+    PoolFor(pool, "mg prolong", RowCount(lv), MG_ROWS, ProlongChunk, lp);
+
+    Smooth(pool, lp, lv, MG_POST_SWEEPS);
+}
+
+/* Grid coordinate U of position P is split into node I in [1, N - 2] and fraction F of the next node. */
+static inline void Locate(float p, float origin, float inv_h, uint32_t n, uint32_t *i, float *f) {
+    float u = (p - origin) * inv_h;
+    float fl = floorf(u);
+    if (fl < 1) fl = 1;
+    if (fl > (float)(n - 2)) fl = (float)(n - 2);
+
+    *i = (uint32_t)fl;
+    *f = u - fl;
+}
+
+/* First of LEN items that slice K of SLICES starts at. */
+static inline uint32_t SliceStart(uint32_t len, uint32_t k, int slices) {
+    return (uint32_t)((uint64_t)len * k / (uint32_t)slices);
+}
+
+/* Find bounding box of every slice of particles. */
+static void BoundsChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const MgLoop *l = ctx;
+    const ParticleSoA *soa = l->soa;
+    (void)tid;
+
+    for (uint32_t k = from; k < to; k++) {
+        float lo[2] = {FLT_MAX, FLT_MAX}, hi[2] = {-FLT_MAX, -FLT_MAX};
+        for (uint32_t i = SliceStart(l->count, k, l->slices); i < SliceStart(l->count, k + 1, l->slices); i++) {
+            lo[0] = fminf(lo[0], soa->x[i]);
+            lo[1] = fminf(lo[1], soa->y[i]);
+            hi[0] = fmaxf(hi[0], soa->x[i]);
+            hi[1] = fmaxf(hi[1], soa->y[i]);
+        }
+
+        float *b = l->mg->bounds + 4 * k;
+        b[0] = lo[0], b[1] = lo[1], b[2] = hi[0], b[3] = hi[1];
+    }
+}
+
+/*
+ * Find bounding box of particles and place the grid over it, unless the old place still fits them:
+ * particles must stay at least a block away from the edges, and must not have shrunk to a small part of the grid.
+ */
+static void Place(Multigrid *mg, Pool *pool, MgLoop *l) {
+    PoolFor(pool, "mg bounds", (uint32_t)l->slices, 1, BoundsChunk, l);
+
+    mg->lo[0] = mg->lo[1] = FLT_MAX;
+    mg->hi[0] = mg->hi[1] = -FLT_MAX;
+    for (int t = 0; t < l->slices; t++) {
+        const float *b = mg->bounds + 4 * t;
+        for (int k = 0; k < 2; k++) {
+            mg->lo[k] = fminf(mg->lo[k], b[k]);
+            mg->hi[k] = fmaxf(mg->hi[k], b[2 + k]);
+        }
+    }
+
+    const uint32_t n = mg->grid;
+    float span = fmaxf(mg->hi[0] - mg->lo[0], mg->hi[1] - mg->lo[1]);
+    float size = (float)n * mg->h;
+    float edge = (float)(n / BlockCount(n)) * mg->h;
+
+    bool fits = mg->placed
+                && mg->lo[0] >= mg->x0 + edge && mg->hi[0] <= mg->x0 + size - edge
+                && mg->lo[1] >= mg->y0 + edge && mg->hi[1] <= mg->y0 + size - edge
+                && span * MG_PADDING * 2 >= size;
+
+    if (!fits) {
+        mg->h = (span > 0 ? span : 1.f) * MG_PADDING / (float)n;
+        mg->x0 = 0.5f * (mg->lo[0] + mg->hi[0]) - 0.5f * (float)n * mg->h;
+        mg->y0 = 0.5f * (mg->lo[1] + mg->hi[1]) - 0.5f * (float)n * mg->h;
+        for (uint32_t l = 0; l < mg->level_len; l++) {
+            mg->levels[l].h = mg->h * (float)(1u << l);
+        }
+
+        // the old solution belongs to another grid
+        memset(mg->levels[0].phi, 0, LevelNodes(n) * sizeof(float));
+        mg->placed = true;
+    }
+}
+
+/*
+ * Spread mass of every slice of particles with mass over its own plane. Slices are fixed rather than taken by
+ * whoever is free, so that sums of mass do not depend on how the loop was shared.
+ */
+static void DepositChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const MgLoop *l = ctx;
+    const Multigrid *mg = l->mg;
+    const ParticleSoA *soa = l->soa;
+    const uint32_t n = mg->grid;
+    const size_t s = n + 1;
+    const float inv_h = 1.f / mg->h;
+    (void)tid;
+
+    for (uint32_t k = from; k < to; k++) {
+        float *mass = mg->mass + (size_t)k * s * s;
+        memset(mass, 0, s * s * sizeof(float));
+
+        for (uint32_t i = SliceStart(l->mass_len, k, l->slices); i < SliceStart(l->mass_len, k + 1, l->slices); i++) {
+            uint32_t ix, iy;
+            float fx, fy;
+            Locate(soa->x[i], mg->x0, inv_h, n, &ix, &fx);
+            Locate(soa->y[i], mg->y0, inv_h, n, &iy, &fy);
+
+            float *row = mass + iy * s + ix;
+            float mi = soa->m[i];
+            row[0] += mi * (1 - fx) * (1 - fy);
+            row[1] += mi * fx * (1 - fy);
+            row[s] += mi * (1 - fx) * fy;
+            row[s + 1] += mi * fx * fy;
+        }
+    }
+}
+
+/* Sum rows of mass over planes into the first one and set right-hand side of the plane from it. */
+static void SumChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const MgLoop *l = ctx;
+    Multigrid *mg = l->mg;
+    const uint32_t n = mg->grid;
+    const size_t s = n + 1;
+    const float inv_h = 1.f / mg->h;
+
+    // mass of a node is its density times the cell volume
+    const float scale = 4 * MG_PI * inv_h * inv_h * inv_h;
+    float *rhs = mg->levels[0].rhs;
+    float max = 0;
+
+    for (uint32_t j = from; j < to; j++) {
+        float *dst = mg->mass + j * s;
+        for (int t = 1; t < l->slices; t++) {
+            const float *src = mg->mass + (size_t)t * s * s + j * s;
+            for (uint32_t i = 0; i <= n; i++) {
+                dst[i] += src[i];
+            }
+        }
+        for (uint32_t i = 0; i <= n; i++) {
+            rhs[j * s + i] = scale * dst[i];
+            max = fmaxf(max, rhs[j * s + i]);
+        }
+    }
+    mg->maxes[tid] = fmaxf(mg->maxes[tid], max);
+}
+
+/* Spread mass over the plane of the finest level; returns the largest right-hand side. */
+static float Deposit(Multigrid *mg, Pool *pool, MgLoop *l) {
+    PoolFor(pool, "mg deposit", (uint32_t)l->slices, 1, DepositChunk, l);
+    return LoopMax(pool, "mg sum", mg->grid + 1, MG_ROWS, SumChunk, l);
+}
+
+/* Find mass and center of mass of blocks of the plane. */
+static void BlockChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const MgLoop *l = ctx;
+    Multigrid *mg = l->mg;
+    const uint32_t n = mg->grid, nb = BlockCount(n), bs = n / nb;
+    const size_t s = n + 1;
+    const float *mass = mg->mass;   // summed over planes
+    (void)tid;
+
+    for (uint32_t b = from; b < to; b++) {
+        uint32_t bx = b % nb, by = b / nb;
+        uint32_t x_end = bx + 1 == nb ? n + 1 : (bx + 1) * bs;
+        uint32_t y_end = by + 1 == nb ? n + 1 : (by + 1) * bs;
+
+        float m = 0, mx = 0, my = 0;
+        for (uint32_t j = by * bs; j < y_end; j++) {
+            for (uint32_t i = bx * bs; i < x_end; i++) {
+                float v = mass[j * s + i];
+                m += v;
+                mx += v * (float)i;
+                my += v * (float)j;
+            }
+        }
+        mg->block_m[b] = m;
+        mg->block_c[b] = m > 0 ? V2_FROM(mg->x0 + mx / m * mg->h, mg->y0 + my / m * mg->h) : V2_ZERO;
+    }
+}
+
+/* Set potential at boundary nodes of rows (j, k); side faces take two nodes of most rows, the rest whole rows. */
+static void FaceChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const MgLoop *lp = ctx;
+    const Multigrid *mg = lp->mg;
+    const uint32_t n = mg->grid, kt = n / 2, nb = BlockCount(n);
+    const size_t s = n + 1;
+    MgLevel *l = &lp->mg->levels[0];
+    (void)tid;
+
+    for (uint32_t r = from; r < to; r++) {
+        uint32_t k = r / s, j = r % s;
+        bool whole = k == kt || j == 0 || j == n;
+        uint32_t step = whole ? 1 : n;
+
+        float y = mg->y0 + (float)j * mg->h, z = (float)k * mg->h;
+        float *phi = l->phi + NodeIndex(l, 0, j, k);
+
+        for (uint32_t i = 0; i <= n; i += step) {
+            float x = mg->x0 + (float)i * mg->h;
+            float sum = 0;
+            for (uint32_t b = 0; b < nb * nb; b++) {
+                float dx = mg->block_c[b].x - x, dy = mg->block_c[b].y - y;
+                sum += mg->block_m[b] / sqrtf(dx * dx + dy * dy + z * z);
+            }
+            phi[i] = -sum;
+        }
+    }
+}
+
+/* Set potential at the boundary of the finest level from monopoles of blocks of the plane. */
+static void Boundary(Multigrid *mg, Pool *pool, MgLoop *l) {
+    const uint32_t n = mg->grid, nb = BlockCount(n);
+    PoolFor(pool, "mg blocks", nb * nb, 1, BlockChunk, l);
+
+    // rows of the top face and at the edges are much longer than the rest, which stealing evens out
+    PoolFor(pool, "mg boundary", (n / 2 + 1) * (n + 1), 8, FaceChunk, l);
+}
+
+/* Acceleration at interior nodes of the plane from central differences of potential; items are rows from the second. */
+static void GradientChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const MgLoop *l = ctx;
+    Multigrid *mg = l->mg;
+    const uint32_t n = mg->grid;
+    const size_t s = n + 1;
+    const float *phi = mg->levels[0].phi;
+    const float scale = -NB_G / (2 * mg->h);
+    (void)tid;
+
+    for (uint32_t j = 1 + from; j < 1 + to; j++) {
+        const float *row = phi + j * s;
+        float *gx = mg->gx + j * s, *gy = mg->gy + j * s;
+        for (uint32_t i = 1; i < n; i++) {
+            gx[i] = scale * (row[i + 1] - row[i - 1]);
+            gy[i] = scale * (row[i + s] - row[i - s]);
+        }
+    }
+}
+
+/* Interpolate acceleration of particles [FROM, TO) from nodes of the plane, the same way as their mass was spread. */
+static void InterpolateChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const MgLoop *l = ctx;
+    const Multigrid *mg = l->mg;
+    ParticleSoA *soa = l->soa;
+    const uint32_t n = mg->grid;
+    const size_t s = n + 1;
+    const float inv_h = 1.f / mg->h;
+    (void)tid;
+
+    for (uint32_t i = from; i < to; i++) {
+        uint32_t ix, iy;
+        float fx, fy;
+        Locate(soa->x[i], mg->x0, inv_h, n, &ix, &fx);
+        Locate(soa->y[i], mg->y0, inv_h, n, &iy, &fy);
+
+        size_t k = iy * s + ix;
+        float w00 = (1 - fx) * (1 - fy), w10 = fx * (1 - fy), w01 = (1 - fx) * fy, w11 = fx * fy;
+        soa->ax[i] = w00 * mg->gx[k] + w10 * mg->gx[k + 1] + w01 * mg->gx[k + s] + w11 * mg->gx[k + s + 1];
+        soa->ay[i] = w00 * mg->gy[k] + w10 * mg->gy[k + 1] + w01 * mg->gy[k + s] + w11 * mg->gy[k + s + 1];
+    }
+}
+
+void MultigridAccel(Multigrid *mg, Pool *pool, ParticleSoA *soa, uint32_t count, uint32_t mass_len, uint32_t grid) {
+    ASSERT(grid >= 8 && (grid & (grid - 1)) == 0 && grid < (1u << MG_MAX_LEVELS),
+           "Multigrid size must be a power of 2 of at least 8, got %u", grid);
+
+    MgLoop l = {
+            .mg = mg,
+            .soa = soa,
+            .count = count,
+            .mass_len = mass_len,
+            .slices = (int)PoolThreads(pool),
+    };
+    Reserve(mg, grid, l.slices);
+
+    Place(mg, pool, &l);
+    float max_rhs = Deposit(mg, pool, &l);
+    Boundary(mg, pool, &l);
+
+    uint32_t cycles = 0;
+    while (cycles < MG_MAX_CYCLES) {
+        float max_res = Residual(pool, &l, &mg->levels[0]);
+        if (max_res <= MG_TOLERANCE * max_rhs) break;
+
+        VCycle(mg, pool, &l, 0);
+        cycles++;
+    }
+    mg->cycles = cycles;
+
+    PoolFor(pool, "mg gradient", grid - 1, MG_ROWS, GradientChunk, &l);
+    PoolFor(pool, "mg interpolate", count, MG_CHUNK, InterpolateChunk, &l);
+}
+
+void FreeMultigrid(Multigrid *mg) {
+    if (mg != NULL) {
+        FreeLevels(mg);
+        free(mg->mass);
+        free(mg->bounds);
+        free(mg->maxes);
+        free(mg->gx);
+        free(mg->gy);
+        *mg = (Multigrid){0};
+    }
+}
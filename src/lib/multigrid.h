@@ -0,0 +1,66 @@
+#ifndef NB_MULTIGRID_H
+#define NB_MULTIGRID_H
+
+#include <nbody.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "pool.h"
+#include "sim_cpu.h"
+
+/*
+ * Multigrid gravity. Potential `-m / dist` of the force law is that of 3D gravity, so it solves the 3D Poisson
+ * equation `laplace(phi) = 4 * pi * rho` with particles forming a sheet of mass in plane z = 0. The potential
+ * is even in z, so only the half-space z >= 0 is kept: a box of N x N x N/2 cells whose bottom face is the plane
+ * of particles and mirrors the nodes above it. Potential at the other faces comes from a coarse multipole
+ * approximation of the mass, which makes boundaries isolated. The solve is a series of V-cycles with red-black
+ * Gauss-Seidel smoothing that starts from the previous solution, so that a few cycles suffice when particles
+ * move little between updates.
+ */
+
+/* Maximum number of grid levels; the coarsest one has 4 cells per side. */
+#define MG_MAX_LEVELS   16
+
+/* Number of blocks per side whose monopoles give potential at the boundaries. */
+#define MG_BLOCKS       16
+
+/* One level of the grid hierarchy. Node (i, j, k) is at `(k * (n + 1) + j) * (n + 1) + i`. */
+typedef struct MgLevel {
+    uint32_t n;         // cells per side in the plane; there are N/2 cells vertically
+    float h;            // cell size
+    float *phi;         // potential, or its correction on coarse levels
+    float *rhs;         // right-hand side of the Poisson equation
+    float *res;         // residual
+} MgLevel;
+
+/* Multigrid data. Memory and the last solution are reused between calls; zero-initialized multigrid is empty. */
+typedef struct Multigrid {
+    uint32_t grid;          // cells per side of the finest level, N
+    uint32_t level_len;     // number of levels
+    MgLevel levels[MG_MAX_LEVELS];  // levels from the finest to the coarsest
+    float *mass;            // (N + 1) x (N + 1) grids of mass of the plane of every slice of particles
+    float *bounds;          // bounding box of every slice of particles: low x and y, then high x and y
+    float *maxes;           // largest value found by every worker of the pool in the current loop
+    float *gx, *gy;         // acceleration at nodes of the plane, (N + 1) x (N + 1)
+    int threads;            // number of grids of MASS, one per worker of the pool
+    float x0, y0;           // position of node (0, 0, 0)
+    float h;                // cell size of the finest level
+    bool placed;            // whether the grid has a position and a solution to start from
+    float block_m[MG_BLOCKS * MG_BLOCKS];   // mass of every block of the plane
+    V2 block_c[MG_BLOCKS * MG_BLOCKS];      // center of mass of every block
+    float lo[2], hi[2];     // bounding box of particles, combined from slices
+    uint32_t cycles;        // number of V-cycles of the last solve
+} Multigrid;
+
+/*
+ * Set acceleration of the first COUNT particles of SOA to the gravity of its first MASS_LEN particles on a grid
+ * of GRID cells per side that covers all COUNT particles; GRID must be a power of 2 of at least 8. The grid
+ * keeps its position while particles stay well inside it, and is moved and solved from scratch otherwise.
+ * Work is shared on POOL; results only depend on its number of workers.
+ */
+void MultigridAccel(Multigrid *mg, Pool *pool, ParticleSoA *soa, uint32_t count, uint32_t mass_len, uint32_t grid);
+
+/* Free memory of MG. */
+void FreeMultigrid(Multigrid *mg);
+
+#endif //NB_MULTIGRID_H
@@ -0,0 +1,202 @@
+#include "p3m.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* How many particles a worker puts into hash cells at a time. */
+#define P3M_CHUNK       1024
+
+/* Make sure P fits COUNT particles, CELLS x CELLS hash cells and THREADS packs. */
+static void Reserve(P3m *p, uint32_t count, uint32_t cells, int threads) {
+    if (cells != p->cells) {
+        free(p->cell_start);
+        free(p->mass_end);
+
+        uint32_t len = cells * cells;
+        p->cell_start = ALLOC(len + 1, uint32_t);
+        p->mass_end = ALLOC(len, uint32_t);
+        ASSERT(p->cell_start != NULL && p->mass_end != NULL, "Failed to alloc %u P3M cells", len);
+
+        p->cells = cells;
+    }
+    if (count > p->body_cap) {
+        free(p->order);
+        free(p->cell_of);
+
+        p->order = ALLOC(count, uint32_t);
+        p->cell_of = ALLOC(count, uint32_t);
+        ASSERT(p->order != NULL && p->cell_of != NULL, "Failed to alloc P3M hash of %u particles", count);
+
+        p->body_cap = count;
+    }
+    if (threads > p->threads) {
+        for (int t = 0; t < p->threads; t++) {
+            FreeParticleSoA(&p->scratch[t]);
+        }
+        free(p->scratch);
+
+        // packs are allocated when a worker first needs one
+        p->scratch = calloc(threads, sizeof(ParticleSoA));
+        ASSERT(p->scratch != NULL, "Failed to alloc %d P3M packs", threads);
+
+        p->threads = threads;
+    }
+}
+
+/* Arguments of the loops of P3mAccel. */
+typedef struct P3mLoop {
+    P3m *p;
+    ParticleSoA *soa;
+    void (*accel)(ParticleSoA *soa, uint32_t mass_len, uint32_t from, uint32_t to);
+} P3mLoop;
+
+/* Find hash cell of particles [FROM, TO). */
+static void CellChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const P3mLoop *l = ctx;
+    P3m *p = l->p;
+    const ParticleSoA *soa = l->soa;
+    const uint32_t cells = p->cells;
+    const float inv_size = 1.f / ((float)P3M_CELL * p->pm.h);
+    (void)tid;
+
+    for (uint32_t i = from; i < to; i++) {
+        float u = (soa->x[i] - p->pm.x0) * inv_size;
+        float v = (soa->y[i] - p->pm.y0) * inv_size;
+        uint32_t cx = u < 0 ? 0 : u >= (float)cells ? cells - 1 : (uint32_t)u;
+        uint32_t cy = v < 0 ? 0 : v >= (float)cells ? cells - 1 : (uint32_t)v;
+        p->cell_of[i] = cy * cells + cx;
+    }
+}
+
+/* Put particles into hash cells over the grid of the long-range part. */
+static void Hash(P3m *p, Pool *pool, P3mLoop *l, uint32_t count, uint32_t mass_len) {
+    PoolFor(pool, "p3m hash", count, P3M_CHUNK, CellChunk, l);
+
+    // counting sort is cheap next to the short-range part; being stable, it keeps particles with mass first
+    const uint32_t len = p->cells * p->cells;
+    memset(p->cell_start, 0, (len + 1) * sizeof(uint32_t));
+    for (uint32_t i = 0; i < count; i++) {
+        p->cell_start[p->cell_of[i] + 1]++;
+    }
+    for (uint32_t c = 0; c < len; c++) {
+        p->cell_start[c + 1] += p->cell_start[c];
+    }
+
+    memcpy(p->mass_end, p->cell_start, len * sizeof(uint32_t));
+    for (uint32_t i = 0; i < mass_len; i++) {
+        p->order[p->mass_end[p->cell_of[i]]++] = i;
+    }
+
+    // particles without mass of a cell follow those with mass
+    memcpy(p->cell_start, p->mass_end, len * sizeof(uint32_t));
+    for (uint32_t i = mass_len; i < count; i++) {
+        p->order[p->cell_start[p->cell_of[i]]++] = i;
+    }
+
+    // every cell_start[c] is now the end of cell c, which is the start of cell c + 1
+    memmove(p->cell_start + 1, p->cell_start, len * sizeof(uint32_t));
+    p->cell_start[0] = 0;
+}
+
+/*
+ * Add the short-range force to particles of hash cell C. PACK gets particles with mass of C and its neighbours
+ * as sources, followed by three copies of particles of C as targets: with their own softening, and with
+ * the two softenings of the long-range force.
+ */
+static void ShortRange(P3m *p, ParticleSoA *soa, ParticleSoA *pack, uint32_t c,
+                       void (*accel)(ParticleSoA *, uint32_t, uint32_t, uint32_t)) {
+    const uint32_t cells = p->cells;
+    const uint32_t cx = c % cells, cy = c / cells;
+    const uint32_t x_lo = cx > 0 ? cx - 1 : 0, x_hi = cx + 1 < cells ? cx + 1 : cx;
+    const uint32_t y_lo = cy > 0 ? cy - 1 : 0, y_hi = cy + 1 < cells ? cy + 1 : cy;
+
+    uint32_t targets = p->cell_start[c + 1] - p->cell_start[c];
+    uint32_t sources = 0;
+    for (uint32_t y = y_lo; y <= y_hi; y++) {
+        for (uint32_t x = x_lo; x <= x_hi; x++) {
+            uint32_t n = y * cells + x;
+            sources += p->mass_end[n] - p->cell_start[n];
+        }
+    }
+    if (targets == 0 || sources == 0) return;
+
+    uint32_t len = sources + 3 * targets;
+    if (len > pack->cap) {
+        FreeParticleSoA(pack);
+        AllocParticleSoA(pack, len + len / 4);
+    }
+
+    uint32_t k = 0;
+    for (uint32_t y = y_lo; y <= y_hi; y++) {
+        for (uint32_t x = x_lo; x <= x_hi; x++) {
+            uint32_t n = y * cells + x;
+            for (uint32_t q = p->cell_start[n]; q < p->mass_end[n]; q++, k++) {
+                uint32_t i = p->order[q];
+                pack->x[k] = soa->x[i];
+                pack->y[k] = soa->y[i];
+                pack->m[k] = soa->m[i];
+                pack->r[k] = 0;
+            }
+        }
+    }
+
+    const float s2 = P3M_SPLIT * P3M_SPLIT * p->pm.h * p->pm.h;
+    const float soft[3] = {0, s2, 2 * s2};
+    for (uint32_t copy = 0; copy < 3; copy++) {
+        for (uint32_t q = p->cell_start[c]; q < p->cell_start[c + 1]; q++, k++) {
+            uint32_t i = p->order[q];
+            pack->x[k] = soa->x[i];
+            pack->y[k] = soa->y[i];
+            pack->m[k] = 0;
+            pack->r[k] = copy == 0 ? soa->r[i] : soft[copy];
+        }
+    }
+
+    accel(pack, sources, sources, len);
+
+    // exact gravity minus the long-range one
+    for (uint32_t t = 0; t < targets; t++) {
+        uint32_t i = p->order[p->cell_start[c] + t];
+        uint32_t k0 = sources + t, k1 = k0 + targets, k2 = k1 + targets;
+        soa->ax[i] += pack->ax[k0] - 2 * pack->ax[k1] + pack->ax[k2];
+        soa->ay[i] += pack->ay[k0] - 2 * pack->ay[k1] + pack->ay[k2];
+    }
+}
+
+/* Add the short-range force to particles of hash cells [FROM, TO), packing them into the pack of worker TID. */
+static void ShortRangeChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const P3mLoop *l = ctx;
+    for (uint32_t c = from; c < to; c++) {
+        ShortRange(l->p, l->soa, &l->p->scratch[tid], c, l->accel);
+    }
+}
+
+void P3mAccel(P3m *p, Pool *pool, ParticleSoA *soa, uint32_t count, uint32_t mass_len, uint32_t grid,
+              void (*accel)(ParticleSoA *soa, uint32_t mass_len, uint32_t from, uint32_t to)) {
+    PmAccel(&p->pm, pool, soa, count, mass_len, grid, P3M_SPLIT);
+
+    // hash cells may overhang the grid, so that a small grid still gets one
+    Reserve(p, count, (grid + P3M_CELL - 1) / P3M_CELL, (int)PoolThreads(pool));
+
+    P3mLoop l = {.p = p, .soa = soa, .accel = accel};
+    Hash(p, pool, &l, count, mass_len);
+
+    // cells differ in the number of particles, which stealing evens out
+    PoolFor(pool, "p3m short range", p->cells * p->cells, 1, ShortRangeChunk, &l);
+}
+
+void FreeP3m(P3m *p) {
+    if (p != NULL) {
+        FreePm(&p->pm);
+        free(p->cell_start);
+        free(p->mass_end);
+        free(p->order);
+        free(p->cell_of);
+        for (int t = 0; t < p->threads; t++) {
+            FreeParticleSoA(&p->scratch[t]);
+        }
+        free(p->scratch);
+        *p = (P3m){0};
+    }
+}
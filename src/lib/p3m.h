@@ -0,0 +1,48 @@
+#ifndef NB_P3M_H
+#define NB_P3M_H
+
+#include <nbody.h>
+#include <stdint.h>
+
+#include "pm.h"
+#include "pool.h"
+#include "sim_cpu.h"
+
+/*
+ * Particle-particle particle-mesh gravity. The mesh computes a long-range force with Plummer softening
+ * combined as `2 * P(S) - P(sqrt(2) * S)`, which is smooth on the grid and differs from gravity by
+ * `O(S^4 / dist^4)`. Particles within a hash cell or its neighbours get the rest directly: exact gravity minus
+ * the same combination, all three of which are ordinary softened gravity that CPU kernels compute.
+ */
+
+/* Split length S in grid cells; the mesh only resolves forces smooth over a few cells. */
+#define P3M_SPLIT       3.0f
+
+/* Size of hash cells in grid cells; the long-range force is within 0.5% of gravity beyond it. */
+#define P3M_CELL        16
+
+/* P3M data. Memory is reused between calls; zero-initialized P3M is empty. */
+typedef struct P3m {
+    Pm pm;                  // long-range part
+    uint32_t cells;         // number of hash cells per side
+    uint32_t *cell_start;   // particles of cell c are order[cell_start[c] .. cell_start[c + 1])
+    uint32_t *mass_end;     // particles with mass of cell c are order[cell_start[c] .. mass_end[c])
+    uint32_t *order;        // particle indices sorted by cell; those with mass come first in every cell
+    uint32_t *cell_of;      // hash cell of every particle
+    uint32_t body_cap;      // capacity of ORDER and CELL_OF
+    ParticleSoA *scratch;   // packs of sources and targets of a cell of every worker of the pool
+    int threads;            // number of packs of SCRATCH
+} P3m;
+
+/*
+ * Set acceleration of the first COUNT particles of SOA to the gravity of its first MASS_LEN particles,
+ * with the long-range part on a grid of GRID x GRID nodes, see PmAccel. ACCEL is the CPU kernel of the short-range
+ * part; it must not use symmetric softening. Work is shared on POOL.
+ */
+void P3mAccel(P3m *p, Pool *pool, ParticleSoA *soa, uint32_t count, uint32_t mass_len, uint32_t grid,
+              void (*accel)(ParticleSoA *soa, uint32_t mass_len, uint32_t from, uint32_t to));
+
+/* Free memory of P. */
+void FreeP3m(P3m *p);
+
+#endif //NB_P3M_H
@@ -0,0 +1,377 @@
+#include "pm.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+/* How many columns are transformed at a time; a multiple of SOA_PADDING, so that chunks stay aligned. */
+#define PM_COLUMN_CHUNK 16
+
+/* How many particles a worker interpolates acceleration of at a time. */
+#define PM_CHUNK        256
+
+/* Green's function at squared distance D2 in grid cells, softened or split by SPLIT. */
+static inline float Green(float d2, float split) {
+    if (split == 0) return -1.f / sqrtf(d2 + PM_SOFTENING * PM_SOFTENING);
+
+    float s2 = split * split;
+    return -2.f / sqrtf(d2 + s2) + 1.f / sqrtf(d2 + 2 * s2);
+}
+
+/*
+ * Transform of cloud-in-cell assignment along one axis at wave number K of a grid of 2M nodes, `sinc(k / 2)^2`
+ * with k in radians per cell. Spreading mass and interpolating force both smooth by it; split Green's function
+ * is divided by that twice, which its smoothness allows, so that the long-range force is right at short range.
+ */
+static inline float CicWindow(uint32_t k, uint32_t m) {
+    if (k == 0) return 1.f;
+    float half = 0.5f * 3.14159265f * (float)k / (float)m;
+    float sinc = sinf(half) / half;
+    return sinc * sinc;
+}
+
+/* Compute transform of Green's function of PM, whose spectrum arrays are used as scratch space. */
+static void MakeGreen(Pm *pm) {
+    const uint32_t m = pm->grid, n = 2 * m, s = pm->stride;
+
+    for (uint32_t y = 0; y < n; y++) {
+        float *re = pm->re + (size_t)y * s, *im = pm->im + (size_t)y * s;
+        float dy = (float)(y < m ? y : n - y);
+
+        // distance wraps around, so that the function is even in both directions
+        for (uint32_t k = 0; k < m; k++) {
+            float dx0 = (float)(2 * k < m ? 2 * k : n - 2 * k);
+            float dx1 = (float)(2 * k + 1 < m ? 2 * k + 1 : n - 2 * k - 1);
+            re[k] = Green(dx0 * dx0 + dy * dy, pm->split);
+            im[k] = Green(dx1 * dx1 + dy * dy, pm->split);
+        }
+        memset(re + m, 0, (s - m) * sizeof(float));
+        memset(im + m, 0, (s - m) * sizeof(float));
+        FftReal(&pm->row_plan, re, im);
+    }
+    for (uint32_t c = 0; c <= m; c += PM_COLUMN_CHUNK) {
+        uint32_t count = m + 1 - c < PM_COLUMN_CHUNK ? m + 1 - c : PM_COLUMN_CHUNK;
+        Fft(&pm->col_plan, pm->re + c, pm->im + c, s, count, false);
+    }
+
+    // forward and inverse transforms of both rows and columns multiply potential by (2M)^2
+    const float norm = 1.f / ((float)n * (float)n);
+    for (uint32_t y = 0; y < n; y++) {
+        float wy = pm->split > 0 ? CicWindow(y < m ? y : n - y, m) : 1.f;
+        for (uint32_t x = 0; x <= m; x++) {
+            float w = pm->split > 0 ? wy * CicWindow(x, m) : 1.f;
+            pm->green[(size_t)y * s + x] = pm->re[(size_t)y * s + x] * norm / (w * w);
+        }
+    }
+}
+
+/* Make sure PM fits a grid of GRID x GRID nodes and THREADS grids of mass, and has Green's function of SPLIT. */
+static void Reserve(Pm *pm, uint32_t grid, float split, int threads) {
+    if (grid == pm->grid && split != pm->split) {
+        pm->split = split;
+        MakeGreen(pm);
+    }
+    if (grid != pm->grid) {
+        FreeFftPlan(&pm->row_plan);
+        FreeFftPlan(&pm->col_plan);
+        free(pm->green);
+        free(pm->re);
+        free(pm->im);
+        free(pm->gx);
+        free(pm->gy);
+
+        pm->grid = grid;
+        pm->split = split;
+        pm->stride = (grid + 1 + SOA_PADDING - 1) / SOA_PADDING * SOA_PADDING;
+        MakeFftPlan(&pm->row_plan, grid);
+        MakeFftPlan(&pm->col_plan, 2 * grid);
+
+        size_t spectrum = (size_t)2 * grid * pm->stride;
+        size_t nodes = (size_t)grid * grid;
+        pm->green = ALLOC(spectrum, float);
+        pm->re = ALLOC(spectrum, float);
+        pm->im = ALLOC(spectrum, float);
+        pm->gx = ALLOC(nodes, float);
+        pm->gy = ALLOC(nodes, float);
+        ASSERT(pm->green != NULL && pm->re != NULL && pm->im != NULL && pm->gx != NULL && pm->gy != NULL,
+               "Failed to alloc PM grid of %u nodes", grid);
+
+        MakeGreen(pm);
+
+        // grids of mass have the old size
+        free(pm->mass);
+        pm->mass = NULL;
+        pm->threads = 0;
+    }
+    if (threads > pm->threads) {
+        free(pm->mass);
+        free(pm->bounds);
+
+        size_t len = (size_t)threads * grid * grid;
+        pm->mass = ALLOC(len, float);
+        pm->bounds = ALLOC(4 * threads, float);
+        ASSERT(pm->mass != NULL && pm->bounds != NULL, "Failed to alloc %d PM grids of %u nodes", threads, grid);
+
+        pm->threads = threads;
+    }
+}
+
+/* Grid coordinate U of position P is split into node I in [2, M - 4] and fraction F of the next node. */
+static inline void Locate(float p, float origin, float inv_h, uint32_t m, uint32_t *i, float *f) {
+    float u = (p - origin) * inv_h;
+    float fl = floorf(u);
+    if (fl < 2) fl = 2;
+    if (fl > (float)(m - 4)) fl = (float)(m - 4);
+
+    *i = (uint32_t)fl;
+    *f = u - fl;
+}
+
+/* Arguments of the loops of PmAccel. */
+typedef struct PmLoop {
+    Pm *pm;
+    ParticleSoA *soa;
+    uint32_t count, mass_len;
+    int slices;         // number of slices of particles, one per grid of mass
+} PmLoop;
+
+/* First of LEN items that slice K of SLICES starts at. */
+static inline uint32_t SliceStart(uint32_t len, uint32_t k, int slices) {
+    return (uint32_t)((uint64_t)len * k / (uint32_t)slices);
+}
+
+/* Find bounding box of every slice of particles. */
+static void BoundsChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const PmLoop *l = ctx;
+    const ParticleSoA *soa = l->soa;
+    (void)tid;
+
+    for (uint32_t k = from; k < to; k++) {
+        float lo[2] = {FLT_MAX, FLT_MAX}, hi[2] = {-FLT_MAX, -FLT_MAX};
+        for (uint32_t i = SliceStart(l->count, k, l->slices); i < SliceStart(l->count, k + 1, l->slices); i++) {
+            lo[0] = fminf(lo[0], soa->x[i]);
+            lo[1] = fminf(lo[1], soa->y[i]);
+            hi[0] = fmaxf(hi[0], soa->x[i]);
+            hi[1] = fmaxf(hi[1], soa->y[i]);
+        }
+
+        float *b = l->pm->bounds + 4 * k;
+        b[0] = lo[0], b[1] = lo[1], b[2] = hi[0], b[3] = hi[1];
+    }
+}
+
+/*
+ * Spread mass of every slice of particles with mass over its own grid. Slices are fixed rather than taken by
+ * whoever is free, so that sums of mass do not depend on how the loop was shared.
+ */
+static void DepositChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const PmLoop *l = ctx;
+    const Pm *pm = l->pm;
+    const ParticleSoA *soa = l->soa;
+    const uint32_t m = pm->grid;
+    const float inv_h = 1.f / pm->h;
+    (void)tid;
+
+    for (uint32_t k = from; k < to; k++) {
+        float *mass = pm->mass + (size_t)k * m * m;
+        memset(mass, 0, (size_t)m * m * sizeof(float));
+
+        for (uint32_t i = SliceStart(l->mass_len, k, l->slices); i < SliceStart(l->mass_len, k + 1, l->slices); i++) {
+            uint32_t ix, iy;
+            float fx, fy;
+            Locate(soa->x[i], pm->x0, inv_h, m, &ix, &fx);
+            Locate(soa->y[i], pm->y0, inv_h, m, &iy, &fy);
+
+            float *row = mass + (size_t)iy * m + ix;
+            float mi = soa->m[i];
+            row[0] += mi * (1 - fx) * (1 - fy);
+            row[1] += mi * fx * (1 - fy);
+            row[m] += mi * (1 - fx) * fy;
+            row[m + 1] += mi * fx * fy;
+        }
+    }
+}
+
+/* Find bounding box of particles, place the grid over it and spread mass over the grids of slices. */
+static void Deposit(Pm *pm, Pool *pool, PmLoop *l) {
+    const uint32_t m = pm->grid;
+    PoolFor(pool, "pm bounds", (uint32_t)l->slices, 1, BoundsChunk, l);
+
+    pm->lo[0] = pm->lo[1] = FLT_MAX;
+    pm->hi[0] = pm->hi[1] = -FLT_MAX;
+    for (int t = 0; t < l->slices; t++) {
+        const float *b = pm->bounds + 4 * t;
+        for (int k = 0; k < 2; k++) {
+            pm->lo[k] = fminf(pm->lo[k], b[k]);
+            pm->hi[k] = fmaxf(pm->hi[k], b[2 + k]);
+        }
+    }
+
+    // particles map to [2.5, M - 3.5], so that both nodes of every particle have two neighbours on either side
+    float span = fmaxf(pm->hi[0] - pm->lo[0], pm->hi[1] - pm->lo[1]);
+    pm->h = span > 0 ? span / (float)(m - 6) : 1.f;
+    pm->x0 = pm->lo[0] - 2.5f * pm->h;
+    pm->y0 = pm->lo[1] - 2.5f * pm->h;
+
+    PoolFor(pool, "pm deposit", (uint32_t)l->slices, 1, DepositChunk, l);
+}
+
+/* Rows of mass are summed over grids and split into even and odd values; padding rows are zero. */
+static void RowChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const PmLoop *l = ctx;
+    const Pm *pm = l->pm;
+    const uint32_t m = pm->grid, s = pm->stride;
+    const size_t nodes = (size_t)m * m;
+    (void)tid;
+
+    for (uint32_t y = from; y < to; y++) {
+        float *re = pm->re + (size_t)y * s, *im = pm->im + (size_t)y * s;
+        memset(re, 0, s * sizeof(float));
+        memset(im, 0, s * sizeof(float));
+        if (y >= m) continue;
+
+        for (int t = 0; t < l->slices; t++) {
+            const float *row = pm->mass + t * nodes + (size_t)y * m;
+            for (uint32_t k = 0; k < m / 2; k++) {
+                re[k] += row[2 * k];
+                im[k] += row[2 * k + 1];
+            }
+        }
+        FftReal(&pm->row_plan, re, im);
+    }
+}
+
+/* Columns never depend on each other, so each chunk of PM_COLUMN_CHUNK columns goes all the way to potential. */
+static void ColumnChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const PmLoop *l = ctx;
+    const Pm *pm = l->pm;
+    const uint32_t m = pm->grid, n = 2 * m, s = pm->stride;
+    (void)tid;
+
+    for (uint32_t b = from; b < to; b++) {
+        uint32_t c = b * PM_COLUMN_CHUNK;
+        uint32_t count = m + 1 - c < PM_COLUMN_CHUNK ? m + 1 - c : PM_COLUMN_CHUNK;
+        Fft(&pm->col_plan, pm->re + c, pm->im + c, s, count, false);
+
+        for (uint32_t y = 0; y < n; y++) {
+            float *re = pm->re + (size_t)y * s + c, *im = pm->im + (size_t)y * s + c;
+            const float *g = pm->green + (size_t)y * s + c;
+            for (uint32_t k = 0; k < count; k++) {
+                re[k] *= g[k];
+                im[k] *= g[k];
+            }
+        }
+        Fft(&pm->col_plan, pm->re + c, pm->im + c, s, count, true);
+    }
+}
+
+/* Only the first M x M values of potential belong to the grid, the rest is padding. */
+static void PotentialChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const PmLoop *l = ctx;
+    const Pm *pm = l->pm;
+    const uint32_t m = pm->grid, s = pm->stride;
+    (void)tid;
+
+    for (uint32_t y = from; y < to; y++) {
+        float *re = pm->re + (size_t)y * s, *im = pm->im + (size_t)y * s;
+        FftRealInverse(&pm->row_plan, re, im);
+
+        float *phi = pm->mass + (size_t)y * m;
+        for (uint32_t k = 0; k < m / 2; k++) {
+            phi[2 * k] = re[k];
+            phi[2 * k + 1] = im[k];
+        }
+    }
+}
+
+/* Convolve mass with Green's function; potential goes into the first grid of mass. */
+static void Convolve(Pm *pm, Pool *pool, PmLoop *l) {
+    const uint32_t m = pm->grid;
+    PoolFor(pool, "pm rows", 2 * m, 1, RowChunk, l);
+    PoolFor(pool, "pm columns", m / PM_COLUMN_CHUNK + 1, 1, ColumnChunk, l);
+    PoolFor(pool, "pm potential", m, 1, PotentialChunk, l);
+}
+
+/*
+ * Acceleration at grid nodes from fourth-order central differences of potential; together with cloud-in-cell
+ * assignment this gives no self-force. Particles never use two nodes at the edges, which are left unset.
+ * Items of the loop are rows from the third one.
+ */
+static void GradientChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const PmLoop *l = ctx;
+    const Pm *pm = l->pm;
+    const uint32_t m = pm->grid;
+    const float *phi = pm->mass;
+    (void)tid;
+
+    // potential is in units of `NB_G / h`; `(8 * (p[1] - p[-1]) - (p[2] - p[-2])) / 12` is the derivative
+    const float scale = -NB_G / (12 * pm->h * pm->h);
+
+    for (uint32_t y = 2 + from; y < 2 + to; y++) {
+        const float *row = phi + (size_t)y * m;
+        const float *up = row - m, *down = row + m, *up2 = row - 2 * m, *down2 = row + 2 * m;
+
+        float *gx = pm->gx + (size_t)y * m, *gy = pm->gy + (size_t)y * m;
+        for (uint32_t x = 2; x < m - 2; x++) {
+            gx[x] = scale * (8 * (row[x + 1] - row[x - 1]) - (row[x + 2] - row[x - 2]));
+            gy[x] = scale * (8 * (down[x] - up[x]) - (down2[x] - up2[x]));
+        }
+    }
+}
+
+/* Interpolate acceleration of particles [FROM, TO) from grid nodes, the same way as their mass was spread. */
+static void InterpolateChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const PmLoop *l = ctx;
+    const Pm *pm = l->pm;
+    ParticleSoA *soa = l->soa;
+    const uint32_t m = pm->grid;
+    const float inv_h = 1.f / pm->h;
+    (void)tid;
+
+    for (uint32_t i = from; i < to; i++) {
+        uint32_t ix, iy;
+        float fx, fy;
+        Locate(soa->x[i], pm->x0, inv_h, m, &ix, &fx);
+        Locate(soa->y[i], pm->y0, inv_h, m, &iy, &fy);
+
+        size_t k = (size_t)iy * m + ix;
+        float w00 = (1 - fx) * (1 - fy), w10 = fx * (1 - fy), w01 = (1 - fx) * fy, w11 = fx * fy;
+        soa->ax[i] = w00 * pm->gx[k] + w10 * pm->gx[k + 1] + w01 * pm->gx[k + m] + w11 * pm->gx[k + m + 1];
+        soa->ay[i] = w00 * pm->gy[k] + w10 * pm->gy[k + 1] + w01 * pm->gy[k + m] + w11 * pm->gy[k + m + 1];
+    }
+}
+
+void PmAccel(Pm *pm, Pool *pool, ParticleSoA *soa, uint32_t count, uint32_t mass_len, uint32_t grid, float split) {
+    ASSERT(grid >= 8 && (grid & (grid - 1)) == 0, "PM grid must be a power of 2 of at least 8, got %u", grid);
+
+    PmLoop l = {
+            .pm = pm,
+            .soa = soa,
+            .count = count,
+            .mass_len = mass_len,
+            .slices = (int)PoolThreads(pool),
+    };
+    Reserve(pm, grid, split, l.slices);
+
+    Deposit(pm, pool, &l);
+    Convolve(pm, pool, &l);
+    PoolFor(pool, "pm gradient", grid - 4, 1, GradientChunk, &l);
+    PoolFor(pool, "pm interpolate", count, PM_CHUNK, InterpolateChunk, &l);
+}
+
+void FreePm(Pm *pm) {
+    if (pm != NULL) {
+        FreeFftPlan(&pm->row_plan);
+        FreeFftPlan(&pm->col_plan);
+        free(pm->green);
+        free(pm->re);
+        free(pm->im);
+        free(pm->mass);
+        free(pm->bounds);
+        free(pm->gx);
+        free(pm->gy);
+        *pm = (Pm){0};
+    }
+}
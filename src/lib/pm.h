@@ -0,0 +1,56 @@
+#ifndef NB_PM_H
+#define NB_PM_H
+
+#include <nbody.h>
+#include <stdint.h>
+
+#include "fft.h"
+#include "pool.h"
+#include "sim_cpu.h"
+
+/*
+ * Particle-mesh gravity. Mass of particles is spread over a square grid of M x M nodes by cloud-in-cell
+ * assignment, potential is the convolution of that mass with Green's function of the force law, and acceleration
+ * of every particle is interpolated from the gradient of potential the same way. Gravity `NB_G * m / dist^2`
+ * is not the 2D Poisson equation, so the convolution uses its own Green's function `-1 / sqrt(dist^2 + eps^2)`,
+ * and the grid is padded to 2M x 2M with zeros so that the periodic convolution of FFT is the isolated one.
+ */
+
+/* Softening eps of Green's function in grid cells; forces are accurate at a few cells and beyond. */
+#define PM_SOFTENING    1.0f
+
+/*
+ * With split length S, Green's function is `-2 / sqrt(dist^2 + S^2) + 1 / sqrt(dist^2 + 2 * S^2)` instead,
+ * the potential of a force that differs from `1 / dist^2` by `O(S^4 / dist^4)`, which P3M corrects at short range.
+ */
+
+/* Particle-mesh data. Memory is reused between calls; zero-initialized PM is empty. */
+typedef struct Pm {
+    uint32_t grid;          // number of grid nodes per side, M
+    uint32_t stride;        // row length of spectrum arrays: M + 1 points rounded up to SOA_PADDING
+    FftPlan row_plan;       // real transforms of rows of 2M values
+    FftPlan col_plan;       // complex transforms of columns of 2M points
+    float split;            // split length of Green's function in grid cells; 0 if it is softened instead
+    float *green;           // transform of Green's function, real since the function is even; 2M rows of STRIDE
+    float *re, *im;         // spectrum of mass, then of potential; 2M rows of STRIDE
+    float *mass;            // M x M grids of mass of every slice of particles; the first one gets potential
+    float *bounds;          // bounding box of every slice of particles: low x and y, then high x and y
+    float *gx, *gy;         // acceleration at grid nodes, M x M
+    int threads;            // number of grids of MASS, one per worker of the pool
+    float x0, y0;           // position of node (0, 0)
+    float h;                // distance between nodes
+    float lo[2], hi[2];     // bounding box of particles, combined from slices
+} Pm;
+
+/*
+ * Set acceleration of the first COUNT particles of SOA to the gravity of its first MASS_LEN particles
+ * on a grid of GRID x GRID nodes that covers all COUNT particles; GRID must be a power of 2 of at least 8.
+ * SPLIT is the split length of Green's function in grid cells, or 0 for the whole softened gravity.
+ * Work is shared on POOL; results only depend on its number of workers.
+ */
+void PmAccel(Pm *pm, Pool *pool, ParticleSoA *soa, uint32_t count, uint32_t mass_len, uint32_t grid, float split);
+
+/* Free memory of PM. */
+void FreePm(Pm *pm);
+
+#endif //NB_PM_H
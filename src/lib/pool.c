@@ -0,0 +1,262 @@
+#include "pool.h"
+#include "affinity.h"
+#include "trace.h"
+#include "util.h"
+
+#ifdef _WIN32
+#   define WIN32_LEAN_AND_MEAN
+#   include <windows.h>
+
+typedef CRITICAL_SECTION Mutex;
+typedef CONDITION_VARIABLE Cond;
+typedef HANDLE Thread;
+
+#   define InitMutex(M)         InitializeCriticalSection(M)
+#   define FreeMutex(M)         DeleteCriticalSection(M)
+#   define Lock(M)              EnterCriticalSection(M)
+#   define Unlock(M)            LeaveCriticalSection(M)
+#   define InitCond(C)          InitializeConditionVariable(C)
+#   define FreeCond(C)          (void)(C)
+#   define Wait(C, M)           SleepConditionVariableCS(C, M, INFINITE)
+#   define Signal(C)            WakeConditionVariable(C)
+#   define Broadcast(C)         WakeAllConditionVariable(C)
+#else
+#   include <pthread.h>
+
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t Cond;
+typedef pthread_t Thread;
+
+#   define InitMutex(M)         pthread_mutex_init(M, NULL)
+#   define FreeMutex(M)         pthread_mutex_destroy(M)
+#   define Lock(M)              pthread_mutex_lock(M)
+#   define Unlock(M)            pthread_mutex_unlock(M)
+#   define InitCond(C)          pthread_cond_init(C, NULL)
+#   define FreeCond(C)          pthread_cond_destroy(C)
+#   define Wait(C, M)           pthread_cond_wait(C, M)
+#   define Signal(C)            pthread_cond_signal(C)
+#   define Broadcast(C)         pthread_cond_broadcast(C)
+#endif
+
+/* Chunks [BEGIN, END) of the current loop that a worker has yet to run. */
+typedef struct Share {
+    Mutex lock;             // guards BEGIN and END, which thieves change too
+    uint32_t begin, end;
+    uint64_t start, stop;   // when the worker started and finished its part of the current loop
+    Pool *pool;
+    uint32_t tid;
+} Share;
+
+/* Share padded to a multiple of the cache line, so that workers taking their chunks do not contend for one. */
+typedef union PaddedShare {
+    Share s;
+    char pad[(sizeof(Share) + 63) / 64 * 64];
+} PaddedShare;
+
+struct Pool {
+    uint32_t threads;       // number of workers, the caller included
+    bool pin;               // whether workers pin themselves to CPUs
+    Thread *handles;        // threads of workers 1 to THREADS - 1
+    PaddedShare *shares;    // share of every worker
+
+    Mutex lock;             // guards the fields below
+    Cond wake;              // a loop has started, or the pool is being destroyed
+    Cond done;              // the last worker has finished its part of a loop
+    uint64_t loop;          // number of started loops
+    uint32_t running;       // workers that have not finished their part of the current loop
+    bool quit;              // whether threads must exit
+
+    PoolFn fn;              // the current loop; written while all workers are idle
+    void *ctx;
+    uint32_t len, chunk;
+};
+
+/* Take a chunk for worker TID into CHUNK: its own next one, or the first of those stolen from another worker. */
+static bool TakeChunk(Pool *p, uint32_t tid, uint32_t *chunk) {
+    Share *own = &p->shares[tid].s;
+    Lock(&own->lock);
+    bool found = own->begin < own->end;
+    if (found) *chunk = own->begin++;
+    Unlock(&own->lock);
+    if (found) return true;
+
+    // steal the back half of what the next worker with any chunks has left; the owner keeps taking from the front
+    for (uint32_t k = 1; k < p->threads; k++) {
+        Share *victim = &p->shares[(tid + k) % p->threads].s;
+        Lock(&victim->lock);
+        uint32_t end = victim->end;
+        uint32_t begin = end - (end - victim->begin + 1) / 2;
+        victim->end = begin;
+        Unlock(&victim->lock);
+
+        if (begin < end) {
+            // nobody steals from a worker without chunks, so these are only in flight while this one runs
+            Lock(&own->lock);
+            own->begin = begin + 1;
+            own->end = end;
+            Unlock(&own->lock);
+
+            *chunk = begin;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Run chunks of the current loop on worker TID until there are none left anywhere. */
+static void Work(Pool *p, uint32_t tid) {
+    Share *own = &p->shares[tid].s;
+    own->start = NowNs();
+
+    uint32_t chunk;
+    while (TakeChunk(p, tid, &chunk)) {
+        uint32_t from = chunk * p->chunk;
+        uint32_t to = p->len - from > p->chunk ? from + p->chunk : p->len;
+        p->fn(p->ctx, from, to, tid);
+    }
+    own->stop = NowNs();
+
+    Lock(&p->lock);
+    if (--p->running == 0) Signal(&p->done);
+    Unlock(&p->lock);
+}
+
+/* Body of the pool's own threads. */
+#ifdef _WIN32
+static DWORD WINAPI WorkerMain(LPVOID arg) {
+#else
+static void *WorkerMain(void *arg) {
+#endif
+    Share *own = arg;
+    Pool *p = own->pool;
+    if (p->pin) PinThread(own->tid);
+
+    uint64_t seen = 0;
+    Lock(&p->lock);
+    while (true) {
+        while (!p->quit && p->loop == seen) Wait(&p->wake, &p->lock);
+        if (p->quit) break;
+        seen = p->loop;
+        Unlock(&p->lock);
+
+        Work(p, own->tid);
+        Lock(&p->lock);
+    }
+    Unlock(&p->lock);
+    return 0;
+}
+
+Pool *CreatePool(uint32_t threads, bool pin) {
+    ASSERT(threads > 0, "Thread pool needs at least one worker");
+
+    Pool *p = ALLOC(1, Pool);
+    ASSERT(p != NULL, "Failed to alloc thread pool");
+    *p = (Pool){
+            .threads = threads,
+            .pin = pin,
+            .handles = ALLOC(threads, Thread),
+            .shares = ALLOC(threads, PaddedShare),
+            .loop = 0,
+            .running = 0,
+            .quit = false,
+    };
+    ASSERT(p->handles != NULL && p->shares != NULL, "Failed to alloc thread pool of %u workers", threads);
+
+    InitMutex(&p->lock);
+    InitCond(&p->wake);
+    InitCond(&p->done);
+    for (uint32_t t = 0; t < threads; t++) {
+        Share *s = &p->shares[t].s;
+        InitMutex(&s->lock);
+        s->begin = s->end = 0;
+        s->pool = p;
+        s->tid = t;
+    }
+
+    // worker 0 is whichever thread runs a loop
+    for (uint32_t t = 1; t < threads; t++) {
+#ifdef _WIN32
+        p->handles[t] = CreateThread(NULL, 0, WorkerMain, &p->shares[t].s, 0, NULL);
+        ASSERT(p->handles[t] != NULL, "Failed to start worker %u of thread pool", t);
+#else
+        int err = pthread_create(&p->handles[t], NULL, WorkerMain, &p->shares[t].s);
+        ASSERT(err == 0, "Failed to start worker %u of thread pool: error %d", t, err);
+#endif
+    }
+    return p;
+}
+
+void DestroyPool(Pool *p) {
+    if (p == NULL) return;
+
+    Lock(&p->lock);
+    p->quit = true;
+    Broadcast(&p->wake);
+    Unlock(&p->lock);
+
+    for (uint32_t t = 1; t < p->threads; t++) {
+#ifdef _WIN32
+        WaitForSingleObject(p->handles[t], INFINITE);
+        CloseHandle(p->handles[t]);
+#else
+        pthread_join(p->handles[t], NULL);
+#endif
+    }
+    for (uint32_t t = 0; t < p->threads; t++) {
+        FreeMutex(&p->shares[t].s.lock);
+    }
+    FreeCond(&p->done);
+    FreeCond(&p->wake);
+    FreeMutex(&p->lock);
+
+    free(p->handles);
+    free(p->shares);
+    free(p);
+}
+
+uint32_t PoolThreads(const Pool *p) {
+    return p->threads;
+}
+
+void PoolFor(Pool *p, const char *name, uint32_t len, uint32_t chunk, PoolFn fn, void *ctx) {
+    if (len == 0) return;
+    const uint32_t chunks = (len - 1) / chunk + 1;
+
+    // a single worker or a single chunk has nobody to share with, so other workers are not woken up
+    if (p->threads == 1 || chunks == 1) {
+        uint64_t start = NowNs();
+        for (uint32_t from = 0; from < len; from += chunk) {
+            fn(ctx, from, len - from > chunk ? from + chunk : len, 0);
+        }
+        TraceWorkerSpan(name, 0, start, NowNs());
+        return;
+    }
+
+    // every worker is idle, so shares are not contended
+    Lock(&p->lock);
+    p->fn = fn;
+    p->ctx = ctx;
+    p->len = len;
+    p->chunk = chunk;
+    for (uint32_t t = 0; t < p->threads; t++) {
+        Share *s = &p->shares[t].s;
+        s->begin = (uint32_t)((uint64_t)chunks * t / p->threads);
+        s->end = (uint32_t)((uint64_t)chunks * (t + 1) / p->threads);
+    }
+    p->running = p->threads;
+    p->loop++;
+    Broadcast(&p->wake);
+    Unlock(&p->lock);
+
+    Work(p, 0);
+
+    Lock(&p->lock);
+    while (p->running > 0) Wait(&p->done, &p->lock);
+    Unlock(&p->lock);
+
+    // spans are recorded by the caller, so the tracer is never used by two threads at once
+    for (uint32_t t = 0; t < p->threads; t++) {
+        const Share *s = &p->shares[t].s;
+        TraceWorkerSpan(name, (int)t, s->start, s->stop);
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef NB_POOL_H
+#define NB_POOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Work-stealing thread pool of CPU simulation and galaxy generation; works with any compiler.
+ * The thread that runs a loop is its worker 0, and the pool's own threads are the rest. Chunks of a loop start
+ * evenly divided between workers, so that neighbouring chunks stay on the same worker the way a static schedule
+ * keeps them; a worker that runs out of chunks steals half of what another one has left. Uniform loops thus cost
+ * about as much as with a static schedule, while tree walks and other irregular work are balanced.
+ * Threads sleep on a condition variable between loops.
+ */
+typedef struct Pool Pool;
+
+/* Body of a loop: process items [FROM, TO) of its range on worker TID. */
+typedef void (*PoolFn)(void *ctx, uint32_t from, uint32_t to, uint32_t tid);
+
+/* Pool of THREADS workers, the caller included. With PIN, worker K pins itself to the K-th CPU of affinity.h. */
+Pool *CreatePool(uint32_t threads, bool pin);
+
+/* Number of workers of P, the caller included. */
+uint32_t PoolThreads(const Pool *p);
+
+/* Stop and free the threads of P. */
+void DestroyPool(Pool *p);
+
+/*
+ * Run FN over items [0, LEN) in chunks of at most CHUNK items, and return once all of them are done.
+ * Every worker's part of the loop is recorded as trace span NAME. Must not be called from FN.
+ */
+void PoolFor(Pool *p, const char *name, uint32_t len, uint32_t chunk, PoolFn fn, void *ctx);
+
+#endif //NB_POOL_H
@@ -0,0 +1,222 @@
+#include "quadtree.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* Make sure T can fit COUNT bodies. */
+static void ReserveBodies(Quadtree *t, uint32_t count) {
+    if (count <= t->body_cap) return;
+
+    free(t->x);
+    free(t->y);
+    free(t->m);
+    free(t->idx);
+    free(t->tmp);
+
+    t->x = ALLOC(count, float);
+    t->y = ALLOC(count, float);
+    t->m = ALLOC(count, float);
+    t->idx = ALLOC(count, uint32_t);
+    t->tmp = ALLOC(count, uint32_t);
+    ASSERT(t->x != NULL && t->y != NULL && t->m != NULL && t->idx != NULL && t->tmp != NULL,
+           "Failed to alloc quadtree bodies for %u particles", count);
+
+    t->body_cap = count;
+}
+
+/* Append COUNT nodes to T and return index of the first one. */
+static uint32_t PushNodes(Quadtree *t, uint32_t count) {
+    if (t->node_len + count > t->node_cap) {
+        uint32_t cap = t->node_cap == 0 ? 64 : 2 * t->node_cap;
+        while (cap < t->node_len + count) cap *= 2;
+
+        QuadNode *nodes = realloc(t->nodes, cap * sizeof(QuadNode));
+        ASSERT(nodes != NULL, "Failed to realloc %u quadtree nodes", cap);
+
+        t->nodes = nodes;
+        t->node_cap = cap;
+    }
+    uint32_t first = t->node_len;
+    t->node_len += count;
+    return first;
+}
+
+/* Which quadrant of CENTER does P belong to. */
+static inline uint32_t Quadrant(V2 center, V2 p) {
+    return (p.x >= center.x ? 1u : 0u) | (p.y >= center.y ? 2u : 0u);
+}
+
+/* Split NODE into 4 children if it has too many bodies; repeat for children. */
+static void SplitNode(Quadtree *t, const ParticleSoA *soa, uint32_t node, uint32_t depth) {
+    QuadNode n = t->nodes[node];
+    uint32_t leaf_cap = t->leaf_cap > 0 ? t->leaf_cap : QT_LEAF_CAPACITY;
+    if (n.count <= leaf_cap || depth >= QT_MAX_DEPTH) return;
+
+    // sort bodies of NODE by quadrant
+    uint32_t offset[4] = {0}, count[4] = {0};
+    for (uint32_t k = n.first; k < n.first + n.count; k++) {
+        uint32_t i = t->idx[k];
+        count[Quadrant(n.center, V2_FROM(soa->x[i], soa->y[i]))]++;
+    }
+    for (uint32_t q = 1; q < 4; q++) {
+        offset[q] = offset[q - 1] + count[q - 1];
+    }
+    for (uint32_t k = n.first; k < n.first + n.count; k++) {
+        uint32_t i = t->idx[k];
+        uint32_t q = Quadrant(n.center, V2_FROM(soa->x[i], soa->y[i]));
+        t->tmp[offset[q]++] = i;
+    }
+    memcpy(&t->idx[n.first], t->tmp, n.count * sizeof(uint32_t));
+
+    // PushNodes may move nodes around, so N is a copy
+    uint32_t child = PushNodes(t, 4);
+    t->nodes[node].child = child;
+
+    float half = 0.5f * n.half;
+    uint32_t first = n.first;
+
+    for (uint32_t q = 0; q < 4; q++) {
+        t->nodes[child + q] = (QuadNode){
+                .center = V2_FROM(n.center.x + (q & 1 ? half : -half),
+                                  n.center.y + (q & 2 ? half : -half)),
+                .half = half,
+                .first = first,
+                .count = count[q],
+        };
+        first += count[q];
+    }
+    for (uint32_t q = 0; q < 4; q++) {
+        SplitNode(t, soa, child + q, depth + 1);
+    }
+}
+
+void BuildQuadtree(Quadtree *t, const ParticleSoA *soa, uint32_t count) {
+    ReserveBodies(t, count);
+    t->body_len = count;
+    t->node_len = 0;
+
+    // root is a square containing every particle
+    V2 min = V2_ZERO, max = V2_ZERO;
+    if (count > 0) {
+        min = max = V2_FROM(soa->x[0], soa->y[0]);
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        min.x = fminf(min.x, soa->x[i]);
+        min.y = fminf(min.y, soa->y[i]);
+        max.x = fmaxf(max.x, soa->x[i]);
+        max.y = fmaxf(max.y, soa->y[i]);
+        t->idx[i] = i;
+    }
+
+    uint32_t root = PushNodes(t, 1);
+    t->nodes[root] = (QuadNode){
+            .center = ScaleV2(AddV2(min, max), 0.5f),
+            .half = 0.5f * fmaxf(max.x - min.x, max.y - min.y),
+            .first = 0,
+            .count = count,
+    };
+    SplitNode(t, soa, root, 0);
+
+    // copy bodies in tree order
+    for (uint32_t k = 0; k < count; k++) {
+        uint32_t i = t->idx[k];
+        t->x[k] = soa->x[i];
+        t->y[k] = soa->y[i];
+        t->m[k] = soa->m[i];
+    }
+
+    // children always come after their parent, so going backwards visits children first
+    for (uint32_t i = t->node_len; i > 0; i--) {
+        QuadNode *n = &t->nodes[i - 1];
+        float mass = 0, mx = 0, my = 0;
+
+        if (n->child == 0) {
+            for (uint32_t k = n->first; k < n->first + n->count; k++) {
+                mass += t->m[k];
+                mx += t->m[k] * t->x[k];
+                my += t->m[k] * t->y[k];
+            }
+        } else {
+            for (uint32_t q = 0; q < 4; q++) {
+                const QuadNode *c = &t->nodes[n->child + q];
+                mass += c->mass;
+                mx += c->mass * c->com.x;
+                my += c->mass * c->com.y;
+            }
+        }
+
+        n->mass = mass;
+        n->com = mass > 0 ? V2_FROM(mx / mass, my / mass) : n->center;
+    }
+}
+
+void FreeQuadtree(Quadtree *t) {
+    if (t != NULL) {
+        free(t->nodes);
+        free(t->x);
+        free(t->y);
+        free(t->m);
+        free(t->idx);
+        free(t->tmp);
+        *t = (Quadtree){0};
+    }
+}
+
+V2 QuadtreeAcc(const Quadtree *t, V2 pos, float radius, float theta) {
+    if (t->body_len == 0) return V2_ZERO;
+
+    const float theta_sq = theta * theta;
+    float ax = 0, ay = 0;
+
+    // every visited node pushes at most 4 children, so the stack never exceeds 3 nodes per level plus 4
+    uint32_t stack[4 * QT_MAX_DEPTH + 4];
+    uint32_t top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        const QuadNode *n = &t->nodes[stack[--top]];
+        if (n->mass <= 0) continue;
+
+        float dx = n->com.x - pos.x;
+        float dy = n->com.y - pos.y;
+        float dist_sq = dx * dx + dy * dy;
+        float size = 2.f * n->half;
+
+        if (size * size < theta_sq * dist_sq) {
+            // far enough to treat the whole node as a single body
+            float r2 = dist_sq + radius;
+            float r1 = sqrtf(r2);
+            float f = NB_G * n->mass / (r1 * r2);
+
+            ax += dx * f;
+            ay += dy * f;
+        } else if (n->child == 0) {
+            for (uint32_t k = n->first; k < n->first + n->count; k++) {
+                float bx = t->x[k] - pos.x;
+                float by = t->y[k] - pos.y;
+
+                float r2 = bx * bx + by * by + radius;
+                float r1 = sqrtf(r2);
+                float f = NB_G * t->m[k] / (r1 * r2);
+
+                ax += bx * f;
+                ay += by * f;
+            }
+        } else {
+            for (uint32_t q = 0; q < 4; q++) {
+                stack[top++] = n->child + q;
+            }
+        }
+    }
+    return V2_FROM(ax, ay);
+}
+
+void QuadtreeAccel(const Quadtree *t, ParticleSoA *soa, uint32_t from, uint32_t to, float theta) {
+    for (uint32_t i = from; i < to; i++) {
+        V2 acc = QuadtreeAcc(t, V2_FROM(soa->x[i], soa->y[i]), soa->r[i], theta);
+        soa->ax[i] = acc.x;
+        soa->ay[i] = acc.y;
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef NB_QUADTREE_H
+#define NB_QUADTREE_H
+
+#include <nbody.h>
+#include <stdint.h>
+
+#include "sim_cpu.h"
+
+/* Default maximum number of bodies in a leaf node. */
+#define QT_LEAF_CAPACITY    8
+
+/* Maximum depth of the tree; nodes at this depth are leaves regardless of how many bodies they have. */
+#define QT_MAX_DEPTH        32
+
+/* Quadtree node. */
+typedef struct QuadNode {
+    V2 center;          // geometric center
+    float half;         // half of the side length
+    float mass;         // total mass of all bodies
+    V2 com;             // center of mass
+    uint32_t child;     // index of the first of 4 consecutive children; 0 if this node is a leaf
+    uint32_t first;     // index of the first body in tree order
+    uint32_t count;     // number of bodies
+} QuadNode;
+
+/*
+ * Quadtree over some bodies. Node 0 is the root.
+ * Positions and masses of bodies are copied in tree order, so that each node's bodies are contiguous.
+ */
+typedef struct Quadtree {
+    QuadNode *nodes;    // array of nodes
+    uint32_t node_len;  // number of nodes in use
+    uint32_t node_cap;  // capacity of NODES
+    float *x, *y, *m;   // body positions and masses in tree order
+    uint32_t *idx;      // idx[k] is the index of k-th body (in tree order) in the array the tree was built from
+    uint32_t *tmp;      // scratch space used while building
+    uint32_t body_len;  // number of bodies
+    uint32_t body_cap;  // capacity of body arrays
+    uint32_t leaf_cap;  // maximum number of bodies in a leaf node; 0 means QT_LEAF_CAPACITY
+} Quadtree;
+
+/* Build T over the first COUNT particles of SOA. Memory of T is reused between builds; zero-initialized T is empty. */
+void BuildQuadtree(Quadtree *t, const ParticleSoA *soa, uint32_t count);
+
+/* Free memory of T. */
+void FreeQuadtree(Quadtree *t);
+
+/*
+ * Gravitational acceleration at POS, softened by RADIUS the same way as CpuKernel.accel.
+ * A node is approximated by its center of mass if `node size / distance < THETA`; THETA of 0 is exact.
+ */
+V2 QuadtreeAcc(const Quadtree *t, V2 pos, float radius, float theta);
+
+/* Set acceleration of particles [FROM, TO) of SOA to the gravity of bodies of T. */
+void QuadtreeAccel(const Quadtree *t, ParticleSoA *soa, uint32_t from, uint32_t to, float theta);
+
+#endif //NB_QUADTREE_H
@@ -1,7 +1,10 @@
 #include "sim_cpu.h"
 #include "util.h"
 
-#if defined(USE_AVX) || defined(USE_SSE)
+#include <stdbool.h>
+#include <string.h>
+
+#ifdef USE_SIMD
 #   if __STDC_VERSION__ >= 201112L
 #       include <stdlib.h>
 #       define MEM_ALIGN(p, a, n)   (*(p) = aligned_alloc(a, n))
@@ -21,174 +24,178 @@
 #   define MEM_FREE(p)          free(p)
 #endif
 
-#ifdef USE_AVX
-
-#   include <immintrin.h>
-
-/* How many floats are packed together. */
-#   define SIMD_SIZE       8
-
-/* Create simd_t from FIELD of 8 P members. */
-#   define SIMD_SET_ARR(P, FIELD)  _mm256_set_ps((P)[0].FIELD, (P)[1].FIELD, (P)[2].FIELD, (P)[3].FIELD, \
-                                              (P)[4].FIELD, (P)[5].FIELD, (P)[6].FIELD, (P)[7].FIELD)
-
-#   define simd_t               __m256
-#   define simd_set1            _mm256_set1_ps
-#   define simd_setzero         _mm256_setzero_ps
-#   define simd_add             _mm256_add_ps
-#   define simd_sub             _mm256_sub_ps
-#   define simd_mul             _mm256_mul_ps
-#   define simd_div             _mm256_div_ps
-#   define simd_max             _mm256_max_ps
-#   define simd_sqrt            _mm256_sqrt_ps
-#   define simd_storeu          _mm256_storeu_ps
-
-#elif defined(USE_SSE)
-
-#   include <xmmintrin.h>
-
-/* Allocate N bytes aligned at A. */
-#   define ALIGNED_ALLOC(a, n) aligned_alloc(a, n)
-
-/* How many floats are packed together. */
-#   define SIMD_SIZE   4
-
-/* Create simd_t from FIELD of 4 P members. */
-#   define SIMD_SET_ARR(P, FIELD)  _mm_set_ps((P)[0].FIELD, (P)[1].FIELD, (P)[2].FIELD, (P)[3].FIELD)
-
-#   define simd_t               __m128
-#   define simd_set1            _mm_set1_ps
-#   define simd_setzero         _mm_setzero_ps
-#   define simd_add             _mm_add_ps
-#   define simd_sub             _mm_sub_ps
-#   define simd_mul             _mm_mul_ps
-#   define simd_div             _mm_div_ps
-#   define simd_max             _mm_max_ps
-#   define simd_sqrt            _mm_sqrt_ps
-#   define simd_storeu          _mm_storeu_ps
-
-#else
-
-#   include <math.h>
-
-/* How many floats are packed together. */
-#   define SIMD_SIZE   1
-
-/* Create simd_t from FIELD of P. */
-#   define SIMD_SET_ARR(P, FIELD)  (P)->FIELD
+#ifdef USE_SIMD
+#   if defined(__GNUC__)
+#       define CPU_SUPPORTS(FEATURE)    __builtin_cpu_supports(FEATURE)
+#   elif defined(_MSC_VER)
+#       include <intrin.h>
+#       define CPU_SUPPORTS(FEATURE)    MsvcCpuSupports(FEATURE)
+#   endif
+#endif
 
-#   define simd_t               float
-#   define simd_set1(x)         (x)
-#   define simd_setzero()       0.f
-#   define simd_add(a, b)       ((a) + (b))
-#   define simd_sub(a, b)       ((a) - (b))
-#   define simd_mul(a, b)       ((a) * (b))
-#   define simd_div(a, b)       ((a) / (b))
-#   define simd_max(a, b)       fmaxf(a, b)
-#   define simd_sqrt(a)         sqrtf(a)
-#   define simd_storeu(a, x)    ((a)[0] = (x))
+#ifndef CPU_SUPPORTS
+#   define CPU_SUPPORTS(FEATURE)        0
+#endif
 
+// kernels defined in sim_cpu_<simd>.c
+extern const CpuKernel cpu_kernel_none;
+#ifdef USE_SIMD
+extern const CpuKernel cpu_kernel_sse;
+extern const CpuKernel cpu_kernel_avx;
+extern const CpuKernel cpu_kernel_fma;
+extern const CpuKernel cpu_kernel_avx512;
 #endif
 
-struct ParticlePack {
-    simd_t x;   // position x
-    simd_t y;   // position y
-    simd_t m;   // mass
+static const char *const SIMD_NAMES[CPU_SIMD_COUNT] = {
+        [CPU_SIMD_NONE] = "none",
+        [CPU_SIMD_SSE] = "sse",
+        [CPU_SIMD_AVX] = "avx",
+        [CPU_SIMD_FMA] = "fma",
+        [CPU_SIMD_AVX512] = "avx512",
 };
 
-/* Merge SIMD_SIZE particles into a single pack. */
-static ParticlePack CreatePack(const Particle *p) {
-    return (ParticlePack){
-            .x = SIMD_SET_ARR(p, pos.x),
-            .y = SIMD_SET_ARR(p, pos.y),
-            .m = SIMD_SET_ARR(p, mass),
-    };
+#if defined(USE_SIMD) && defined(_MSC_VER)
+/* MSVC has no __builtin_cpu_supports, so query CPUID and XCR0 directly. */
+static int MsvcCpuSupports(const char *feature) {
+    int info[4], ext[4];
+    __cpuid(info, 1);
+    __cpuidex(ext, 7, 0);
+
+    // OS must save AVX (and AVX-512) registers on context switch
+    bool os_avx = (info[2] & (1 << 27)) && (_xgetbv(0) & 0x06) == 0x06;
+    bool os_avx512 = os_avx && (_xgetbv(0) & 0xe6) == 0xe6;
+
+    if (strcmp(feature, "sse") == 0) return info[3] & (1 << 25);
+    if (strcmp(feature, "avx") == 0) return os_avx && (info[2] & (1 << 28));
+    if (strcmp(feature, "fma") == 0) return os_avx && (info[2] & (1 << 12));
+    if (strcmp(feature, "avx2") == 0) return os_avx && (ext[1] & (1 << 5));
+    if (strcmp(feature, "avx512f") == 0) return os_avx512 && (ext[1] & (1 << 16));
+    return 0;
 }
+#endif
 
-void AllocPackArray(ParticlePack **arr, uint32_t *len, uint32_t count) {
-    if (count == 0) {
-        *len = 0;
-        *arr = NULL;
-    } else {
-        *len = count / SIMD_SIZE + (count % SIMD_SIZE == 0 ? 0 : 1);
-        (void)MEM_ALIGN(arr, 4 * SIMD_SIZE, *len * sizeof(ParticlePack));
-        ASSERT(*arr != NULL, "Failed to alloc %u ParticlePacks", *len);
-    }
+const char *GetCpuSimdName(CpuSimd simd) {
+    return simd < CPU_SIMD_COUNT ? SIMD_NAMES[simd] : "unknown";
 }
 
-void FreePackArray(ParticlePack *pack) {
-    if (pack != NULL) {
-        MEM_FREE(pack);
+const CpuKernel *GetCpuKernel(CpuSimd simd) {
+    switch (simd) {
+        case CPU_SIMD_NONE:
+            return &cpu_kernel_none;
+#ifdef USE_SIMD
+        case CPU_SIMD_SSE:
+            return CPU_SUPPORTS("sse") ? &cpu_kernel_sse : NULL;
+        case CPU_SIMD_AVX:
+            return CPU_SUPPORTS("avx") ? &cpu_kernel_avx : NULL;
+        case CPU_SIMD_FMA:
+            return CPU_SUPPORTS("avx2") && CPU_SUPPORTS("fma") ? &cpu_kernel_fma : NULL;
+        case CPU_SIMD_AVX512:
+            return CPU_SUPPORTS("avx512f") ? &cpu_kernel_avx512 : NULL;
+#endif
+        default:
+            return NULL;
     }
 }
 
-void PackParticles(uint32_t count, const Particle *ps, ParticlePack *packs) {
-    uint32_t rem = count % SIMD_SIZE;
-    uint32_t n = count / SIMD_SIZE;
-
-    #pragma omp parallel for schedule(static, 10) firstprivate(ps, packs, n) default(none)
-    for (uint32_t i = 0; i < n; i++) {
-        packs[i] = CreatePack(&ps[i * SIMD_SIZE]);
-    }
-    if (rem != 0) {
-        Particle rest[SIMD_SIZE];
-        for (uint32_t i = 0; i < rem; i++) {
-            rest[i] = ps[n * SIMD_SIZE + i];
-        }
-        for (uint32_t i = SIMD_SIZE; i > rem; i--) {
-            rest[i - 1] = (Particle){0};
+/* Pick the kernel according to NB_SIMD or the best one available. */
+static const CpuKernel *SelectCpuKernel(void) {
+    const char *env = getenv("NB_SIMD");
+    if (env != NULL && env[0] != '\0') {
+        for (int simd = 0; simd < CPU_SIMD_COUNT; simd++) {
+            if (strcmp(env, SIMD_NAMES[simd]) == 0) {
+                const CpuKernel *kernel = GetCpuKernel(simd);
+                ASSERT(kernel != NULL, "NB_SIMD=%s is not supported by this CPU or was not compiled", env);
+                return kernel;
+            }
         }
-        packs[n] = CreatePack(rest);
+        ASSERT(false, "Unknown NB_SIMD=%s; expected none, sse, avx, fma or avx512", env);
     }
-}
 
-/* Horizontal sun of X. Should probably be done with SIMD instructions. */
-static float simd_sum(simd_t x) {
-    float f[SIMD_SIZE], sum = 0;
-    simd_storeu(f, x);
-
-    for (int i = 0; i < SIMD_SIZE; i++) {
-        sum += f[i];
+    for (int simd = CPU_SIMD_COUNT - 1; simd > CPU_SIMD_NONE; simd--) {
+        const CpuKernel *kernel = GetCpuKernel(simd);
+        if (kernel != NULL) return kernel;
     }
-    return sum;
+    return &cpu_kernel_none;
 }
 
-void PackedUpdate(Particle *p, float dt, uint32_t packs_len, ParticlePack *packs) {
-    const simd_t g = simd_set1(NB_G);         // gravitational constant
-    const simd_t x = simd_set1(p->pos.x);     // position x
-    const simd_t y = simd_set1(p->pos.y);     // position y
-    const simd_t r = simd_set1(p->radius);    // radius
-
-    simd_t ax = simd_setzero();               // acceleration x
-    simd_t ay = simd_setzero();               // acceleration y
-
-    for (uint32_t i = 0; i < packs_len; i++) {
-        ParticlePack pack = packs[i];
+const CpuKernel *GetDefaultCpuKernel(void) {
+    static const CpuKernel *kernel = NULL;
+    if (kernel == NULL) {
+        kernel = SelectCpuKernel();
+        fprintf(stderr, "Using CPU kernel: %s\n", GetCpuSimdName(kernel->simd));
+    }
+    return kernel;
+}
 
-        // delta x and delta y
-        simd_t dx = simd_sub(pack.x, x);
-        simd_t dy = simd_sub(pack.y, y);
+void AllocParticleSoA(ParticleSoA *soa, uint32_t len) {
+    uint32_t cap = len + (len % SOA_PADDING == 0 ? 0 : SOA_PADDING - len % SOA_PADDING);
+    *soa = (ParticleSoA){
+            .len = len,
+            .cap = cap,
+    };
+    if (cap == 0) return;
+
+    // all arrays share a single allocation
+    float *mem;
+    (void)MEM_ALIGN(&mem, SOA_ALIGNMENT, 8 * cap * sizeof(float));
+    ASSERT(mem != NULL, "Failed to alloc SoA for %u particles", len);
+    memset(mem, 0, 8 * cap * sizeof(float));
+
+    soa->x = mem;
+    soa->y = mem + cap;
+    soa->vx = mem + 2 * cap;
+    soa->vy = mem + 3 * cap;
+    soa->ax = mem + 4 * cap;
+    soa->ay = mem + 5 * cap;
+    soa->m = mem + 6 * cap;
+    soa->r = mem + 7 * cap;
+}
 
-        // distance squared
-        simd_t dist_sq = simd_add(simd_mul(dx, dx),
-                                  simd_mul(dy, dy));
+void FreeParticleSoA(ParticleSoA *soa) {
+    if (soa != NULL && soa->x != NULL) {
+        MEM_FREE(soa->x);
+        *soa = (ParticleSoA){0};
+    }
+}
 
-        simd_t r2 = simd_add(dist_sq, r); // distance^2, softened
-        simd_t r1 = simd_sqrt(r2);        // distance^1, softened
+void PackParticles(const Particle *ps, ParticleSoA *soa) {
+    PackParticleRange(ps, soa, 0, soa->len);
+}
 
-        simd_t gm = simd_mul(pack.m, g);  // gravity times mass
-        simd_t r3 = simd_mul(r1, r2);     // distance^3
+void PackParticleRange(const Particle *ps, ParticleSoA *soa, uint32_t from, uint32_t to) {
+    for (uint32_t i = from; i < to; i++) {
+        soa->x[i] = ps[i].pos.x;
+        soa->y[i] = ps[i].pos.y;
+        soa->vx[i] = ps[i].vel.x;
+        soa->vy[i] = ps[i].vel.y;
+        soa->ax[i] = ps[i].acc.x;
+        soa->ay[i] = ps[i].acc.y;
+        soa->m[i] = ps[i].mass;
+        soa->r[i] = ps[i].radius;
+    }
+}
 
-        // acceleration == normalize(radv) * (Gm / dist^2)
-        //              == (radv / dist) * (Gm / dist^2)
-        //              == radv * (Gm / dist^3)
-        simd_t f = simd_div(gm, r3);
+void UnpackParticles(const ParticleSoA *soa, Particle *ps) {
+    UnpackParticleRange(soa, ps, 0, soa->len);
+}
 
-        ax = simd_add(ax, simd_mul(dx, f));
-        ay = simd_add(ay, simd_mul(dy, f));
+void UnpackParticleRange(const ParticleSoA *soa, Particle *ps, uint32_t from, uint32_t to) {
+    for (uint32_t i = from; i < to; i++) {
+        ps[i] = (Particle){
+                .pos = V2_FROM(soa->x[i], soa->y[i]),
+                .vel = V2_FROM(soa->vx[i], soa->vy[i]),
+                .acc = V2_FROM(soa->ax[i], soa->ay[i]),
+                .mass = soa->m[i],
+                .radius = soa->r[i],
+        };
     }
+}
 
-    p->acc = V2_FROM(simd_sum(ax), simd_sum(ay));
-    p->vel = AddV2(p->vel, ScaleV2(p->acc, dt));
-    p->pos = AddV2(p->pos, ScaleV2(p->vel, dt));
+void PackedIntegrate(ParticleSoA *soa, float kick, float drift, uint32_t from, uint32_t to) {
+    for (uint32_t i = from; i < to; i++) {
+        soa->vx[i] += soa->ax[i] * kick;
+        soa->vy[i] += soa->ay[i] * kick;
+        soa->x[i] += soa->vx[i] * drift;
+        soa->y[i] += soa->vy[i] * drift;
+    }
 }
@@ -4,23 +4,93 @@
 #include <nbody.h>
 #include <stdint.h>
 
-/* Some number of particles packed together for vectorization. */
-typedef struct ParticlePack ParticlePack;
+/* Every array of ParticleSoA is padded to a multiple of this many floats. */
+#define SOA_PADDING     16
+
+/* Alignment (in bytes) of every array of ParticleSoA. */
+#define SOA_ALIGNMENT   64
 
 /*
- * Allocate ParticlePack array that can fit COUNT particles.
- * ARR is set to allocated array.
- * LEN is set to array size.
+ * Particle data as a structure of arrays, which SIMD kernels read directly.
+ * Every array is aligned at SOA_ALIGNMENT and has CAP elements; elements past LEN are zeroed.
  */
-void AllocPackArray(ParticlePack **arr, uint32_t *len, uint32_t count);
+typedef struct ParticleSoA {
+    float *x, *y;       // position
+    float *vx, *vy;     // velocity
+    float *ax, *ay;     // acceleration
+    float *m;           // mass
+    float *r;           // radius
+    uint32_t len;       // number of particles
+    uint32_t cap;       // length of every array; LEN rounded up to a multiple of SOA_PADDING
+} ParticleSoA;
+
+/* Allocate SOA that can fit LEN particles. */
+void AllocParticleSoA(ParticleSoA *soa, uint32_t len);
+
+/* Free previously allocated SOA. */
+void FreeParticleSoA(ParticleSoA *soa);
+
+/* Copy `soa->len` particles from PS into SOA. */
+void PackParticles(const Particle *ps, ParticleSoA *soa);
+
+/* Copy particles [FROM, TO) from PS into SOA. */
+void PackParticleRange(const Particle *ps, ParticleSoA *soa, uint32_t from, uint32_t to);
+
+/* Copy `soa->len` particles from SOA into PS. */
+void UnpackParticles(const ParticleSoA *soa, Particle *ps);
+
+/* Copy particles [FROM, TO) from SOA into PS. */
+void UnpackParticleRange(const ParticleSoA *soa, Particle *ps, uint32_t from, uint32_t to);
+
+/* SIMD instruction sets CPU kernels can be compiled for, from the worst to the best. */
+typedef enum CpuSimd {
+    CPU_SIMD_NONE,      // plain C
+    CPU_SIMD_SSE,       // 4 floats per pack
+    CPU_SIMD_AVX,       // 8 floats per pack
+    CPU_SIMD_FMA,       // 8 floats per pack, AVX2 and fused multiply-add
+    CPU_SIMD_AVX512,    // 16 floats per pack, AVX-512F
+    CPU_SIMD_COUNT,
+} CpuSimd;
+
+/* Set of CPU kernels compiled for some SIMD instruction set. */
+typedef struct CpuKernel {
+    CpuSimd simd;       // instruction set
+    uint32_t width;     // how many floats are packed together
 
-/* Free previously allocated ParticlePack array. */
-void FreePackArray(ParticlePack *pack);
+    /* Set acceleration of particles [FROM, TO) of SOA to the gravity of its first MASS_LEN particles. */
+    void (*accel)(ParticleSoA *soa, uint32_t mass_len, uint32_t from, uint32_t to);
 
-/* Pack COUNT particles into PACKS. */
-void PackParticles(uint32_t count, const Particle *ps, ParticlePack *packs);
+    /* The same as ACCEL, but with approximate reciprocal square root instead of square root and division. */
+    void (*accel_fast)(ParticleSoA *soa, uint32_t mass_len, uint32_t from, uint32_t to);
+
+    /* The same as ACCEL and ACCEL_FAST, but with symmetric softening `dist^2 + (r_i + r_j) / 2`. */
+    void (*accel_sym)(ParticleSoA *soa, uint32_t mass_len, uint32_t from, uint32_t to);
+    void (*accel_sym_fast)(ParticleSoA *soa, uint32_t mass_len, uint32_t from, uint32_t to);
+
+    /*
+     * Add gravity between every pair (I, J) of the first MASS_LEN particles of SOA with I in [FROM, TO) and I < J
+     * to accumulators AX and AY of MASS_LEN elements. Every pair is computed once: I gets the pull of J and
+     * J gets the opposite pull of I. Softening is symmetric, the same as of ACCEL_SYM.
+     */
+    void (*pairs)(const ParticleSoA *soa, uint32_t mass_len, uint32_t from, uint32_t to, float *ax, float *ay);
+
+    /* The same as PAIRS, but with approximate reciprocal square root. */
+    void (*pairs_fast)(const ParticleSoA *soa, uint32_t mass_len, uint32_t from, uint32_t to, float *ax, float *ay);
+} CpuKernel;
+
+/* Name of SIMD as accepted by NB_SIMD environment variable. */
+const char *GetCpuSimdName(CpuSimd simd);
+
+/* Kernel compiled for SIMD; NULL if it was not compiled or this CPU does not support it. */
+const CpuKernel *GetCpuKernel(CpuSimd simd);
+
+/*
+ * The best kernel this CPU supports. The choice is made the first time this function is called,
+ * and can be overridden by setting NB_SIMD environment variable to the name of an instruction set.
+ */
+const CpuKernel *GetDefaultCpuKernel(void);
 
-/* Update P with PACKS. */
-void PackedUpdate(Particle *p, float dt, uint32_t packs_len, ParticlePack *packs);
+/* Integrate particles [FROM, TO) of SOA: `vel += acc * kick` followed by `pos += vel * drift`. */
+void PackedIntegrate(ParticleSoA *soa, float kick, float drift, uint32_t from, uint32_t to);
 
 #endif //NB_PARTICLE_PACK_H
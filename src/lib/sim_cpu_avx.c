@@ -0,0 +1,3 @@
+/* AVX variant of CPU kernels; this file is compiled with AVX enabled. */
+#define KERNEL_AVX
+#include "sim_cpu_kernel.h"
@@ -0,0 +1,3 @@
+/* AVX-512 variant of CPU kernels; this file is compiled with AVX-512 enabled. */
+#define KERNEL_AVX512
+#include "sim_cpu_kernel.h"
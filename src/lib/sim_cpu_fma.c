@@ -0,0 +1,3 @@
+/* AVX2 and FMA variant of CPU kernels; this file is compiled with AVX2 and FMA enabled. */
+#define KERNEL_FMA
+#include "sim_cpu_kernel.h"
@@ -0,0 +1,508 @@
+/*
+ * CPU kernels written once for every SIMD instruction set.
+ *
+ * This file is not a regular header: it is included by exactly one source file per instruction set,
+ * which defines one of KERNEL_AVX512, KERNEL_FMA, KERNEL_AVX, KERNEL_SSE or KERNEL_NONE beforehand
+ * and is compiled with that instruction set enabled. The result is a CpuKernel named `cpu_kernel_<set>`.
+ */
+
+#include "sim_cpu.h"
+
+#include <math.h>
+#include <stdbool.h>
+
+/* Functions that must be inlined, so that their constant arguments select code at compile time. */
+#ifdef _MSC_VER
+#   define FORCE_INLINE         static __forceinline
+#else
+#   define FORCE_INLINE         static inline __attribute__((always_inline))
+#endif
+
+#if defined(KERNEL_AVX512)
+
+#   include <immintrin.h>
+
+#   define KERNEL(NAME)         NAME##_avx512
+#   define KERNEL_SIMD          CPU_SIMD_AVX512
+
+/* How many floats are packed together. */
+#   define SIMD_SIZE            16
+
+#   define simd_t               __m512
+#   define simd_set1            _mm512_set1_ps
+#   define simd_setzero         _mm512_setzero_ps
+#   define simd_add             _mm512_add_ps
+#   define simd_sub             _mm512_sub_ps
+#   define simd_mul             _mm512_mul_ps
+#   define simd_div             _mm512_div_ps
+#   define simd_sqrt            _mm512_sqrt_ps
+#   define simd_rsqrt           _mm512_rsqrt14_ps
+#   define simd_fmadd           _mm512_fmadd_ps
+#   define simd_loadu           _mm512_loadu_ps
+#   define simd_storeu          _mm512_storeu_ps
+
+/* Horizontal sums of A, B, C and D stored in OUT[0..3]. */
+static inline void simd_reduce4(__m512 a, __m512 b, __m512 c, __m512 d, float *out) {
+    // fold 512-bit vectors in half and finish as AVX
+#   define FOLD_512(x)  _mm256_add_ps(_mm512_castps512_ps256(x), \
+                                      _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(x), 1)))
+    __m256 ab = _mm256_hadd_ps(FOLD_512(a), FOLD_512(b));
+    __m256 cd = _mm256_hadd_ps(FOLD_512(c), FOLD_512(d));
+#   undef FOLD_512
+    __m256 abcd = _mm256_hadd_ps(ab, cd);
+    _mm_storeu_ps(out, _mm_add_ps(_mm256_castps256_ps128(abcd), _mm256_extractf128_ps(abcd, 1)));
+}
+
+#elif defined(KERNEL_FMA)
+
+#   include <immintrin.h>
+
+#   define KERNEL(NAME)         NAME##_fma
+#   define KERNEL_SIMD          CPU_SIMD_FMA
+
+/* How many floats are packed together. */
+#   define SIMD_SIZE            8
+
+#   define simd_t               __m256
+#   define simd_set1            _mm256_set1_ps
+#   define simd_setzero         _mm256_setzero_ps
+#   define simd_add             _mm256_add_ps
+#   define simd_sub             _mm256_sub_ps
+#   define simd_mul             _mm256_mul_ps
+#   define simd_div             _mm256_div_ps
+#   define simd_sqrt            _mm256_sqrt_ps
+#   define simd_rsqrt           _mm256_rsqrt_ps
+#   define simd_fmadd           _mm256_fmadd_ps
+#   define simd_loadu           _mm256_loadu_ps
+#   define simd_storeu          _mm256_storeu_ps
+
+/* Horizontal sums of A, B, C and D stored in OUT[0..3]. */
+static inline void simd_reduce4(__m256 a, __m256 b, __m256 c, __m256 d, float *out) {
+    __m256 ab = _mm256_hadd_ps(a, b);       // a01 a23 b01 b23 | a45 a67 b45 b67
+    __m256 cd = _mm256_hadd_ps(c, d);       // c01 c23 d01 d23 | c45 c67 d45 d67
+    __m256 abcd = _mm256_hadd_ps(ab, cd);   // a0-3 b0-3 c0-3 d0-3 | a4-7 b4-7 c4-7 d4-7
+    _mm_storeu_ps(out, _mm_add_ps(_mm256_castps256_ps128(abcd), _mm256_extractf128_ps(abcd, 1)));
+}
+
+#elif defined(KERNEL_AVX)
+
+#   include <immintrin.h>
+
+#   define KERNEL(NAME)         NAME##_avx
+#   define KERNEL_SIMD          CPU_SIMD_AVX
+
+/* How many floats are packed together. */
+#   define SIMD_SIZE            8
+
+#   define simd_t               __m256
+#   define simd_set1            _mm256_set1_ps
+#   define simd_setzero         _mm256_setzero_ps
+#   define simd_add             _mm256_add_ps
+#   define simd_sub             _mm256_sub_ps
+#   define simd_mul             _mm256_mul_ps
+#   define simd_div             _mm256_div_ps
+#   define simd_sqrt            _mm256_sqrt_ps
+#   define simd_rsqrt           _mm256_rsqrt_ps
+#   define simd_fmadd(a, b, c)  _mm256_add_ps(_mm256_mul_ps(a, b), c)
+#   define simd_loadu           _mm256_loadu_ps
+#   define simd_storeu          _mm256_storeu_ps
+
+/* Horizontal sums of A, B, C and D stored in OUT[0..3]. */
+static inline void simd_reduce4(__m256 a, __m256 b, __m256 c, __m256 d, float *out) {
+    __m256 ab = _mm256_hadd_ps(a, b);       // a01 a23 b01 b23 | a45 a67 b45 b67
+    __m256 cd = _mm256_hadd_ps(c, d);       // c01 c23 d01 d23 | c45 c67 d45 d67
+    __m256 abcd = _mm256_hadd_ps(ab, cd);   // a0-3 b0-3 c0-3 d0-3 | a4-7 b4-7 c4-7 d4-7
+    _mm_storeu_ps(out, _mm_add_ps(_mm256_castps256_ps128(abcd), _mm256_extractf128_ps(abcd, 1)));
+}
+
+#elif defined(KERNEL_SSE)
+
+#   include <xmmintrin.h>
+
+#   define KERNEL(NAME)         NAME##_sse
+#   define KERNEL_SIMD          CPU_SIMD_SSE
+
+/* How many floats are packed together. */
+#   define SIMD_SIZE            4
+
+#   define simd_t               __m128
+#   define simd_set1            _mm_set1_ps
+#   define simd_setzero         _mm_setzero_ps
+#   define simd_add             _mm_add_ps
+#   define simd_sub             _mm_sub_ps
+#   define simd_mul             _mm_mul_ps
+#   define simd_div             _mm_div_ps
+#   define simd_sqrt            _mm_sqrt_ps
+#   define simd_rsqrt           _mm_rsqrt_ps
+#   define simd_fmadd(a, b, c)  _mm_add_ps(_mm_mul_ps(a, b), c)
+#   define simd_loadu           _mm_loadu_ps
+#   define simd_storeu          _mm_storeu_ps
+
+/* Horizontal sums of A, B, C and D stored in OUT[0..3]. */
+static inline void simd_reduce4(__m128 a, __m128 b, __m128 c, __m128 d, float *out) {
+    // after transposing, lane K of every vector belongs to K-th argument
+    _MM_TRANSPOSE4_PS(a, b, c, d);
+    _mm_storeu_ps(out, _mm_add_ps(_mm_add_ps(a, b), _mm_add_ps(c, d)));
+}
+
+#elif defined(KERNEL_NONE)
+
+#   define KERNEL(NAME)         NAME##_none
+#   define KERNEL_SIMD          CPU_SIMD_NONE
+
+/* How many floats are packed together. */
+#   define SIMD_SIZE            1
+
+#   define simd_t               float
+#   define simd_set1(x)         (x)
+#   define simd_setzero()       0.f
+#   define simd_add(a, b)       ((a) + (b))
+#   define simd_sub(a, b)       ((a) - (b))
+#   define simd_mul(a, b)       ((a) * (b))
+#   define simd_div(a, b)       ((a) / (b))
+#   define simd_sqrt(a)         sqrtf(a)
+#   define simd_fmadd(a, b, c)  ((a) * (b) + (c))
+#   define simd_loadu(a)        ((a)[0])
+#   define simd_storeu(a, x)    ((a)[0] = (x))
+
+/* Horizontal sums of A, B, C and D stored in OUT[0..3]. */
+static inline void simd_reduce4(float a, float b, float c, float d, float *out) {
+    out[0] = a;
+    out[1] = b;
+    out[2] = c;
+    out[3] = d;
+}
+
+#else
+#   error "sim_cpu_kernel.h is included without selecting an instruction set"
+#endif
+
+/* Some number of particles with mass packed together for vectorization. */
+typedef struct ParticlePack {
+    simd_t x;   // position x
+    simd_t y;   // position y
+    simd_t m;   // mass
+    simd_t r;   // radius; only read with symmetric softening, otherwise the load is optimized away
+} ParticlePack;
+
+/* Load SIMD_SIZE particles starting from I-th particle of SOA. */
+static inline ParticlePack LoadPack(const ParticleSoA *soa, uint32_t i) {
+    return (ParticlePack){
+            .x = simd_loadu(&soa->x[i]),
+            .y = simd_loadu(&soa->y[i]),
+            .m = simd_loadu(&soa->m[i]),
+            .r = simd_loadu(&soa->r[i]),
+    };
+}
+
+/*
+ * GM divided by R2^1.5. With FAST, the approximate reciprocal square root refined by one Newton-Raphson
+ * step replaces the square root and the division, which are the slowest instructions of the kernel.
+ */
+static inline simd_t Force(simd_t gm, simd_t r2, bool fast) {
+#ifdef simd_rsqrt
+    if (fast) {
+        simd_t y = simd_rsqrt(r2);
+        // y = y * (1.5 - 0.5 * r2 * y^2)
+        simd_t half_r2y2 = simd_mul(simd_mul(simd_set1(0.5f), r2), simd_mul(y, y));
+        y = simd_mul(y, simd_sub(simd_set1(1.5f), half_r2y2));
+        return simd_mul(gm, simd_mul(y, simd_mul(y, y)));
+    }
+#else
+    (void)fast;     // plain C has no approximate square root, so the exact path is the fast one
+#endif
+    simd_t r1 = simd_sqrt(r2);    // distance^1, softened
+    simd_t r3 = simd_mul(r1, r2); // distance^3
+    return simd_div(gm, r3);
+}
+
+/* How many target particles are updated with every loaded pack. */
+#define BLOCK_SIZE  4
+
+/* Gravity of a single particle with mass J at distance (DX, DY) from a particle with radius R. */
+static inline V2 ScalarAcc(const ParticleSoA *soa, uint32_t j, float dx, float dy, float r) {
+    float r2 = dx * dx + dy * dy + r;
+    float r1 = sqrtf(r2);
+    float f = NB_G * soa->m[j] / (r1 * r2);
+    return V2_FROM(dx * f, dy * f);
+}
+
+/*
+ * Softening term of a target with radius R: R itself, or half of it with SYM, in which case
+ * the other half comes from the source, so that `dist^2 + (r_i + r_j) / 2` is the same for both of them.
+ */
+#define TARGET_SOFT(R, SYM)     ((SYM) ? 0.5f * (R) : (R))
+
+/*
+ * Set acceleration of particles [I, I + BLOCK_SIZE) of SOA to the gravity of its first MASS_LEN particles.
+ * Every pack is loaded once and used for all particles of the block. FAST selects approximate Force,
+ * SYM selects symmetric softening.
+ */
+FORCE_INLINE void AccelBlock(ParticleSoA *soa, uint32_t mass_len, uint32_t i, bool fast, bool sym) {
+    const simd_t g = simd_set1(NB_G);         // gravitational constant
+    const simd_t half = simd_set1(0.5f);
+
+    simd_t x[BLOCK_SIZE], y[BLOCK_SIZE], r[BLOCK_SIZE];     // position and radius of targets
+    simd_t ax[BLOCK_SIZE], ay[BLOCK_SIZE];                  // acceleration of targets
+
+    for (int k = 0; k < BLOCK_SIZE; k++) {
+        x[k] = simd_set1(soa->x[i + k]);
+        y[k] = simd_set1(soa->y[i + k]);
+        r[k] = simd_set1(TARGET_SOFT(soa->r[i + k], sym));
+        ax[k] = simd_setzero();
+        ay[k] = simd_setzero();
+    }
+
+    uint32_t packed_len = mass_len - mass_len % SIMD_SIZE;
+    for (uint32_t j = 0; j < packed_len; j += SIMD_SIZE) {
+        ParticlePack pack = LoadPack(soa, j);
+        simd_t gm = simd_mul(pack.m, g);  // gravity times mass
+        simd_t rj = sym ? simd_mul(half, pack.r) : simd_setzero();
+
+        for (int k = 0; k < BLOCK_SIZE; k++) {
+            // delta x and delta y
+            simd_t dx = simd_sub(pack.x, x[k]);
+            simd_t dy = simd_sub(pack.y, y[k]);
+
+            // distance^2, softened
+            simd_t soft = sym ? simd_add(r[k], rj) : r[k];
+            simd_t r2 = simd_fmadd(dx, dx, simd_fmadd(dy, dy, soft));
+
+            // acceleration == normalize(radv) * (Gm / dist^2)
+            //              == (radv / dist) * (Gm / dist^2)
+            //              == radv * (Gm / dist^3)
+            simd_t f = Force(gm, r2, fast);
+
+            ax[k] = simd_fmadd(dx, f, ax[k]);
+            ay[k] = simd_fmadd(dy, f, ay[k]);
+        }
+    }
+
+    float sum_x[BLOCK_SIZE], sum_y[BLOCK_SIZE];
+    simd_reduce4(ax[0], ax[1], ax[2], ax[3], sum_x);
+    simd_reduce4(ay[0], ay[1], ay[2], ay[3], sum_y);
+
+    for (int k = 0; k < BLOCK_SIZE; k++) {
+        // particles that don't fill a whole pack
+        for (uint32_t j = packed_len; j < mass_len; j++) {
+            float soft = TARGET_SOFT(soa->r[i + k], sym) + (sym ? 0.5f * soa->r[j] : 0.f);
+            V2 acc = ScalarAcc(soa, j, soa->x[j] - soa->x[i + k], soa->y[j] - soa->y[i + k], soft);
+            sum_x[k] += acc.x;
+            sum_y[k] += acc.y;
+        }
+        soa->ax[i + k] = sum_x[k];
+        soa->ay[i + k] = sum_y[k];
+    }
+}
+
+/* Set acceleration of I-th particle of SOA to the gravity of its first MASS_LEN particles. */
+FORCE_INLINE void AccelOne(ParticleSoA *soa, uint32_t mass_len, uint32_t i, bool fast, bool sym) {
+    const simd_t g = simd_set1(NB_G);         // gravitational constant
+    const simd_t half = simd_set1(0.5f);
+    const simd_t x = simd_set1(soa->x[i]);    // position x
+    const simd_t y = simd_set1(soa->y[i]);    // position y
+    const simd_t r = simd_set1(TARGET_SOFT(soa->r[i], sym));    // softening of the target
+
+    simd_t ax = simd_setzero();               // acceleration x
+    simd_t ay = simd_setzero();               // acceleration y
+
+    uint32_t packed_len = mass_len - mass_len % SIMD_SIZE;
+    for (uint32_t j = 0; j < packed_len; j += SIMD_SIZE) {
+        ParticlePack pack = LoadPack(soa, j);
+
+        simd_t dx = simd_sub(pack.x, x);
+        simd_t dy = simd_sub(pack.y, y);
+
+        simd_t soft = sym ? simd_fmadd(half, pack.r, r) : r;
+        simd_t r2 = simd_fmadd(dx, dx, simd_fmadd(dy, dy, soft));
+        simd_t f = Force(simd_mul(pack.m, g), r2, fast);
+
+        ax = simd_fmadd(dx, f, ax);
+        ay = simd_fmadd(dy, f, ay);
+    }
+
+    // reduce together with zeros to reuse the vectorized reduction
+    const simd_t zero = simd_setzero();
+    float sum_x[BLOCK_SIZE], sum_y[BLOCK_SIZE];
+    simd_reduce4(ax, zero, zero, zero, sum_x);
+    simd_reduce4(ay, zero, zero, zero, sum_y);
+
+    for (uint32_t j = packed_len; j < mass_len; j++) {
+        float soft = TARGET_SOFT(soa->r[i], sym) + (sym ? 0.5f * soa->r[j] : 0.f);
+        V2 acc = ScalarAcc(soa, j, soa->x[j] - soa->x[i], soa->y[j] - soa->y[i], soft);
+        sum_x[0] += acc.x;
+        sum_y[0] += acc.y;
+    }
+    soa->ax[i] = sum_x[0];
+    soa->ay[i] = sum_y[0];
+}
+
+/* Shared body of Accel variants; FAST and SYM are constants, so each variant gets its own copy of the loops. */
+FORCE_INLINE void AccelRange(ParticleSoA *soa, uint32_t mass_len, uint32_t from, uint32_t to, bool fast, bool sym) {
+    uint32_t i = from;
+    for (; i + BLOCK_SIZE <= to; i += BLOCK_SIZE) {
+        AccelBlock(soa, mass_len, i, fast, sym);
+    }
+    for (; i < to; i++) {
+        AccelOne(soa, mass_len, i, fast, sym);
+    }
+}
+
+static void Accel(ParticleSoA *soa, uint32_t mass_len, uint32_t from, uint32_t to) {
+    AccelRange(soa, mass_len, from, to, false, false);
+}
+
+static void AccelFast(ParticleSoA *soa, uint32_t mass_len, uint32_t from, uint32_t to) {
+    AccelRange(soa, mass_len, from, to, true, false);
+}
+
+static void AccelSym(ParticleSoA *soa, uint32_t mass_len, uint32_t from, uint32_t to) {
+    AccelRange(soa, mass_len, from, to, false, true);
+}
+
+static void AccelSymFast(ParticleSoA *soa, uint32_t mass_len, uint32_t from, uint32_t to) {
+    AccelRange(soa, mass_len, from, to, true, true);
+}
+
+/*
+ * Gravity between particles I and J of SOA with symmetric softening: I's pull is added to (AXI, AYI),
+ * the opposite pull of J is subtracted from AX[J] and AY[J].
+ */
+static inline void ScalarPair(const ParticleSoA *soa, uint32_t i, uint32_t j,
+                              float *axi, float *ayi, float *ax, float *ay) {
+    float dx = soa->x[j] - soa->x[i];
+    float dy = soa->y[j] - soa->y[i];
+    float r2 = dx * dx + dy * dy + 0.5f * (soa->r[i] + soa->r[j]);
+    float inv_r3 = 1.f / (sqrtf(r2) * r2);
+
+    float fi = NB_G * soa->m[j] * inv_r3;   // pull on I
+    float fj = NB_G * soa->m[i] * inv_r3;   // pull on J
+    *axi += dx * fi;
+    *ayi += dy * fi;
+    ax[j] -= dx * fj;
+    ay[j] -= dy * fj;
+}
+
+/*
+ * Add gravity of every pair (I + K, J) with K < BLOCK_SIZE and I + BLOCK_SIZE <= J < MASS_LEN to AX and AY.
+ * Every pack of sources and accumulators is loaded once for all rows of the block; I's pulls are added
+ * to AXI and AYI.
+ */
+FORCE_INLINE void PairsBlock(const ParticleSoA *soa, uint32_t mass_len, uint32_t i,
+                             float *axi, float *ayi, float *ax, float *ay, bool fast) {
+    const simd_t g = simd_set1(NB_G);
+    const simd_t half = simd_set1(0.5f);
+    const simd_t one = simd_set1(1.f);
+
+    simd_t xi[BLOCK_SIZE], yi[BLOCK_SIZE], ri[BLOCK_SIZE], gmi[BLOCK_SIZE];
+    simd_t vaxi[BLOCK_SIZE], vayi[BLOCK_SIZE];
+    for (int k = 0; k < BLOCK_SIZE; k++) {
+        xi[k] = simd_set1(soa->x[i + k]);
+        yi[k] = simd_set1(soa->y[i + k]);
+        ri[k] = simd_set1(0.5f * soa->r[i + k]);
+        gmi[k] = simd_set1(NB_G * soa->m[i + k]);
+        vaxi[k] = simd_setzero();
+        vayi[k] = simd_setzero();
+    }
+
+    // scalar until J is at a pack boundary
+    uint32_t j = i + BLOCK_SIZE;
+    for (; j < mass_len && j % SIMD_SIZE != 0; j++) {
+        for (int k = 0; k < BLOCK_SIZE; k++) {
+            ScalarPair(soa, i + k, j, &axi[k], &ayi[k], ax, ay);
+        }
+    }
+
+    for (; j + SIMD_SIZE <= mass_len; j += SIMD_SIZE) {
+        ParticlePack pack = LoadPack(soa, j);
+        simd_t gmj = simd_mul(g, pack.m);
+        simd_t rj = simd_mul(half, pack.r);
+        simd_t axj = simd_loadu(&ax[j]);
+        simd_t ayj = simd_loadu(&ay[j]);
+
+        for (int k = 0; k < BLOCK_SIZE; k++) {
+            simd_t dx = simd_sub(pack.x, xi[k]);
+            simd_t dy = simd_sub(pack.y, yi[k]);
+            simd_t r2 = simd_fmadd(dx, dx, simd_fmadd(dy, dy, simd_add(ri[k], rj)));
+            simd_t inv_r3 = Force(one, r2, fast);
+
+            simd_t fi = simd_mul(gmj, inv_r3);      // pulls on I + K
+            vaxi[k] = simd_fmadd(dx, fi, vaxi[k]);
+            vayi[k] = simd_fmadd(dy, fi, vayi[k]);
+
+            simd_t fj = simd_mul(gmi[k], inv_r3);   // pulls on J
+            axj = simd_sub(axj, simd_mul(dx, fj));
+            ayj = simd_sub(ayj, simd_mul(dy, fj));
+        }
+        simd_storeu(&ax[j], axj);
+        simd_storeu(&ay[j], ayj);
+    }
+
+    for (; j < mass_len; j++) {
+        for (int k = 0; k < BLOCK_SIZE; k++) {
+            ScalarPair(soa, i + k, j, &axi[k], &ayi[k], ax, ay);
+        }
+    }
+
+    float sum_x[BLOCK_SIZE], sum_y[BLOCK_SIZE];
+    simd_reduce4(vaxi[0], vaxi[1], vaxi[2], vaxi[3], sum_x);
+    simd_reduce4(vayi[0], vayi[1], vayi[2], vayi[3], sum_y);
+    for (int k = 0; k < BLOCK_SIZE; k++) {
+        axi[k] += sum_x[k];
+        ayi[k] += sum_y[k];
+    }
+}
+
+/*
+ * Add gravity of every pair (I, J) with I < J < MASS_LEN to AX and AY, for rows I in [FROM, TO).
+ * Each pair is computed once: I gets the pull of J and J gets the opposite pull of I.
+ */
+FORCE_INLINE void PairsRange(const ParticleSoA *soa, uint32_t mass_len, uint32_t from, uint32_t to,
+                             float *ax, float *ay, bool fast) {
+    uint32_t i = from;
+    for (; i + BLOCK_SIZE <= to; i += BLOCK_SIZE) {
+        float axi[BLOCK_SIZE] = {0}, ayi[BLOCK_SIZE] = {0};
+
+        // pairs within the block
+        for (int k = 0; k < BLOCK_SIZE; k++) {
+            for (int l = k + 1; l < BLOCK_SIZE; l++) {
+                ScalarPair(soa, i + k, i + l, &axi[k], &ayi[k], ax, ay);
+            }
+        }
+        PairsBlock(soa, mass_len, i, axi, ayi, ax, ay, fast);
+
+        for (int k = 0; k < BLOCK_SIZE; k++) {
+            ax[i + k] += axi[k];
+            ay[i + k] += ayi[k];
+        }
+    }
+
+    // remaining rows pair with everything after them one by one
+    for (; i < to; i++) {
+        float axi = 0, ayi = 0;
+        for (uint32_t j = i + 1; j < mass_len; j++) {
+            ScalarPair(soa, i, j, &axi, &ayi, ax, ay);
+        }
+        ax[i] += axi;
+        ay[i] += ayi;
+    }
+}
+
+static void Pairs(const ParticleSoA *soa, uint32_t mass_len, uint32_t from, uint32_t to, float *ax, float *ay) {
+    PairsRange(soa, mass_len, from, to, ax, ay, false);
+}
+
+static void PairsFast(const ParticleSoA *soa, uint32_t mass_len, uint32_t from, uint32_t to, float *ax, float *ay) {
+    PairsRange(soa, mass_len, from, to, ax, ay, true);
+}
+
+const CpuKernel KERNEL(cpu_kernel) = {
+        .simd = KERNEL_SIMD,
+        .width = SIMD_SIZE,
+        .accel = Accel,
+        .accel_fast = AccelFast,
+        .accel_sym = AccelSym,
+        .accel_sym_fast = AccelSymFast,
+        .pairs = Pairs,
+        .pairs_fast = PairsFast,
+};
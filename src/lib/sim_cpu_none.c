@@ -0,0 +1,3 @@
+/* CPU kernels without SIMD; always compiled, used when nothing better is available. */
+#define KERNEL_NONE
+#include "sim_cpu_kernel.h"
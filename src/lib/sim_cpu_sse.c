@@ -0,0 +1,3 @@
+/* SSE variant of CPU kernels; this file is compiled with SSE enabled. */
+#define KERNEL_SSE
+#include "sim_cpu_kernel.h"
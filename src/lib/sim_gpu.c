@@ -3,12 +3,24 @@
 #include <stdbool.h>
 
 #include "vulkan_ctx.h"
+#include "trace.h"
 #include "util.h"
 #include "../shader/particle_cs.h"
+#include "../shader/particle_tiled_cs.h"
 
 /* Compute shader work group size. */
 #define LOCAL_SIZE_X 256
 
+/* Maximum number of updates submitted to GPU at the same time. */
+#define SIM_FRAMES  2
+
+/* Integrator stage given to shaders in push constants; see Stage. */
+typedef struct StageData {
+    float kick;         // velocity step as a fraction of dt
+    float drift;        // position step as a fraction of dt
+    uint32_t accel;     // whether acceleration is computed; otherwise the stored one is used
+} StageData;
+
 struct SimPipeline {
     WorldData world_data;
     VkShaderModule shader;
@@ -16,28 +28,51 @@ struct SimPipeline {
     VulkanDeviceMemory dev_mem;     // device-local memory
     VulkanDeviceMemory host_mem;    // host-accessible memory
     VulkanBuffer uniform;           // uniform buffer in device-local memory
-    VulkanBuffer storage[2];        // uniform buffer in device-local memory; [0] for old data, [1] for new
-    VulkanBuffer transfer_buf[2];   // host-accessible transfer buffers; [0] for uniform, [1] for storage
-    bool transfer_buf_synced;       // whether transfer_buf[1] holds the same data as storage[1]
+    VulkanBuffer storage[2];        // storage buffers in device-local memory; take turns holding old and new data
+    VulkanBuffer transfer_buf;      // host-accessible transfer buffer of storage size
+    uint32_t cur;                   // index of storage buffer that holds the latest data
+    bool transfer_buf_synced;       // whether transfer_buf holds the same data as storage[cur]
     // Descriptor
     VkDescriptorSetLayout ds_layout;
     VkDescriptorPool ds_pool;
-    VkDescriptorSet set;
+    VkDescriptorSet set[2];         // set[k] reads storage[k] and writes storage[1 - k]
     // Pipeline
     VkPipelineLayout pipeline_layout;
     VkPipeline pipeline;
-    // Commands and synchronization
-    VkCommandBuffer cmd;
-    VkFence fence;
+    // Commands and synchronization; update with ticket T uses [(T - 1) % SIM_FRAMES]
+    VkCommandBuffer cmd[SIM_FRAMES];
+    VkFence fence[SIM_FRAMES];
+    uint64_t submitted;             // ticket of the last submitted update
+    uint64_t completed;             // ticket of the last update known to be complete
+    // Statistics; frame F uses queries [2 * F * span_cap, 2 * (F + 1) * span_cap) of timestamps
+    VkQueryPool timestamps;         // a pair of timestamps around every command; NULL until the first update
+                                    // and if timestamps are not supported
+    uint32_t span_cap;              // number of timestamp pairs per frame
+    const char **span_names;        // name of every timestamp pair, SPAN_CAP per frame
+    uint64_t *ticks;                // scratch space for timestamps of one frame
+    uint32_t frame_spans[SIM_FRAMES];   // number of timestamp pairs written by each frame
+    uint32_t frame_steps[SIM_FRAMES];   // number of dispatches (integrator stages) of each frame
+    uint32_t first_dispatch[SIM_FRAMES];    // timestamp pair of the first dispatch of each frame
+    uint32_t last_dispatch[SIM_FRAMES];     // timestamp pair of the last dispatch of each frame
+    PhaseStats upload, dispatch, readback;
 };
 
-SimPipeline *CreateSimPipeline(WorldData data) {
+SimPipeline *CreateSimPipeline(WorldData data, GpuKernel kernel) {
     SimPipeline *sim = ALLOC(1, SimPipeline);
     ASSERT(sim != NULL, "Failed to alloc SimPipeline");
 
     InitGlobalVulkanContext();  // does nothing if global context was already initialized
     sim->world_data = data;
     sim->world_data.dt = 0;     // update uniform buffer when PerformSimUpdate is called
+    sim->cur = 0;
+    sim->transfer_buf_synced = false;
+    sim->submitted = 0;
+    sim->completed = 0;
+    sim->timestamps = VK_NULL_HANDLE;
+    sim->span_cap = 0;
+    sim->span_names = NULL;
+    sim->ticks = NULL;
+    sim->upload = sim->dispatch = sim->readback = (PhaseStats){0};
 
     /*
      * Shaders.
@@ -45,9 +80,18 @@ SimPipeline *CreateSimPipeline(WorldData data) {
 
     VkShaderModuleCreateInfo create_info = {
             .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-            .codeSize = sizeof(particle_cs_spv),
-            .pCode = (uint32_t *)particle_cs_spv,
     };
+    switch (kernel) {
+        case GPU_KERNEL_TILED:
+            create_info.codeSize = sizeof(particle_tiled_cs_spv);
+            create_info.pCode = (uint32_t *)particle_tiled_cs_spv;
+            break;
+        case GPU_KERNEL_DIRECT:
+        default:
+            create_info.codeSize = sizeof(particle_cs_spv);
+            create_info.pCode = (uint32_t *)particle_cs_spv;
+            break;
+    }
     ASSERT_VK(vkCreateShaderModule(vulkan_ctx.dev, &create_info, NULL, &sim->shader),
               "Failed to create shader compute shader module");
 
@@ -85,7 +129,7 @@ SimPipeline *CreateSimPipeline(WorldData data) {
     const VkDeviceSize uniform_size = SIZE_OF_ALIGN_16(WorldData);
     const VkDeviceSize storage_size = data.total_len * sizeof(Particle);
 
-    sim->host_mem = CreateHostCoherentMemory(uniform_size + storage_size);
+    sim->host_mem = CreateHostCoherentMemory(storage_size);
     sim->dev_mem = CreateDeviceLocalMemory(uniform_size + 2 * storage_size);
 
     VkBufferUsageFlags transfer_buf_flags = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
@@ -95,8 +139,7 @@ SimPipeline *CreateSimPipeline(WorldData data) {
     sim->uniform = CreateVulkanBuffer(&sim->dev_mem, uniform_size, uniform_buf_flags);
     sim->storage[0] = CreateVulkanBuffer(&sim->dev_mem, storage_size, storage_buf_flags);
     sim->storage[1] = CreateVulkanBuffer(&sim->dev_mem, storage_size, storage_buf_flags);
-    sim->transfer_buf[0] = CreateVulkanBuffer(&sim->host_mem, uniform_size, transfer_buf_flags);
-    sim->transfer_buf[1] = CreateVulkanBuffer(&sim->host_mem, storage_size, transfer_buf_flags);
+    sim->transfer_buf = CreateVulkanBuffer(&sim->host_mem, storage_size, transfer_buf_flags);
 
     /*
      * Descriptors.
@@ -133,68 +176,79 @@ SimPipeline *CreateSimPipeline(WorldData data) {
     VkDescriptorPoolSize ds_pool_size[2] = {
             {
                     .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                    .descriptorCount = 1,
+                    .descriptorCount = 2,
             },
             {
                     .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-                    .descriptorCount = 2,
+                    .descriptorCount = 4,
             },
     };
     VkDescriptorPoolCreateInfo ds_pool_info = {
             .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-            .maxSets = 1,
+            .maxSets = 2,
             .poolSizeCount = 2,
             .pPoolSizes = ds_pool_size,
     };
     ASSERT_VK(vkCreateDescriptorPool(vulkan_ctx.dev, &ds_pool_info, NULL, &sim->ds_pool),
               "Failed to create descriptor pool");
 
+    VkDescriptorSetLayout ds_layouts[2] = {sim->ds_layout, sim->ds_layout};
     VkDescriptorSetAllocateInfo ds_alloc_info = {
             .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
             .descriptorPool = sim->ds_pool,
-            .descriptorSetCount = 1,
-            .pSetLayouts = &sim->ds_layout,
+            .descriptorSetCount = 2,
+            .pSetLayouts = ds_layouts,
     };
-    ASSERT_VK(vkAllocateDescriptorSets(vulkan_ctx.dev, &ds_alloc_info, &sim->set),
-              "Failed to allocate descriptor set");
+    ASSERT_VK(vkAllocateDescriptorSets(vulkan_ctx.dev, &ds_alloc_info, sim->set),
+              "Failed to allocate descriptor sets");
 
     /*
-     * Update descriptor set.
+     * Update descriptor sets.
      */
 
-    VkDescriptorBufferInfo uniform_info, storage_info[2];
+    // storage_info[k] and storage_info[k + 1] are old and new buffers of set[k]
+    VkDescriptorBufferInfo uniform_info, storage_info[3];
     FillDescriptorBufferInfo(&sim->uniform, &uniform_info);
     FillDescriptorBufferInfo(&sim->storage[0], &storage_info[0]);
     FillDescriptorBufferInfo(&sim->storage[1], &storage_info[1]);
-
-    VkWriteDescriptorSet write_sets[2] = {
-            {
-                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                    .dstSet = sim->set,
-                    .dstBinding = 0,
-                    .descriptorCount = 1,
-                    .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                    .pBufferInfo = &uniform_info,
-            },
-            {
-                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                    .dstSet = sim->set,
-                    .dstBinding = 1,
-                    .descriptorCount = 2,
-                    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-                    .pBufferInfo = storage_info,
-            },
-    };
-    vkUpdateDescriptorSets(vulkan_ctx.dev, 2, write_sets, 0, NULL);
+    FillDescriptorBufferInfo(&sim->storage[0], &storage_info[2]);
+
+    VkWriteDescriptorSet write_sets[4];
+    for (int k = 0; k < 2; k++) {
+        write_sets[2 * k] = (VkWriteDescriptorSet){
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = sim->set[k],
+                .dstBinding = 0,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                .pBufferInfo = &uniform_info,
+        };
+        write_sets[2 * k + 1] = (VkWriteDescriptorSet){
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = sim->set[k],
+                .dstBinding = 1,
+                .descriptorCount = 2,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .pBufferInfo = &storage_info[k],
+        };
+    }
+    vkUpdateDescriptorSets(vulkan_ctx.dev, 4, write_sets, 0, NULL);
 
     /*
      * Pipeline.
      */
 
+    VkPushConstantRange push_range = {
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            .offset = 0,
+            .size = sizeof(StageData),
+    };
     VkPipelineLayoutCreateInfo layout_info = {
             .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
             .setLayoutCount = 1,
             .pSetLayouts = &sim->ds_layout,
+            .pushConstantRangeCount = 1,
+            .pPushConstantRanges = &push_range,
     };
     ASSERT_VK(vkCreatePipelineLayout(vulkan_ctx.dev, &layout_info, NULL, &sim->pipeline_layout),
               "Failed to create pipeline layout");
@@ -211,11 +265,13 @@ SimPipeline *CreateSimPipeline(WorldData data) {
      * Command buffers and synchronization.
      */
 
-    AllocCommandBuffers(1, &sim->cmd);
+    AllocCommandBuffers(SIM_FRAMES, sim->cmd);
     VkFenceCreateInfo fence_info = {
             .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
     };
-    ASSERT_VK(vkCreateFence(vulkan_ctx.dev, &fence_info, NULL, &sim->fence), "Failed to create fence");
+    for (int i = 0; i < SIM_FRAMES; i++) {
+        ASSERT_VK(vkCreateFence(vulkan_ctx.dev, &fence_info, NULL, &sim->fence[i]), "Failed to create fence");
+    }
 
     return sim;
 }
@@ -224,8 +280,18 @@ void DestroySimPipeline(SimPipeline *sim) {
     if (sim != NULL) {
         VkDevice dev = vulkan_ctx.dev;
 
-        vkDestroyFence(dev, sim->fence, NULL);
-        vkFreeCommandBuffers(dev, vulkan_ctx.cmd_pool, 1, &sim->cmd);
+        // resources must not be in use
+        WaitSimUpdate(sim, sim->submitted);
+
+        for (int i = 0; i < SIM_FRAMES; i++) {
+            vkDestroyFence(dev, sim->fence[i], NULL);
+        }
+        vkFreeCommandBuffers(dev, vulkan_ctx.cmd_pool, SIM_FRAMES, sim->cmd);
+        if (sim->timestamps != VK_NULL_HANDLE) {
+            vkDestroyQueryPool(dev, sim->timestamps, NULL);
+        }
+        free(sim->span_names);
+        free(sim->ticks);
 
         vkDestroyPipeline(dev, sim->pipeline, NULL);
         vkDestroyPipelineLayout(dev, sim->pipeline_layout, NULL);
@@ -233,8 +299,7 @@ void DestroySimPipeline(SimPipeline *sim) {
         vkDestroyDescriptorPool(dev, sim->ds_pool, NULL);
         vkDestroyDescriptorSetLayout(dev, sim->ds_layout, NULL);
 
-        DestroyVulkanBuffer(&sim->transfer_buf[0]);
-        DestroyVulkanBuffer(&sim->transfer_buf[1]);
+        DestroyVulkanBuffer(&sim->transfer_buf);
         DestroyVulkanBuffer(&sim->storage[0]);
         DestroyVulkanBuffer(&sim->storage[1]);
         DestroyVulkanBuffer(&sim->uniform);
@@ -246,116 +311,308 @@ void DestroySimPipeline(SimPipeline *sim) {
     }
 }
 
-void GetSimulationData(const SimPipeline *sim, Particle *ps) {
-    CopyFromVulkanBuffer(&sim->transfer_buf[1], ps);
+void GetSimulationData(SimPipeline *sim, Particle *ps) {
+    WaitSimUpdate(sim, sim->submitted);
+
+    uint64_t start = NowNs();
+    CopyFromVulkanBuffer(&sim->transfer_buf, ps);
+    uint64_t end = NowNs();
+
+    ADD_PHASE(&sim->readback, end - start);
+    TraceSpan("readback", start, end);
 }
 
 void SetSimulationData(SimPipeline *sim, const Particle *ps) {
-    CopyIntoVulkanBuffer(&sim->transfer_buf[1], ps);
+    WaitSimUpdate(sim, sim->submitted);
+
+    uint64_t start = NowNs();
+    CopyIntoVulkanBuffer(&sim->transfer_buf, ps);
+    uint64_t end = NowNs();
+
+    ADD_PHASE(&sim->upload, end - start);
+    TraceSpan("upload", start, end);
+
     sim->transfer_buf_synced = false;
 }
 
-void PerformSimUpdate(SimPipeline *sim, uint32_t n, float dt) {
-    ASSERT_DBG(n > 0, "Performing 0 GPU simulation updates is not allowed");
+void GetSimStats(SimPipeline *sim, WorldStats *stats) {
+    PollSimUpdate(sim, sim->submitted);    // collect timestamps of updates that are already complete
+    stats->upload = sim->upload;
+    stats->gpu_dispatch = sim->dispatch;
+    stats->readback = sim->readback;
+}
+
+/* Mark the oldest pending update as complete after its fence was signaled, and make its resources reusable. */
+static void RetireSimUpdate(SimPipeline *sim) {
+    uint32_t frame = sim->completed % SIM_FRAMES;
+    uint32_t spans = sim->frame_spans[frame];
+
+    if (sim->timestamps != VK_NULL_HANDLE && spans > 0) {
+        ASSERT_VK(vkGetQueryPoolResults(vulkan_ctx.dev, sim->timestamps, 2 * frame * sim->span_cap, 2 * spans,
+                                        2 * spans * sizeof(uint64_t), sim->ticks,
+                                        sizeof(uint64_t), VK_QUERY_RESULT_64_BIT),
+                  "Failed to get timestamp query results");
+
+        // from the start of the first dispatch to the end of the last one, barriers between them included
+        if (sim->frame_steps[frame] > 0) {
+            uint64_t first = sim->ticks[2 * sim->first_dispatch[frame]];
+            uint64_t last = sim->ticks[2 * sim->last_dispatch[frame] + 1];
+            sim->dispatch.count += sim->frame_steps[frame];
+            sim->dispatch.ns += (uint64_t)((double)(last - first) * vulkan_ctx.timestamp_period);
+        }
+
+        if (TraceEnabled()) {
+            const char **names = sim->span_names + (size_t)frame * sim->span_cap;
+            for (uint32_t k = 0; k < spans; k++) {
+                TraceGpuSpan(names[k], TimestampToNs(sim->ticks[2 * k]), TimestampToNs(sim->ticks[2 * k + 1]));
+            }
+        }
+    }
+    ASSERT_VK(vkResetFences(vulkan_ctx.dev, 1, &sim->fence[frame]), "Failed to reset fence");
+    ASSERT_VK(vkResetCommandBuffer(sim->cmd[frame], 0), "Failed to reset command buffer");
+    sim->completed++;
+}
+
+/*
+ * Make room for SPANS timestamp pairs per frame. The query pool is created by the first update and
+ * recreated when a longer schedule comes, once every pending update is complete.
+ */
+static void ReserveTimestamps(SimPipeline *sim, uint32_t spans) {
+    if (vulkan_ctx.timestamp_period <= 0 || spans <= sim->span_cap) return;
+
+    WaitSimUpdate(sim, sim->submitted);
+    if (sim->timestamps != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(vulkan_ctx.dev, sim->timestamps, NULL);
+    }
+    free(sim->span_names);
+    free(sim->ticks);
+
+    sim->span_cap = spans;
+    sim->span_names = ALLOC((size_t)SIM_FRAMES * spans, const char *);
+    sim->ticks = ALLOC((size_t)2 * spans, uint64_t);
+    ASSERT(sim->span_names != NULL && sim->ticks != NULL, "Failed to alloc %u GPU timestamp pairs", spans);
+
+    VkQueryPoolCreateInfo query_pool_info = {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType = VK_QUERY_TYPE_TIMESTAMP,
+            .queryCount = 2 * SIM_FRAMES * spans,
+    };
+    ASSERT_VK(vkCreateQueryPool(vulkan_ctx.dev, &query_pool_info, NULL, &sim->timestamps),
+              "Failed to create timestamp query pool");
+}
+
+/*
+ * Write the timestamp that starts span NAME of FRAME into CMD, and return the span to pass to EndGpuSpan.
+ * Does nothing if timestamps are not supported.
+ */
+static uint32_t BeginGpuSpan(SimPipeline *sim, VkCommandBuffer cmd, uint32_t frame, const char *name) {
+    uint32_t span = sim->frame_spans[frame];
+    if (sim->timestamps == VK_NULL_HANDLE) return span;
+
+    ASSERT_DBG(span < sim->span_cap, "GPU span %u of frame %u is out of %u", span, frame, sim->span_cap);
+    sim->span_names[(size_t)frame * sim->span_cap + span] = name;
+    sim->frame_spans[frame]++;
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, sim->timestamps, 2 * (frame * sim->span_cap + span));
+    return span;
+}
+
+/* Write the timestamp that ends SPAN of FRAME into CMD, once every command before it is complete. */
+static void EndGpuSpan(SimPipeline *sim, VkCommandBuffer cmd, uint32_t frame, uint32_t span) {
+    if (sim->timestamps == VK_NULL_HANDLE) return;
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, sim->timestamps,
+                        2 * (frame * sim->span_cap + span) + 1);
+}
+
+uint64_t SubmitSimUpdate(SimPipeline *sim, const Schedule *schedule, float dt) {
+    uint32_t n = ScheduleLength(schedule);
+
+    // a dispatch and a barrier per stage but the first, and at most 7 other commands around them
+    ReserveTimestamps(sim, 2 * n + 6);
+
+    // wait for the oldest update if every command buffer is in use
+    if (sim->submitted - sim->completed == SIM_FRAMES) {
+        WaitSimUpdate(sim, sim->completed + 1);
+    }
+    uint32_t frame = sim->submitted % SIM_FRAMES;
+    VkCommandBuffer cmd = sim->cmd[frame];
+    VkFence fence = sim->fence[frame];
+    sim->frame_steps[frame] = n;
+    sim->frame_spans[frame] = 0;
 
     // start recording command buffer
     VkCommandBufferBeginInfo begin_info = {
             .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
             .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
     };
-    ASSERT_VK(vkBeginCommandBuffer(sim->cmd, &begin_info), "Failed to begin pipeline command buffer");
+    ASSERT_VK(vkBeginCommandBuffer(cmd, &begin_info), "Failed to begin pipeline command buffer");
+
+    if (sim->timestamps != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(cmd, sim->timestamps, 2 * frame * sim->span_cap, 2 * sim->span_cap);
+    }
+
+    // previously submitted updates may still be running and use the same buffers
+    if (sim->submitted != sim->completed) {
+        VkMemoryBarrier pending_barrier = {
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                .srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT,
+        };
+        VkPipelineStageFlags stages = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
 
-    // update uniform buffer if dt has changed
+        uint32_t span = BeginGpuSpan(sim, cmd, frame, "wait pending");
+        vkCmdPipelineBarrier(cmd, stages, stages,
+                             0,
+                             1, &pending_barrier,
+                             0, NULL,
+                             0, NULL);
+        EndGpuSpan(sim, cmd, frame, span);
+    }
+
+    // update uniform buffer if dt has changed; data is stored in the command buffer,
+    // so that it does not change under updates that are still pending
     if (sim->world_data.dt != dt) {
         sim->world_data.dt = dt;
+        uint32_t span = BeginGpuSpan(sim, cmd, frame, "update uniform");
+        vkCmdUpdateBuffer(cmd, sim->uniform.handle, 0, sizeof(WorldData), &sim->world_data);
+        EndGpuSpan(sim, cmd, frame, span);
 
-        CopyIntoVulkanBuffer(&sim->transfer_buf[0], &sim->world_data);
-        CopyVulkanBuffer(sim->cmd, &sim->transfer_buf[0], &sim->uniform);
-
-        // pipeline should wait until copy command is finished
-        VkBufferMemoryBarrier uniform_copy_barrier;
-        FillWriteReadBufferBarrier(&sim->uniform, &uniform_copy_barrier);
+        // pipeline should wait until update command is finished
+        VkBufferMemoryBarrier uniform_update_barrier;
+        FillWriteReadBufferBarrier(&sim->uniform, &uniform_update_barrier);
 
-        vkCmdPipelineBarrier(sim->cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        span = BeginGpuSpan(sim, cmd, frame, "uniform barrier");
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
                              VK_DEPENDENCY_BY_REGION_BIT,
                              0, NULL,
-                             1, &uniform_copy_barrier,
+                             1, &uniform_update_barrier,
                              0, NULL);
+        EndGpuSpan(sim, cmd, frame, span);
     }
 
-    // copy latest data into storage[0]
-    if (sim->transfer_buf_synced) {
-        // transfer_buf[1] is identical to storage[1]
-        CopyVulkanBuffer(sim->cmd, &sim->storage[1], &sim->storage[0]);
-    } else {
-        // transfer_buf[1] was modified externally
-        CopyVulkanBuffer(sim->cmd, &sim->transfer_buf[1], &sim->storage[0]);
-    }
+    // copy data that was set externally into the current storage buffer
+    if (!sim->transfer_buf_synced) {
+        uint32_t span = BeginGpuSpan(sim, cmd, frame, "copy to GPU");
+        CopyVulkanBuffer(cmd, &sim->transfer_buf, &sim->storage[sim->cur]);
+        EndGpuSpan(sim, cmd, frame, span);
 
-    // wait for pipeline to finish before copying storage[1] into storage[0]
-    VkBufferMemoryBarrier pipeline_barrier;
-    FillWriteReadBufferBarrier(&sim->storage[1], &pipeline_barrier);
+        // wait for copy command to finish before running pipeline
+        VkBufferMemoryBarrier transfer_barrier;
+        FillWriteReadBufferBarrier(&sim->storage[sim->cur], &transfer_barrier);
 
-    // wait for copy command to finish before running pipeline
-    VkBufferMemoryBarrier transfer_barrier;
-    FillWriteReadBufferBarrier(&sim->storage[0], &transfer_barrier);
+        span = BeginGpuSpan(sim, cmd, frame, "copy barrier");
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_DEPENDENCY_BY_REGION_BIT,
+                             0, NULL,
+                             1, &transfer_barrier,
+                             0, NULL);
+        EndGpuSpan(sim, cmd, frame, span);
+    }
 
-    // bind pipeline and descriptor set
     uint32_t group_count = sim->world_data.total_len / LOCAL_SIZE_X;
     if (sim->world_data.total_len % LOCAL_SIZE_X != 0) group_count++;
 
-    vkCmdBindPipeline(sim->cmd, VK_PIPELINE_BIND_POINT_COMPUTE, sim->pipeline);
-    vkCmdBindDescriptorSets(sim->cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
-                            sim->pipeline_layout, 0,
-                            1, &sim->set,
-                            0, 0);
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, sim->pipeline);
 
-    // run simulation N times
+    // run every stage, swapping old and new buffers every time
     for (uint32_t i = 0; i < n; i++) {
-        // first dispatch already has new data in storage[0]
         if (i != 0) {
-            // wait for pipeline to finish and copy new data from storage[1] to storage[0]
-            vkCmdPipelineBarrier(sim->cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            // wait for previous dispatch to finish writing into what is now the old buffer;
+            // execution dependency also keeps this dispatch from overwriting what previous one reads
+            VkBufferMemoryBarrier pipeline_barrier;
+            FillWriteReadBufferBarrier(&sim->storage[sim->cur], &pipeline_barrier);
+
+            uint32_t span = BeginGpuSpan(sim, cmd, frame, "stage barrier");
+            vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
                                  VK_DEPENDENCY_BY_REGION_BIT,
                                  0, NULL,
                                  1, &pipeline_barrier,
                                  0, NULL);
-            CopyVulkanBuffer(sim->cmd, &sim->storage[1], &sim->storage[0]);
+            EndGpuSpan(sim, cmd, frame, span);
         }
 
-        // wait for transfer to finish and run pipeline
-        vkCmdPipelineBarrier(sim->cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-                             VK_DEPENDENCY_BY_REGION_BIT,
-                             0, NULL,
-                             1, &transfer_barrier,
-                             0, NULL);
-        vkCmdDispatch(sim->cmd, group_count, 1, 1);
+        Stage stage = GetStage(schedule, i);
+        StageData stage_data = {
+                .kick = stage.kick,
+                .drift = stage.drift,
+                .accel = stage.accel,
+        };
+        vkCmdPushConstants(cmd, sim->pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT,
+                           0, sizeof(StageData), &stage_data);
+
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                sim->pipeline_layout, 0,
+                                1, &sim->set[sim->cur],
+                                0, 0);
+        uint32_t span = BeginGpuSpan(sim, cmd, frame, "dispatch");
+        vkCmdDispatch(cmd, group_count, 1, 1);
+        EndGpuSpan(sim, cmd, frame, span);
+
+        if (i == 0) sim->first_dispatch[frame] = span;
+        sim->last_dispatch[frame] = span;
+
+        // the buffer just written is now the latest
+        sim->cur = 1 - sim->cur;
     }
 
-    // wait for pipeline to finish and copy new data from storage[1] to transfer_buf[1]
-    vkCmdPipelineBarrier(sim->cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+    // wait for pipeline to finish and copy the latest data into transfer_buf
+    VkBufferMemoryBarrier pipeline_barrier;
+    FillWriteReadBufferBarrier(&sim->storage[sim->cur], &pipeline_barrier);
+
+    uint32_t span = BeginGpuSpan(sim, cmd, frame, "readback barrier");
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
                          VK_DEPENDENCY_BY_REGION_BIT,
                          0, NULL,
                          1, &pipeline_barrier,
                          0, NULL);
-    CopyVulkanBuffer(sim->cmd, &sim->storage[1], &sim->transfer_buf[1]);
+    EndGpuSpan(sim, cmd, frame, span);
+
+    span = BeginGpuSpan(sim, cmd, frame, "copy from GPU");
+    CopyVulkanBuffer(cmd, &sim->storage[sim->cur], &sim->transfer_buf);
+    EndGpuSpan(sim, cmd, frame, span);
 
     // finish recording command buffer
-    ASSERT_VK(vkEndCommandBuffer(sim->cmd), "Failed to end pipeline command buffer");
+    ASSERT_VK(vkEndCommandBuffer(cmd), "Failed to end pipeline command buffer");
 
     // submit command buffer
     VkSubmitInfo submit_info = {
             .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
             .commandBufferCount = 1,
-            .pCommandBuffers = &sim->cmd,
+            .pCommandBuffers = &cmd,
     };
-    ASSERT_VK(vkQueueSubmit(vulkan_ctx.queue, 1, &submit_info, sim->fence), "Failed to submit command buffer");
-    ASSERT_VK(vkWaitForFences(vulkan_ctx.dev, 1, &sim->fence, VK_TRUE, UINT64_MAX), "Failed to wait for fences");
-
-    // reset fence and command buffer
-    ASSERT_VK(vkResetFences(vulkan_ctx.dev, 1, &sim->fence), "Failed to reset fence");
-    ASSERT_VK(vkResetCommandBuffer(sim->cmd, 0), "Failed to reset command buffer");
+    uint64_t submit_start = NowNs();
+    ASSERT_VK(vkQueueSubmit(vulkan_ctx.queue, 1, &submit_info, fence), "Failed to submit command buffer");
+    TraceSpan("submit GPU", submit_start, NowNs());
 
-    // storage[1] was copied to transfer_buf[1]
+    // storage[cur] will be copied to transfer_buf
     sim->transfer_buf_synced = true;
+    return ++sim->submitted;
+}
+
+void WaitSimUpdate(SimPipeline *sim, uint64_t ticket) {
+    ASSERT_DBG(ticket <= sim->submitted, "Waiting for GPU update %llu that was not submitted",
+               (unsigned long long)ticket);
+
+    while (sim->completed < ticket) {
+        VkFence *fence = &sim->fence[sim->completed % SIM_FRAMES];
+        uint64_t start = NowNs();
+        ASSERT_VK(vkWaitForFences(vulkan_ctx.dev, 1, fence, VK_TRUE, UINT64_MAX), "Failed to wait for fences");
+        TraceSpan("wait GPU", start, NowNs());
+
+        RetireSimUpdate(sim);
+    }
+}
+
+bool PollSimUpdate(SimPipeline *sim, uint64_t ticket) {
+    while (sim->completed < ticket) {
+        VkResult status = vkGetFenceStatus(vulkan_ctx.dev, sim->fence[sim->completed % SIM_FRAMES]);
+        if (status == VK_NOT_READY) return false;
+
+        ASSERT_VK(status, "Failed to get fence status");
+        RetireSimUpdate(sim);
+    }
+    return true;
+}
+
+void PerformSimUpdate(SimPipeline *sim, const Schedule *schedule, float dt) {
+    WaitSimUpdate(sim, SubmitSimUpdate(sim, schedule, dt));
 }
@@ -3,6 +3,9 @@
 
 #include <nbody.h>
 #include <stdint.h>
+#include <stdbool.h>
+
+#include "integrator.h"
 
 /* Constant data given to shaders in a uniform buffer. */
 typedef struct WorldData {
@@ -15,24 +18,40 @@ typedef struct WorldData {
 typedef struct SimPipeline SimPipeline;
 
 /*
- * Setup simulation pipeline.
+ * Setup simulation pipeline that uses KERNEL compute shader.
  * Only `dt` field of DATA can be changed later.
  */
-SimPipeline *CreateSimPipeline(WorldData data);
+SimPipeline *CreateSimPipeline(WorldData data, GpuKernel kernel);
 
 /* Destroy simulation pipeline. */
 void DestroySimPipeline(SimPipeline *sim);
 
-/* Copy particle data from GPU buffer into PS. */
-void GetSimulationData(const SimPipeline *sim, Particle *ps);
+/* Copy particle data from GPU buffer into PS. Waits for all submitted updates to complete. */
+void GetSimulationData(SimPipeline *sim, Particle *ps);
 
-/* Copy particle data from PS into GPU buffer. */
+/* Copy particle data from PS into GPU buffer. Waits for all submitted updates to complete. */
 void SetSimulationData(SimPipeline *sim, const Particle *ps);
 
 /*
- * Perform N > 0 updates with time step.
+ * Submit updates of SCHEDULE with time step and return without waiting for them to complete.
+ * Every stage is one dispatch. Returns a ticket that is greater than tickets of all previous submissions.
+ * Simulation data MUST have been set prior to calling this function.
+ */
+uint64_t SubmitSimUpdate(SimPipeline *sim, const Schedule *schedule, float dt);
+
+/* Wait until updates with TICKET and all previous tickets are complete. */
+void WaitSimUpdate(SimPipeline *sim, uint64_t ticket);
+
+/* Whether updates with TICKET and all previous tickets are complete; does not block. */
+bool PollSimUpdate(SimPipeline *sim, uint64_t ticket);
+
+/* Fill upload, gpu_dispatch and readback fields of STATS. */
+void GetSimStats(SimPipeline *sim, WorldStats *stats);
+
+/*
+ * Perform updates of SCHEDULE with time step and wait for them to complete.
  * Simulation data MUST have been set prior to calling this function.
  */
-void PerformSimUpdate(SimPipeline *sim, uint32_t n, float dt);
+void PerformSimUpdate(SimPipeline *sim, const Schedule *schedule, float dt);
 
 #endif //NB_WORLD_VK_H
@@ -0,0 +1,125 @@
+#include "trace.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Maximum number of recorded events; later events are dropped. */
+#define TRACE_MAX_EVENTS    (1u << 22)
+
+/* Track of GPU spans. */
+#define GPU_TID     -1
+
+typedef struct TraceEvent {
+    const char *name;
+    uint64_t start, end;    // nanoseconds of NowNs clock
+    int tid;                // pool worker number, or GPU_TID
+} TraceEvent;
+
+static struct Trace {
+    const char *path;       // output file; NULL if tracing is disabled
+    uint64_t origin;        // NowNs when tracing started
+    TraceEvent *events;
+    uint32_t len, cap;
+    uint32_t dropped;       // number of events that did not fit
+    int max_tid;            // the greatest thread number seen
+} trace = {0};
+
+/* Write all events into the output file. */
+static void WriteTrace(void) {
+    FILE *f = fopen(trace.path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "Failed to open trace file %s\n", trace.path);
+        return;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"CPU\"}},\n");
+    fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 2, \"args\": {\"name\": \"GPU\"}}");
+    for (int tid = 0; tid <= trace.max_tid; tid++) {
+        fprintf(f, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                   "\"args\": {\"name\": \"thread %d\"}}", tid, tid);
+    }
+
+    for (uint32_t i = 0; i < trace.len; i++) {
+        const TraceEvent *e = &trace.events[i];
+        bool gpu = e->tid == GPU_TID;
+
+        // timestamps are microseconds relative to the start of tracing
+        double ts = (double)(int64_t)(e->start - trace.origin) / 1000.0;
+        double dur = (double)(e->end - e->start) / 1000.0;
+
+        fprintf(f, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, "
+                   "\"pid\": %d, \"tid\": %d}",
+                e->name, gpu ? "gpu" : "cpu", ts, dur, gpu ? 2 : 1, gpu ? 0 : e->tid);
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+
+    if (trace.dropped > 0) {
+        fprintf(stderr, "Trace is incomplete: %u events were dropped\n", trace.dropped);
+    }
+    fprintf(stderr, "Trace of %u events written to %s\n", trace.len, trace.path);
+    free(trace.events);
+}
+
+bool TraceEnabled(void) {
+    static bool initialized = false;
+    if (!initialized) {
+        initialized = true;
+
+        const char *env = getenv("NB_TRACE");
+        if (env != NULL && env[0] != '\0') {
+            trace.path = env;
+            trace.origin = NowNs();
+            atexit(WriteTrace);
+        }
+    }
+    return trace.path != NULL;
+}
+
+/*
+ * Append event; must be called only when tracing is enabled. Spans of pool workers are recorded by the thread
+ * that runs the loop, so events are never added by two threads at once.
+ */
+static void AddEvent(TraceEvent event) {
+    if (trace.len == trace.cap && trace.cap < TRACE_MAX_EVENTS) {
+        uint32_t cap = trace.cap == 0 ? 4096 : 2 * trace.cap;
+        TraceEvent *events = realloc(trace.events, cap * sizeof(TraceEvent));
+        ASSERT(events != NULL, "Failed to realloc %u trace events", cap);
+
+        trace.events = events;
+        trace.cap = cap;
+    }
+    if (trace.len < trace.cap) {
+        trace.events[trace.len++] = event;
+        if (event.tid > trace.max_tid) trace.max_tid = event.tid;
+    } else {
+        trace.dropped++;
+    }
+}
+
+void TraceSpan(const char *name, uint64_t start, uint64_t end) {
+    // the calling thread runs loops of the pool as worker 0
+    TraceWorkerSpan(name, 0, start, end);
+}
+
+void TraceWorkerSpan(const char *name, int tid, uint64_t start, uint64_t end) {
+    if (!TraceEnabled()) return;
+    AddEvent((TraceEvent){.name = name, .start = start, .end = end, .tid = tid});
+}
+
+void TraceGpuSpan(const char *name, uint64_t start, uint64_t end) {
+    if (!TraceEnabled()) return;
+    AddEvent((TraceEvent){.name = name, .start = start, .end = end, .tid = GPU_TID});
+}
+
+uint64_t BeginTraceSpan(void) {
+    return TraceEnabled() ? NowNs() : 0;
+}
+
+void EndTraceSpan(const char *name, uint64_t begin) {
+    if (TraceEnabled()) {
+        TraceSpan(name, begin, NowNs());
+    }
+}
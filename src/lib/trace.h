@@ -0,0 +1,27 @@
+#ifndef NB_TRACE_H
+#define NB_TRACE_H
+
+#include <nbody.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Tracer that writes Chrome trace event JSON (chrome://tracing, ui.perfetto.dev).
+ * It is enabled by setting NB_TRACE environment variable to the output file path; the file is written at exit.
+ * CPU spans are recorded per thread pool worker, GPU spans come from timestamp queries and go to a separate track.
+ * Public BeginTraceSpan and EndTraceSpan are declared in nbody.h.
+ */
+
+/* Whether NB_TRACE is set. */
+bool TraceEnabled(void);
+
+/* Record CPU span NAME of the calling thread from START to END nanoseconds of NowNs clock. NAME must be static. */
+void TraceSpan(const char *name, uint64_t start, uint64_t end);
+
+/* The same as TraceSpan, but for thread TID of CPU simulation; the calling thread need not be that one. */
+void TraceWorkerSpan(const char *name, int tid, uint64_t start, uint64_t end);
+
+/* Record GPU span NAME from START to END nanoseconds, already converted to NowNs clock. NAME must be static. */
+void TraceGpuSpan(const char *name, uint64_t start, uint64_t end);
+
+#endif //NB_TRACE_H
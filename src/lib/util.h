@@ -5,6 +5,8 @@
 #include <stdio.h>                      // fprintf, stderr
 #include <errno.h>                      // errno
 #include <string.h>                     // strerror_r, strerror_s
+#include <stdint.h>                     // uint64_t
+#include <time.h>                       // clock_gettime, timespec_get
 
 #ifdef _WIN32
 #   define strerror_r(num, buf, len)    strerror_s(buf, len, num)
@@ -34,6 +36,20 @@
 #   define ASSERT_DBG(COND, ...)   (void)(COND)
 #endif
 
+/* Current time in nanoseconds, from monotonic clock if there is one. Only differences are meaningful. */
+static inline uint64_t NowNs(void) {
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* Add a single run of NS nanoseconds to STATS. */
+#define ADD_PHASE(STATS, NS)    ((STATS)->count++, (STATS)->ns += (NS))
+
 #endif //NB_UTIL_H
 
 #ifdef VULKAN_H_
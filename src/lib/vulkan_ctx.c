@@ -10,6 +10,14 @@
 /* The one and only Vulkan context. */
 struct VulkanContext vulkan_ctx = {0};
 
+/* Host clock that VK_EXT_calibrated_timestamps can read at the same time as the device one, if it is NowNs clock. */
+#if defined(VK_EXT_calibrated_timestamps) && defined(CLOCK_MONOTONIC) && !defined(_WIN32)
+#   define HOST_TIME_DOMAIN     VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT
+#endif
+
+static bool props2_enabled = false;         // whether VK_KHR_get_physical_device_properties2 is enabled
+static bool calibration_enabled = false;    // whether VK_EXT_calibrated_timestamps is enabled
+
 #ifndef NDEBUG
 static const char *DBG_LAYERS[] = {"VK_LAYER_KHRONOS_validation"};
 static const int DBG_LAYERS_COUNT = sizeof(DBG_LAYERS) / sizeof(DBG_LAYERS[0]);
@@ -46,6 +54,27 @@ static void AssertDebugLayersSupported() {
 
 #endif //NDEBUG
 
+#ifdef HOST_TIME_DOMAIN
+/* Whether instance extension NAME is supported. */
+static bool InstanceExtensionSupported(const char *name) {
+    uint32_t count;
+    ASSERT_VK(vkEnumerateInstanceExtensionProperties(NULL, &count, NULL), "Failed to enumerate instance extensions");
+    if (count == 0) return false;
+
+    VkExtensionProperties *properties = ALLOC(count, VkExtensionProperties);
+    ASSERT(properties != NULL, "Failed to alloc %u VkExtensionProperties", count);
+    ASSERT_VK(vkEnumerateInstanceExtensionProperties(NULL, &count, properties),
+              "Failed to enumerate instance extensions");
+
+    bool found = false;
+    for (uint32_t i = 0; i < count && !found; i++) {
+        found = strncmp(properties[i].extensionName, name, VK_MAX_EXTENSION_NAME_SIZE) == 0;
+    }
+    free(properties);
+    return found;
+}
+#endif
+
 static void InitInstance(VkInstance *instance) {
     VkApplicationInfo app_info = {
             .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
@@ -57,12 +86,22 @@ static void InitInstance(VkInstance *instance) {
             .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
             .pApplicationInfo = &app_info,
     };
+    const char *extensions[2];
+    uint32_t extension_count = 0;
 #ifdef __APPLE__
-    const char *port_ext = "VK_KHR_portability_enumeration";
-    instance_create_info.flags = VK_INSTANCE_CREATE_ENUMERATE_PORTABILITY_BIT_KHR,
-    instance_create_info.enabledExtensionCount = 1,
-    instance_create_info.ppEnabledExtensionNames = &port_ext,
+    extensions[extension_count++] = "VK_KHR_portability_enumeration";
+    instance_create_info.flags = VK_INSTANCE_CREATE_ENUMERATE_PORTABILITY_BIT_KHR;
 #endif
+#ifdef HOST_TIME_DOMAIN
+    // VK_EXT_calibrated_timestamps needs it on Vulkan 1.0
+    const char *props2_ext = "VK_KHR_get_physical_device_properties2";
+    if (InstanceExtensionSupported(props2_ext)) {
+        extensions[extension_count++] = props2_ext;
+        props2_enabled = true;
+    }
+#endif
+    instance_create_info.enabledExtensionCount = extension_count;
+    instance_create_info.ppEnabledExtensionNames = extensions;
 #ifndef NDEBUG
     AssertDebugLayersSupported();
     instance_create_info.enabledLayerCount = 1;
@@ -86,7 +125,8 @@ static void InitPDev(VkPhysicalDevice *pdev, VkInstance instance) {
 
     VkPhysicalDeviceProperties props;
     vkGetPhysicalDeviceProperties(*pdev, &props);
-    printf("Using VkPhysicalDevice #%u of type %u -- %s\n", props.deviceID, props.deviceType, props.deviceName);
+    fprintf(stderr, "Using VkPhysicalDevice #%u of type %u -- %s\n",
+            props.deviceID, props.deviceType, props.deviceName);
 }
 
 /*
@@ -123,7 +163,7 @@ static uint32_t SortDeviceExtensionsBySupported(const char **extensions, uint32_
     return supported_count;
 }
 
-static void InitDev(VkDevice *dev, uint32_t *queue_family_idx, VkPhysicalDevice pdev) {
+static void InitDev(VkDevice *dev, uint32_t *queue_family_idx, uint32_t *timestamp_bits, VkPhysicalDevice pdev) {
     uint32_t family_count;
     vkGetPhysicalDeviceQueueFamilyProperties(pdev, &family_count, NULL);
     ASSERT(family_count > 0, "Queue family count is 0");
@@ -133,18 +173,18 @@ static void InitDev(VkDevice *dev, uint32_t *queue_family_idx, VkPhysicalDevice
     vkGetPhysicalDeviceQueueFamilyProperties(pdev, &family_count, family_props);
 
     uint32_t qf_idx = UINT32_MAX;
-    printf("Selecting queue family:\n");
+    fprintf(stderr, "Selecting queue family:\n");
 
     for (uint32_t i = 0; i < family_count; i++) {
         bool g = family_props[i].queueFlags & VK_QUEUE_GRAPHICS_BIT;
         bool c = family_props[i].queueFlags & VK_QUEUE_COMPUTE_BIT;
         bool t = family_props[i].queueFlags & VK_QUEUE_TRANSFER_BIT;
 
-        printf("\t#%u: count = %u, flags =", i, family_props[i].queueCount);
-        if (g) printf(" graphics");
-        if (c) printf(" compute");
-        if (t) printf(" transfer");
-        printf("\n");
+        fprintf(stderr, "\t#%u: count = %u, flags =", i, family_props[i].queueCount);
+        if (g) fprintf(stderr, " graphics");
+        if (c) fprintf(stderr, " compute");
+        if (t) fprintf(stderr, " transfer");
+        fprintf(stderr, "\n");
 
         // prefer compute only
         if (c && t && (!g || qf_idx == UINT32_MAX)) {
@@ -152,9 +192,10 @@ static void InitDev(VkDevice *dev, uint32_t *queue_family_idx, VkPhysicalDevice
         }
     }
     ASSERT(qf_idx != UINT32_MAX, "Could not find suitable queue family");
+    *timestamp_bits = family_props[qf_idx].timestampValidBits;
     free(family_props);
 
-    printf("Using queue family #%u\n", qf_idx);
+    fprintf(stderr, "Using queue family #%u\n", qf_idx);
     *queue_family_idx = qf_idx;
 
     const float queue_priority = 1.f;
@@ -170,12 +211,23 @@ static void InitDev(VkDevice *dev, uint32_t *queue_family_idx, VkPhysicalDevice
             .pQueueCreateInfos = &queue_create_info,
     };
 
+    const char *extensions[2];
+    uint32_t extension_count = 0;
+
     // per Vulkan spec, VK_KHR_portability_subset must be enabled if supported
     const char *portability_extension = "VK_KHR_portability_subset";
     if (1 == SortDeviceExtensionsBySupported(&portability_extension, 1, pdev)) {
-        device_create_info.enabledExtensionCount = 1;
-        device_create_info.ppEnabledExtensionNames = &portability_extension;
+        extensions[extension_count++] = portability_extension;
     }
+
+    // correlates timestamps with the host clock; without it, CalibrateTimestamps samples them
+    const char *calibration_extension = "VK_EXT_calibrated_timestamps";
+    if (props2_enabled && 1 == SortDeviceExtensionsBySupported(&calibration_extension, 1, pdev)) {
+        extensions[extension_count++] = calibration_extension;
+        calibration_enabled = true;
+    }
+    device_create_info.enabledExtensionCount = extension_count;
+    device_create_info.ppEnabledExtensionNames = extensions;
 #ifndef NDEBUG
     AssertDebugLayersSupported();
     device_create_info.enabledLayerCount = 1;
@@ -184,6 +236,118 @@ static void InitDev(VkDevice *dev, uint32_t *queue_family_idx, VkPhysicalDevice
     ASSERT_VK(vkCreateDevice(pdev, &device_create_info, NULL, dev), "Failed to create device");
 }
 
+#ifdef HOST_TIME_DOMAIN
+/* Read device and host clocks at the same time and set the offset between them; returns false if not possible. */
+static bool ReadCalibratedTimestamps(void) {
+    if (!calibration_enabled) return false;
+
+    PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT get_domains =
+            (PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT)vkGetInstanceProcAddr(
+                    vulkan_ctx.instance, "vkGetPhysicalDeviceCalibrateableTimeDomainsEXT");
+    PFN_vkGetCalibratedTimestampsEXT get_timestamps =
+            (PFN_vkGetCalibratedTimestampsEXT)vkGetDeviceProcAddr(vulkan_ctx.dev, "vkGetCalibratedTimestampsEXT");
+    if (get_domains == NULL || get_timestamps == NULL) return false;
+
+    uint32_t count;
+    ASSERT_VK(get_domains(vulkan_ctx.pdev, &count, NULL), "Failed to get calibrateable time domains");
+    if (count == 0) return false;
+
+    VkTimeDomainEXT *domains = ALLOC(count, VkTimeDomainEXT);
+    ASSERT(domains != NULL, "Failed to alloc %u VkTimeDomainEXT", count);
+    ASSERT_VK(get_domains(vulkan_ctx.pdev, &count, domains), "Failed to get calibrateable time domains");
+
+    bool device = false, host = false;
+    for (uint32_t i = 0; i < count; i++) {
+        if (domains[i] == VK_TIME_DOMAIN_DEVICE_EXT) device = true;
+        if (domains[i] == HOST_TIME_DOMAIN) host = true;
+    }
+    free(domains);
+    if (!device || !host) return false;
+
+    VkCalibratedTimestampInfoEXT infos[2] = {
+            {.sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT, .timeDomain = VK_TIME_DOMAIN_DEVICE_EXT},
+            {.sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT, .timeDomain = HOST_TIME_DOMAIN},
+    };
+    uint64_t values[2], deviation;
+    ASSERT_VK(get_timestamps(vulkan_ctx.dev, 2, infos, values, &deviation), "Failed to get calibrated timestamps");
+
+    // host value is in nanoseconds of the same clock as NowNs
+    vulkan_ctx.timestamp_offset = (double)values[1] - (double)values[0] * vulkan_ctx.timestamp_period;
+    return true;
+}
+#endif
+
+/* Number of timestamps CalibrateTimestamps samples when it cannot read both clocks at once. */
+#define CALIBRATION_SAMPLES 5
+
+/*
+ * Set the offset between timestamps of the queue and NowNs clock. Without VK_EXT_calibrated_timestamps,
+ * a timestamp is written by a command buffer that is waited for; it is placed halfway between submission
+ * and completion, and the sample that took the least time is kept.
+ */
+static void CalibrateTimestamps(void) {
+#ifdef HOST_TIME_DOMAIN
+    if (ReadCalibratedTimestamps()) return;
+#endif
+    VkDevice dev = vulkan_ctx.dev;
+
+    VkQueryPool pool;
+    VkQueryPoolCreateInfo pool_info = {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType = VK_QUERY_TYPE_TIMESTAMP,
+            .queryCount = 1,
+    };
+    ASSERT_VK(vkCreateQueryPool(dev, &pool_info, NULL, &pool), "Failed to create timestamp query pool");
+
+    VkCommandBuffer cmd;
+    AllocCommandBuffers(1, &cmd);
+
+    VkFence fence;
+    VkFenceCreateInfo fence_info = {
+            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+    };
+    ASSERT_VK(vkCreateFence(dev, &fence_info, NULL, &fence), "Failed to create fence");
+
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < CALIBRATION_SAMPLES; i++) {
+        VkCommandBufferBeginInfo begin_info = {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        };
+        ASSERT_VK(vkBeginCommandBuffer(cmd, &begin_info), "Failed to begin calibration command buffer");
+        vkCmdResetQueryPool(cmd, pool, 0, 1);
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, pool, 0);
+        ASSERT_VK(vkEndCommandBuffer(cmd), "Failed to end calibration command buffer");
+
+        VkSubmitInfo submit_info = {
+                .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                .commandBufferCount = 1,
+                .pCommandBuffers = &cmd,
+        };
+        uint64_t before = NowNs();
+        ASSERT_VK(vkQueueSubmit(vulkan_ctx.queue, 1, &submit_info, fence), "Failed to submit command buffer");
+        ASSERT_VK(vkWaitForFences(dev, 1, &fence, VK_TRUE, UINT64_MAX), "Failed to wait for fences");
+        uint64_t after = NowNs();
+
+        uint64_t ticks;
+        ASSERT_VK(vkGetQueryPoolResults(dev, pool, 0, 1, sizeof(ticks), &ticks, sizeof(ticks),
+                                        VK_QUERY_RESULT_64_BIT),
+                  "Failed to get timestamp query results");
+        if (after - before < best) {
+            best = after - before;
+            vulkan_ctx.timestamp_offset = (double)(before + (after - before) / 2)
+                                          - (double)ticks * vulkan_ctx.timestamp_period;
+        }
+
+        ASSERT_VK(vkResetFences(dev, 1, &fence), "Failed to reset fence");
+        ASSERT_VK(vkResetCommandBuffer(cmd, 0), "Failed to reset command buffer");
+    }
+
+    vkDestroyFence(dev, fence, NULL);
+    vkFreeCommandBuffers(dev, vulkan_ctx.cmd_pool, 1, &cmd);
+    vkDestroyQueryPool(dev, pool, NULL);
+}
+
 void InitGlobalVulkanContext() {
     // run this function only once
     static bool done = false;
@@ -192,9 +356,15 @@ void InitGlobalVulkanContext() {
 
     InitInstance(&vulkan_ctx.instance);
     InitPDev(&vulkan_ctx.pdev, vulkan_ctx.instance);
-    InitDev(&vulkan_ctx.dev, &vulkan_ctx.queue_family_idx, vulkan_ctx.pdev);
+
+    uint32_t timestamp_bits;
+    InitDev(&vulkan_ctx.dev, &vulkan_ctx.queue_family_idx, &timestamp_bits, vulkan_ctx.pdev);
     vkGetDeviceQueue(vulkan_ctx.dev, vulkan_ctx.queue_family_idx, 0, &vulkan_ctx.queue);
 
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(vulkan_ctx.pdev, &props);
+    vulkan_ctx.timestamp_period = timestamp_bits > 0 ? props.limits.timestampPeriod : 0;
+
     VkCommandPoolCreateInfo pool_create_info = {
             .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
             .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
@@ -202,6 +372,10 @@ void InitGlobalVulkanContext() {
     };
     ASSERT_VK(vkCreateCommandPool(vulkan_ctx.dev, &pool_create_info, NULL, &vulkan_ctx.cmd_pool),
               "Failed to create global command pool");
+
+    if (vulkan_ctx.timestamp_period > 0) {
+        CalibrateTimestamps();
+    }
 }
 
 void AllocCommandBuffers(uint32_t count, VkCommandBuffer *buffers) {
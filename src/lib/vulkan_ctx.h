@@ -15,6 +15,8 @@ extern struct VulkanContext {
     VkQueue queue;
     VkCommandPool cmd_pool;
     uint32_t queue_family_idx;
+    float timestamp_period;     // nanoseconds per timestamp tick; 0 if the queue does not support timestamps
+    double timestamp_offset;    // NowNs time of timestamp tick 0, see TimestampToNs
 } vulkan_ctx;
 
 /*
@@ -23,6 +25,14 @@ extern struct VulkanContext {
  */
 void InitGlobalVulkanContext();
 
+/*
+ * NowNs time of timestamp TICKS written by the queue. Both clocks are correlated once, when the context is
+ * initialized, so times drift apart as slowly as the clocks do. Timestamps must be supported.
+ */
+static inline uint64_t TimestampToNs(uint64_t ticks) {
+    return (uint64_t)((double)ticks * vulkan_ctx.timestamp_period + vulkan_ctx.timestamp_offset);
+}
+
 /* Allocate primary command buffers. */
 void AllocCommandBuffers(uint32_t count, VkCommandBuffer *buffers);
 
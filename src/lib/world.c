@@ -4,30 +4,124 @@
 #include <stdbool.h>
 #include <string.h>
 
+#include "affinity.h"
+#include "fio.h"
+#include "fmm.h"
+#include "integrator.h"
+#include "morton.h"
+#include "multigrid.h"
+#include "p3m.h"
+#include "pm.h"
+#include "pool.h"
 #include "sim_cpu.h"
 #include "sim_gpu.h"
+#include "quadtree.h"
+#include "trace.h"
 #include "util.h"
 
 struct World {
+    WorldConfig cfg;    // world parameters
     Particle *arr;      // array of particles
-    SimPipeline *sim;   // simulation pipeline
-    ParticlePack *pack; // array of packed particle data
+    uint32_t *ids;      // ids[i] is the index of arr[i] in the array the world was created from
+    Snapshot snapshot;  // snapshot file that ARR and IDS are mapped from; empty unless the world was loaded
+    ParticleSoA soa;    // the same particles as SIMD-friendly structure of arrays; allocated on first CPU update
+    const CpuKernel *kernel;    // CPU kernels for the best available SIMD instruction set
+    int threads;        // number of threads of CPU simulation
+    Pool *pool;         // workers of CPU simulation; created on first CPU update
+    SimPipeline *sim;   // simulation pipeline; NULL until GPU simulation is used
+    Quadtree tree;      // Barnes-Hut tree over particles with mass
+    Fmm fmm;            // fast multipole method data over all particles
+    Pm pm;              // particle-mesh grids
+    Multigrid mg;       // multigrid hierarchy and the last potential
+    P3m p3m;            // particle-particle particle-mesh data
+    ParticleSoA tracer_pack;    // masses, radii and acceleration of tracer blocks, see ReserveHistory
+    float *history;     // positions of particles with mass at every force evaluation of a tracer block
+    size_t history_cap; // number of floats of HISTORY
+    uint8_t *level;     // time step level of every particle for block time steps; NULL until they are used
+    uint32_t *active;   // scratch list of particles whose block time step ends
+    float *pair_acc;    // acceleration accumulators of every slice of symmetric pairs; NULL if they are not used
+    uint32_t pair_stride;   // number of floats per accumulator array
+    WorldStats stats;   // CPU statistics; GPU statistics are collected by SIM
     uint32_t total_len; // total number of particles
     uint32_t mass_len;  // number of particles with mass
-    uint32_t pack_len;  // length of pack
-    bool arr_sync;      // whether latest change in ARR is synced with GPU buffer
-    bool gpu_sync;      // whether latest change in GPU buffer is synced with ARR
+    uint32_t since_reorder; // number of updates since particles were last reordered
+    bool arr_valid;     // whether ARR holds the latest particle data
+    bool soa_valid;     // whether SOA holds the latest particle data
+    bool gpu_valid;     // whether GPU buffer holds the latest particle data
+    bool acc_valid;     // whether stored acceleration was computed from the latest positions
 };
 
+/* How many particles a worker computes acceleration of at a time. */
+#define CPU_CHUNK       16
+
+/* How many particles a worker packs or integrates at a time; that is cheap per particle, so chunks are large. */
+#define STREAM_CHUNK    1024
+
+/* One-sided CPU kernel; see CpuKernel. */
+typedef void (*AccelFn)(ParticleSoA *soa, uint32_t mass_len, uint32_t from, uint32_t to);
+
 World *CreateWorld(const Particle *ps, uint32_t size) {
+    return CreateWorldEx(ps, size, NULL);
+}
+
+/*
+ * World that takes ownership of ARR and IDS of SIZE particles, the first MASS_LEN of which have mass.
+ * SNAPSHOT is the mapping they live in, or NULL if they were allocated.
+ */
+static World *AdoptWorld(Particle *arr, uint32_t *ids, uint32_t size, uint32_t mass_len, const WorldConfig *cfg,
+                         const Snapshot *snapshot) {
     World *world = ALLOC(1, World);
     ASSERT(world != NULL, "Failed to alloc World");
 
+    *world = (World){
+        .cfg = cfg != NULL ? *cfg : (WorldConfig){0},
+        .arr = arr,
+        .ids = ids,
+        .snapshot = snapshot != NULL ? *snapshot : (Snapshot){.data = NULL},
+        .kernel = GetDefaultCpuKernel(),
+        .threads = 1,
+        .pool = NULL,       // created on first CPU update
+        .sim = NULL,        // created on first GPU update
+        .level = NULL,      // allocated on first block time step update
+        .active = NULL,
+        .pair_acc = NULL,   // allocated below if needed
+        .history = NULL,    // allocated on first tracer block update
+        .history_cap = 0,
+        .total_len = size,
+        .mass_len = mass_len,
+        .since_reorder = 0,
+        .arr_valid = true,  // SOA and GPU buffer are filled when needed
+        .soa_valid = false,
+        .gpu_valid = false,
+        .acc_valid = false, // given particles may have any acceleration
+    };
+    (void)TraceEnabled();   // read NB_TRACE before any parallel region
+    InitAffinity();         // remember allowed CPUs before any thread is pinned
+
+    world->threads = world->cfg.threads > 0 ? (int)world->cfg.threads : (int)GetCpuCount();
+
+    if (world->cfg.symmetric) {
+        // x and y accumulators of every thread, each padded to a cache line to avoid false sharing
+        world->pair_stride = (world->mass_len + SOA_PADDING - 1) / SOA_PADDING * SOA_PADDING;
+        size_t len = (size_t)world->threads * 2 * world->pair_stride;
+        world->pair_acc = ALLOC(len, float);
+        ASSERT(world->pair_acc != NULL, "Failed to alloc %zu pair accumulators", len);
+        memset(world->pair_acc, 0, len * sizeof(float));
+    }
+
+    return world;
+}
+
+World *CreateWorldEx(const Particle *ps, uint32_t size, const WorldConfig *cfg) {
     Particle *arr = ALLOC(size, Particle);
-    ASSERT(arr != NULL, "Failed to alloc %u particles", size);
+    uint32_t *ids = ALLOC(size, uint32_t);
+    ASSERT(arr != NULL && ids != NULL, "Failed to alloc %u particles", size);
 
     // copy all particles from PS into arr
     memcpy(arr, ps, size * sizeof(Particle));
+    for (uint32_t k = 0; k < size; k++) {
+        ids[k] = k;
+    }
 
     // sort arr so that particles with no mass come after all particles with mass
     uint32_t i = 0, j = size;
@@ -42,77 +136,887 @@ World *CreateWorld(const Particle *ps, uint32_t size) {
         Particle tmp = arr[i];
         arr[i] = arr[j];
         arr[j] = tmp;
+
+        uint32_t tmp_id = ids[i];
+        ids[i] = ids[j];
+        ids[j] = tmp_id;
     }
     // j == index of the first particle without mass == number of particles with mass
 
-    WorldData world_data = {
-            .total_len = size,
-            .mass_len = j,
-    };
-    SimPipeline *sim = CreateSimPipeline(world_data);
-
-    *world = (World){
-        .arr = arr,
-        .sim = sim,
-        .total_len = size,
-        .mass_len = j,
-        .arr_sync = false,  // ARR must be synced with GPU buffer
-        .gpu_sync = true,   // GPU buffer have no data to sync
-    };
-    AllocPackArray(&world->pack, &world->pack_len, world->mass_len);
-
-    return world;
+    return AdoptWorld(arr, ids, size, j, cfg, NULL);
 }
 
 void DestroyWorld(World *w) {
     if (w != NULL) {
         DestroySimPipeline(w->sim);
-        FreePackArray(w->pack);
+        DestroyPool(w->pool);
+        FreeParticleSoA(&w->soa);
+        FreeQuadtree(&w->tree);
+        FreeFmm(&w->fmm);
+        FreePm(&w->pm);
+        FreeMultigrid(&w->mg);
+        FreeP3m(&w->p3m);
+        FreeParticleSoA(&w->tracer_pack);
+        free(w->history);
+        free(w->level);
+        free(w->active);
+        free(w->pair_acc);
+        if (w->snapshot.data != NULL) {
+            FIO_UnmapSnapshot(&w->snapshot);
+        } else {
+            free(w->arr);
+            free(w->ids);
+        }
         free(w);
     }
 }
 
-/* Sync changes from ARR to GPU buffer, if necessary. */
-static void SyncFromArrToGPU(World *w) {
-    if (!w->arr_sync) {
+static void PackChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    World *w = ctx;
+    (void)tid;
+    PackParticleRange(w->arr, &w->soa, from, to);
+}
+
+static void UnpackChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    World *w = ctx;
+    (void)tid;
+    UnpackParticleRange(&w->soa, w->arr, from, to);
+}
+
+/* Make sure ARR holds the latest particle data. */
+static void SyncArr(World *w) {
+    if (!w->arr_valid) {
+        if (w->soa_valid) {
+            uint64_t start = NowNs();
+            PoolFor(w->pool, "unpack", w->total_len, STREAM_CHUNK, UnpackChunk, w);
+            ADD_PHASE(&w->stats.unpack, NowNs() - start);
+        } else {
+            GetSimulationData(w->sim, w->arr);
+        }
+        w->arr_valid = true;
+    }
+}
+
+/* Make sure SOA holds the latest particle data. */
+static void SyncSoA(World *w) {
+    if (!w->soa_valid) {
+        SyncArr(w);
+        if (w->soa.x == NULL) {
+            // created on first use, so that worlds only simulated on GPU or just loaded do not pay for them
+            AllocParticleSoA(&w->soa, w->total_len);
+            w->pool = CreatePool((uint32_t)w->threads, w->cfg.pin_threads);
+        }
+
+        uint64_t start = NowNs();
+        PoolFor(w->pool, "pack", w->total_len, STREAM_CHUNK, PackChunk, w);
+        ADD_PHASE(&w->stats.pack, NowNs() - start);
+
+        w->soa_valid = true;
+    }
+}
+
+/* Make sure GPU buffer holds the latest particle data. Creates simulation pipeline if it does not exist yet. */
+static void SyncGPU(World *w) {
+    if (w->sim == NULL) {
+        WorldData world_data = {
+                .total_len = w->total_len,
+                .mass_len = w->mass_len,
+        };
+        w->sim = CreateSimPipeline(world_data, w->cfg.gpu_kernel);
+    }
+    if (!w->gpu_valid) {
+        SyncArr(w);
         SetSimulationData(w->sim, w->arr);
-        w->arr_sync = true;
+        w->gpu_valid = true;
     }
 }
 
-/* Sync changes from GPU buffer to ARR, if necessary. */
-static void SyncToArrFromGPU(World *w) {
-    if (!w->gpu_sync) {
-        GetSimulationData(w->sim, w->arr);
-        w->gpu_sync = true;
+void GetWorldStats(World *w, WorldStats *stats) {
+    *stats = w->stats;
+    if (w->sim != NULL) {
+        GetSimStats(w->sim, stats);
     }
 }
 
 const Particle *GetWorldParticles(World *w, uint32_t *size) {
-    SyncToArrFromGPU(w);
+    SyncArr(w);
     if (size != NULL) {
         *size = w->total_len;
     }
     return w->arr;
 }
 
+const uint32_t *GetWorldParticleIds(World *w, uint32_t *size) {
+    if (size != NULL) {
+        *size = w->total_len;
+    }
+    return w->ids;
+}
+
+/* Copy ARR and IDS of a loaded world out of the snapshot mapping and unmap it. */
+static void DetachSnapshot(World *w) {
+    if (w->snapshot.data == NULL) return;
+
+    Particle *arr = ALLOC(w->total_len, Particle);
+    uint32_t *ids = ALLOC(w->total_len, uint32_t);
+    ASSERT(arr != NULL && ids != NULL, "Failed to alloc %u particles", w->total_len);
+
+    memcpy(arr, w->arr, w->total_len * sizeof(Particle));
+    memcpy(ids, w->ids, w->total_len * sizeof(uint32_t));
+    FIO_UnmapSnapshot(&w->snapshot);
+
+    w->arr = arr;
+    w->ids = ids;
+}
+
+void SaveWorld(World *w, const char *path, double time, float dt) {
+    SyncArr(w);
+    // the snapshot may be saved over the file it was loaded from, which cannot be replaced while mapped on Windows
+    DetachSnapshot(w);
+
+    SnapshotHeader h = {
+            .version = SNAPSHOT_VERSION,
+            .header_size = sizeof(SnapshotHeader),
+            .particle_size = sizeof(Particle),
+            .total_len = w->total_len,
+            .mass_len = w->mass_len,
+            .flags = w->acc_valid ? SNAPSHOT_ACC_VALID : 0,
+            .time = time,
+            .dt = dt,
+    };
+    memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+    FIO_WriteSnapshot(path, &h, w->arr, w->ids);
+}
+
+World *LoadWorld(const char *path, const WorldConfig *cfg, double *time, float *dt) {
+    Snapshot s;
+    FIO_MapSnapshot(path, &s);
+
+    const SnapshotHeader *h = &s.header;
+    if (time != NULL) *time = h->time;
+    if (dt != NULL) *dt = h->dt;
+
+    // particles are already in the order of a world, so they are used in place
+    World *w = AdoptWorld(s.particles, s.ids, h->total_len, h->mass_len, cfg, &s);
+    w->acc_valid = (h->flags & SNAPSHOT_ACC_VALID) != 0;
+    return w;
+}
+
+/* Reorder LEN particles of ARR and IDS along the Morton curve; TMP must fit LEN particles. */
+static void ReorderRange(Particle *arr, uint32_t *ids, uint32_t len, Particle *tmp, uint32_t *order) {
+    MortonOrder(arr, len, order);
+
+    for (uint32_t k = 0; k < len; k++) {
+        tmp[k] = arr[order[k]];
+    }
+    memcpy(arr, tmp, len * sizeof(Particle));
+
+    // ORDER is no longer needed, reuse it for ids
+    for (uint32_t k = 0; k < len; k++) {
+        order[k] = ids[order[k]];
+    }
+    memcpy(ids, order, len * sizeof(uint32_t));
+}
+
+void ReorderWorld(World *w) {
+    SyncArr(w);
+
+    Particle *tmp = ALLOC(w->total_len, Particle);
+    uint32_t *order = ALLOC(w->total_len, uint32_t);
+    ASSERT(tmp != NULL && order != NULL, "Failed to alloc reorder buffers of %u particles", w->total_len);
+
+    uint64_t start = NowNs();
+    ReorderRange(w->arr, w->ids, w->mass_len, tmp, order);
+    ReorderRange(w->arr + w->mass_len, w->ids + w->mass_len, w->total_len - w->mass_len, tmp, order);
+    TraceSpan("reorder", start, NowNs());
+
+    free(tmp);
+    free(order);
+
+    // acceleration moves together with particles, so it stays valid
+    w->since_reorder = 0;
+    w->soa_valid = false;
+    w->gpu_valid = false;
+}
+
+/* Reorder particles if the configured number of updates has passed, then count N more updates. */
+static void MaybeReorder(World *w, uint32_t n) {
+    if (w->cfg.reorder_interval > 0 && w->since_reorder >= w->cfg.reorder_interval) {
+        ReorderWorld(w);
+    }
+    w->since_reorder += n;
+}
+
+/*
+ * Pin the calling thread, which is worker 0 of the pool, to its own CPU if the world is configured to;
+ * the pool's own workers pin themselves when they start.
+ */
+static void PinCaller(const World *w) {
+    if (w->cfg.pin_threads) PinThread(0);
+}
+
+/* One-sided CPU kernel W is configured to use. */
+static AccelFn GetAccelFn(const World *w) {
+    const CpuKernel *k = w->kernel;
+    if (w->cfg.symmetric) {
+        return w->cfg.fast_math ? k->accel_sym_fast : k->accel_sym;
+    }
+    return w->cfg.fast_math ? k->accel_fast : k->accel;
+}
+
+/* Arguments of the loops of AccelFirst. */
+typedef struct AccelLoop {
+    World *w;
+    AccelFn accel;
+    void (*pairs)(const ParticleSoA *soa, uint32_t mass_len, uint32_t from, uint32_t to, float *ax, float *ay);
+    uint32_t first;     // particle that item 0 of the loop is
+} AccelLoop;
+
+static void AccelChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const AccelLoop *l = ctx;
+    (void)tid;
+    l->accel(&l->w->soa, l->w->mass_len, l->first + from, l->first + to);
+}
+
+/* First row of pairs of slice S out of SLICES; rows get shorter towards the end, so that slices have the same pairs. */
+static uint32_t SliceRow(uint32_t mass_len, uint32_t s, uint32_t slices) {
+    // rows [0, R) have `R * (MASS_LEN - R / 2)` pairs, which is S / SLICES of all of them
+    return (uint32_t)((double)mass_len * (1 - sqrt(1 - (double)s / slices)));
+}
+
+/* Rows of pairs of slices [FROM, TO); every slice has accumulators of its own, whichever worker runs it. */
+static void PairsChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const AccelLoop *l = ctx;
+    World *w = l->w;
+    (void)tid;
+
+    for (uint32_t s = from; s < to; s++) {
+        float *ax = w->pair_acc + (size_t)s * 2 * w->pair_stride;
+        uint32_t begin = SliceRow(w->mass_len, s, (uint32_t)w->threads);
+        uint32_t end = SliceRow(w->mass_len, s + 1, (uint32_t)w->threads);
+        l->pairs(&w->soa, w->mass_len, begin, end, ax, ax + w->pair_stride);
+    }
+}
+
+/* Sum accumulators of all slices, and clear them for the next time. */
+static void SumPairsChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    World *w = ctx;
+    (void)tid;
+
+    for (uint32_t i = from; i < to; i++) {
+        float sum_x = 0, sum_y = 0;
+        for (int t = 0; t < w->threads; t++) {
+            float *ax = w->pair_acc + (size_t)t * 2 * w->pair_stride;
+            float *ay = ax + w->pair_stride;
+            sum_x += ax[i];
+            sum_y += ay[i];
+            ax[i] = ay[i] = 0;
+        }
+        w->soa.ax[i] = sum_x;
+        w->soa.ay[i] = sum_y;
+    }
+}
+
+/*
+ * Set acceleration of the first COUNT particles of SOA by direct summation; COUNT is either all of them or
+ * the number of particles with mass.
+ */
+static void AccelFirst(World *w, uint32_t count) {
+    AccelLoop l = {
+            .w = w,
+            .accel = GetAccelFn(w),
+            .pairs = w->cfg.fast_math ? w->kernel->pairs_fast : w->kernel->pairs,
+            .first = 0,
+    };
+    if (!w->cfg.symmetric) {
+        PoolFor(w->pool, "accel", count, CPU_CHUNK, AccelChunk, &l);
+        return;
+    }
+
+    // pairs are split into one slice per worker rather than stolen, so that every pull is summed in the same
+    // order on every run; otherwise rounding would depend on which worker ran which rows
+    PoolFor(w->pool, "pairs", (uint32_t)w->threads, 1, PairsChunk, &l);
+
+    // particles without mass pull nothing, so they keep the one-sided kernel
+    l.first = w->mass_len;
+    PoolFor(w->pool, "accel", count - w->mass_len, CPU_CHUNK, AccelChunk, &l);
+    PoolFor(w->pool, "sum pairs", w->mass_len, STREAM_CHUNK, SumPairsChunk, w);
+}
+
+/* Arguments of the loop of IntegrateFirst. */
+typedef struct IntegrateLoop {
+    ParticleSoA *soa;
+    float kick, drift;
+} IntegrateLoop;
+
+static void IntegrateChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const IntegrateLoop *l = ctx;
+    (void)tid;
+    PackedIntegrate(l->soa, l->kick, l->drift, from, to);
+}
+
+/* Integrate the first COUNT particles of SOA after their acceleration is known; KICK and DRIFT include dt. */
+static void IntegrateFirst(World *w, uint32_t count, float kick, float drift) {
+    IntegrateLoop l = {.soa = &w->soa, .kick = kick, .drift = drift};
+    PoolFor(w->pool, "integrate", count, STREAM_CHUNK, IntegrateChunk, &l);
+}
+
+/*
+ * CPU updates run every parallel phase as a loop of the world's pool: direct and tree gravity, integration
+ * and packing here, and the loops of FMM, PM, P3M and multigrid solvers, which are given the pool.
+ */
+
 void UpdateWorld_CPU(World *w, float dt, uint32_t n) {
-    SyncToArrFromGPU(w);
-    for (uint32_t update_iter = 0; update_iter < n; update_iter++) {
-        PackParticles(w->mass_len, w->arr, w->pack);
+    if (n == 0) return;
+    MaybeReorder(w, n);
+    SyncSoA(w);
+    PinCaller(w);
+
+    Schedule sched = MakeSchedule(w->cfg.integrator, n, w->acc_valid);
+    uint32_t len = ScheduleLength(&sched);
 
-        #pragma omp parallel for schedule(static, 20) firstprivate(dt, w) default(none)
-        for (uint32_t i = 0; i < w->total_len; i++) {
-            PackedUpdate(&w->arr[i], dt, w->pack_len, w->pack);
+    for (uint32_t k = 0; k < len; k++) {
+        Stage stage = GetStage(&sched, k);
+        uint64_t t0 = NowNs();
+
+        if (stage.accel) {
+            AccelFirst(w, w->total_len);
         }
+        uint64_t t1 = NowNs();
+
+        IntegrateFirst(w, w->total_len, stage.kick * dt, stage.drift * dt);
+        uint64_t t2 = NowNs();
+
+        if (stage.accel) ADD_PHASE(&w->stats.cpu_accel, t1 - t0);
+        ADD_PHASE(&w->stats.cpu_integrate, t2 - t1);
     }
-    w->arr_sync = false;
+
+    w->acc_valid = ScheduleLeavesAccValid(&sched);
+    w->arr_valid = false;
+    w->gpu_valid = false;
+}
+
+/* Arguments of the loop of Barnes-Hut tree walks. */
+typedef struct TreeLoop {
+    World *w;
+    float theta;
+} TreeLoop;
+
+static void TreeChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const TreeLoop *l = ctx;
+    (void)tid;
+    QuadtreeAccel(&l->w->tree, &l->w->soa, from, to, l->theta);
+}
+
+void UpdateWorld_BarnesHut(World *w, float dt, uint32_t n, float theta) {
+    if (n == 0) return;
+    MaybeReorder(w, n);
+    SyncSoA(w);
+    PinCaller(w);
+
+    Schedule sched = MakeSchedule(w->cfg.integrator, n, w->acc_valid);
+    uint32_t len = ScheduleLength(&sched);
+    TreeLoop l = {.w = w, .theta = theta};
+
+    for (uint32_t k = 0; k < len; k++) {
+        Stage stage = GetStage(&sched, k);
+        uint64_t t0 = NowNs(), t1 = t0;
+
+        if (stage.accel) {
+            // building is sequential
+            BuildQuadtree(&w->tree, &w->soa, w->mass_len);
+            t1 = NowNs();
+            TraceSpan("build tree", t0, t1);
+
+            // tree walks differ in length, which stealing evens out
+            PoolFor(w->pool, "tree accel", w->total_len, CPU_CHUNK, TreeChunk, &l);
+        }
+        uint64_t t2 = NowNs();
+
+        IntegrateFirst(w, w->total_len, stage.kick * dt, stage.drift * dt);
+        uint64_t t3 = NowNs();
+
+        if (stage.accel) {
+            ADD_PHASE(&w->stats.cpu_tree, t1 - t0);
+            ADD_PHASE(&w->stats.cpu_accel, t2 - t1);
+        }
+        ADD_PHASE(&w->stats.cpu_integrate, t3 - t2);
+    }
+
+    w->acc_valid = ScheduleLeavesAccValid(&sched);
+    w->arr_valid = false;
+    w->gpu_valid = false;
+}
+
+void UpdateWorld_FMM(World *w, float dt, uint32_t n, uint32_t order, float theta) {
+    ASSERT(order >= 1 && order <= NB_MAX_FMM_ORDER, "FMM order must be from 1 to %d, got %u",
+           NB_MAX_FMM_ORDER, order);
+    if (n == 0) return;
+    MaybeReorder(w, n);
+    SyncSoA(w);
+    PinCaller(w);
+
+    Schedule sched = MakeSchedule(w->cfg.integrator, n, w->acc_valid);
+    uint32_t len = ScheduleLength(&sched);
+
+    for (uint32_t k = 0; k < len; k++) {
+        Stage stage = GetStage(&sched, k);
+        uint64_t t0 = NowNs(), t1 = t0;
+
+        if (stage.accel) {
+            BuildFmm(&w->fmm, w->pool, &w->soa, w->total_len, w->mass_len, order);
+            t1 = NowNs();
+            TraceSpan("build tree", t0, t1);
+
+            FmmAccel(&w->fmm, w->pool, &w->soa, theta);
+            TraceSpan("fmm accel", t1, NowNs());
+        }
+        uint64_t t2 = NowNs();
+
+        IntegrateFirst(w, w->total_len, stage.kick * dt, stage.drift * dt);
+        uint64_t t3 = NowNs();
+
+        if (stage.accel) {
+            ADD_PHASE(&w->stats.cpu_tree, t1 - t0);
+            ADD_PHASE(&w->stats.cpu_accel, t2 - t1);
+        }
+        ADD_PHASE(&w->stats.cpu_integrate, t3 - t2);
+    }
+
+    w->acc_valid = ScheduleLeavesAccValid(&sched);
+    w->arr_valid = false;
+    w->gpu_valid = false;
+}
+
+void UpdateWorld_PM(World *w, float dt, uint32_t n, uint32_t grid) {
+    ASSERT(grid >= 8 && grid <= NB_MAX_PM_GRID && (grid & (grid - 1)) == 0,
+           "PM grid must be a power of 2 from 8 to %d, got %u", NB_MAX_PM_GRID, grid);
+    if (n == 0) return;
+    MaybeReorder(w, n);
+    SyncSoA(w);
+    PinCaller(w);
+
+    Schedule sched = MakeSchedule(w->cfg.integrator, n, w->acc_valid);
+    uint32_t len = ScheduleLength(&sched);
+
+    for (uint32_t k = 0; k < len; k++) {
+        Stage stage = GetStage(&sched, k);
+        uint64_t t0 = NowNs();
+
+        if (stage.accel) {
+            PmAccel(&w->pm, w->pool, &w->soa, w->total_len, w->mass_len, grid, 0);
+            TraceSpan("pm accel", t0, NowNs());
+        }
+        uint64_t t1 = NowNs();
+
+        IntegrateFirst(w, w->total_len, stage.kick * dt, stage.drift * dt);
+        uint64_t t2 = NowNs();
+
+        if (stage.accel) ADD_PHASE(&w->stats.cpu_accel, t1 - t0);
+        ADD_PHASE(&w->stats.cpu_integrate, t2 - t1);
+    }
+
+    w->acc_valid = ScheduleLeavesAccValid(&sched);
+    w->arr_valid = false;
+    w->gpu_valid = false;
+}
+
+void UpdateWorld_P3M(World *w, float dt, uint32_t n, uint32_t grid) {
+    ASSERT(grid >= 8 && grid <= NB_MAX_PM_GRID && (grid & (grid - 1)) == 0,
+           "PM grid must be a power of 2 from 8 to %d, got %u", NB_MAX_PM_GRID, grid);
+    if (n == 0) return;
+    MaybeReorder(w, n);
+    SyncSoA(w);
+    PinCaller(w);
+
+    Schedule sched = MakeSchedule(w->cfg.integrator, n, w->acc_valid);
+    uint32_t len = ScheduleLength(&sched);
+
+    // softening of the long-range part is not symmetric, so neither is the short-range one
+    AccelFn accel = w->cfg.fast_math ? w->kernel->accel_fast : w->kernel->accel;
+
+    for (uint32_t k = 0; k < len; k++) {
+        Stage stage = GetStage(&sched, k);
+        uint64_t t0 = NowNs();
+
+        if (stage.accel) {
+            P3mAccel(&w->p3m, w->pool, &w->soa, w->total_len, w->mass_len, grid, accel);
+            TraceSpan("p3m accel", t0, NowNs());
+        }
+        uint64_t t1 = NowNs();
+
+        IntegrateFirst(w, w->total_len, stage.kick * dt, stage.drift * dt);
+        uint64_t t2 = NowNs();
+
+        if (stage.accel) ADD_PHASE(&w->stats.cpu_accel, t1 - t0);
+        ADD_PHASE(&w->stats.cpu_integrate, t2 - t1);
+    }
+
+    w->acc_valid = ScheduleLeavesAccValid(&sched);
+    w->arr_valid = false;
+    w->gpu_valid = false;
+}
+
+void UpdateWorld_Multigrid(World *w, float dt, uint32_t n, uint32_t grid) {
+    ASSERT(grid >= 8 && grid <= NB_MAX_MG_GRID && (grid & (grid - 1)) == 0,
+           "Multigrid size must be a power of 2 from 8 to %d, got %u", NB_MAX_MG_GRID, grid);
+    if (n == 0) return;
+    MaybeReorder(w, n);
+    SyncSoA(w);
+    PinCaller(w);
+
+    Schedule sched = MakeSchedule(w->cfg.integrator, n, w->acc_valid);
+    uint32_t len = ScheduleLength(&sched);
+
+    for (uint32_t k = 0; k < len; k++) {
+        Stage stage = GetStage(&sched, k);
+        uint64_t t0 = NowNs();
+
+        if (stage.accel) {
+            MultigridAccel(&w->mg, w->pool, &w->soa, w->total_len, w->mass_len, grid);
+            TraceSpan("multigrid accel", t0, NowNs());
+        }
+        uint64_t t1 = NowNs();
+
+        IntegrateFirst(w, w->total_len, stage.kick * dt, stage.drift * dt);
+        uint64_t t2 = NowNs();
+
+        if (stage.accel) ADD_PHASE(&w->stats.cpu_accel, t1 - t0);
+        ADD_PHASE(&w->stats.cpu_integrate, t2 - t1);
+    }
+
+    w->acc_valid = ScheduleLeavesAccValid(&sched);
+    w->arr_valid = false;
+    w->gpu_valid = false;
+}
+
+/*
+ * Tracer blocks. Particles with mass go through a block of stages first, and their positions at every force
+ * evaluation are recorded. Then particles without mass, which pull nothing, go through the same stages
+ * one tile at a time, pulled by the recorded positions; a tile stays in cache for the whole block
+ * instead of being streamed from memory every stage.
+ */
+
+/* How many particles without mass a worker advances through a block at a time; their data fits L1 cache. */
+#define TRACER_TILE     256
+
+/*
+ * Make sure history fits BLOCK force evaluations, and return the length of its slots. Every evaluation has a slot
+ * of x followed by a slot of y, each with positions of particles with mass and then a tile of every worker.
+ * TRACER_PACK holds masses, radii and acceleration in the same layout, so that with x and y pointed at
+ * the slots of an evaluation it is a ParticleSoA that CPU kernels read.
+ */
+static uint32_t ReserveHistory(World *w, uint32_t block) {
+    uint32_t slot = (w->mass_len + SOA_PADDING - 1) / SOA_PADDING * SOA_PADDING + (uint32_t)w->threads * TRACER_TILE;
+    if (slot > w->tracer_pack.cap) {
+        FreeParticleSoA(&w->tracer_pack);
+        AllocParticleSoA(&w->tracer_pack, slot);
+    }
+
+    size_t len = (size_t)block * 2 * slot;
+    if (len > w->history_cap) {
+        free(w->history);
+        w->history = ALLOC(len, float);
+        ASSERT(w->history != NULL, "Failed to alloc history of %u force evaluations", block);
+        w->history_cap = len;
+    }
+
+    // particles may have been reordered since the last call
+    memcpy(w->tracer_pack.m, w->soa.m, w->mass_len * sizeof(float));
+    memcpy(w->tracer_pack.r, w->soa.r, w->mass_len * sizeof(float));
+    return slot;
+}
+
+/*
+ * Advance particles [FROM, TO) without mass through stages [BEGIN, END) of S, which are a block whose positions
+ * of particles with mass are recorded in history with slots of length SLOT. TILE is where the calling worker's
+ * tile starts in a slot.
+ */
+static void AdvanceTile(World *w, const Schedule *s, uint32_t begin, uint32_t end, uint32_t from, uint32_t to,
+                        uint32_t tile, uint32_t slot, float dt, AccelFn accel) {
+    ParticleSoA *soa = &w->soa;
+    ParticleSoA pack = w->tracer_pack;
+    const uint32_t len = to - from;
+    memcpy(pack.r + tile, soa->r + from, len * sizeof(float));
+
+    for (uint32_t k = begin, e = 0; k < end; k++) {
+        Stage stage = GetStage(s, k);
+        if (stage.accel) {
+            pack.x = w->history + (size_t)2 * slot * e++;
+            pack.y = pack.x + slot;
+            memcpy(pack.x + tile, soa->x + from, len * sizeof(float));
+            memcpy(pack.y + tile, soa->y + from, len * sizeof(float));
+
+            accel(&pack, w->mass_len, tile, tile + len);
+            memcpy(soa->ax + from, pack.ax + tile, len * sizeof(float));
+            memcpy(soa->ay + from, pack.ay + tile, len * sizeof(float));
+        }
+        PackedIntegrate(soa, stage.kick * dt, stage.drift * dt, from, to);
+    }
+}
+
+/* Arguments of the loop over tiles of particles without mass, which are counted from the first of them. */
+typedef struct TileLoop {
+    World *w;
+    const Schedule *s;
+    uint32_t begin, end;    // stages of the block
+    uint32_t slot;          // length of history slots
+    float dt;
+    AccelFn accel;
+} TileLoop;
+
+static void TileChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const TileLoop *l = ctx;
+    World *w = l->w;
+    uint32_t tile = l->slot - ((uint32_t)w->threads - tid) * TRACER_TILE;
+    AdvanceTile(w, l->s, l->begin, l->end, w->mass_len + from, w->mass_len + to, tile, l->slot, l->dt, l->accel);
+}
+
+void UpdateWorld_TracerBlocks(World *w, float dt, uint32_t n, uint32_t block) {
+    ASSERT(block > 0, "Tracer block must have at least one force evaluation");
+    if (n == 0) return;
+    MaybeReorder(w, n);
+    SyncSoA(w);
+    PinCaller(w);
+
+    uint32_t slot = ReserveHistory(w, block);
+    Schedule sched = MakeSchedule(w->cfg.integrator, n, w->acc_valid);
+    uint32_t len = ScheduleLength(&sched);
+    ParticleSoA *soa = &w->soa;
+
+    for (uint32_t begin = 0, end; begin < len; begin = end) {
+        // a block ends before the stage that needs one force evaluation too many
+        uint32_t evals = 0;
+        for (end = begin; end < len; end++) {
+            if (!GetStage(&sched, end).accel) continue;
+            if (evals == block) break;
+            evals++;
+        }
+
+        for (uint32_t k = begin, e = 0; k < end; k++) {
+            Stage stage = GetStage(&sched, k);
+            uint64_t t0 = NowNs();
+
+            if (stage.accel) {
+                float *hx = w->history + (size_t)2 * slot * e++;
+                float *hy = hx + slot;
+                memcpy(hx, soa->x, w->mass_len * sizeof(float));
+                memcpy(hy, soa->y, w->mass_len * sizeof(float));
+
+                AccelFirst(w, w->mass_len);
+            }
+            uint64_t t1 = NowNs();
+
+            IntegrateFirst(w, w->mass_len, stage.kick * dt, stage.drift * dt);
+            uint64_t t2 = NowNs();
+
+            if (stage.accel) ADD_PHASE(&w->stats.cpu_accel, t1 - t0);
+            ADD_PHASE(&w->stats.cpu_integrate, t2 - t1);
+        }
+        uint64_t t0 = NowNs();
+
+        TileLoop l = {
+                .w = w,
+                .s = &sched,
+                .begin = begin,
+                .end = end,
+                .slot = slot,
+                .dt = dt,
+                .accel = GetAccelFn(w),
+        };
+        PoolFor(w->pool, "tracers", w->total_len - w->mass_len, TRACER_TILE, TileChunk, &l);
+
+        // particles without mass mostly compute acceleration; their time joins the evaluations counted above
+        w->stats.cpu_accel.ns += NowNs() - t0;
+    }
+
+    w->acc_valid = ScheduleLeavesAccValid(&sched);
+    w->arr_valid = false;
+    w->gpu_valid = false;
+}
+
+/*
+ * Block time steps. A big step DT is split into 2^LEVELS substeps; a particle of level L advances with
+ * step DT / 2^L, which is a whole number of substeps. Every particle is drifted each substep, so positions
+ * of all sources are always predicted to the current time; only particles whose own step ends get new
+ * acceleration. Each particle's step is kick-drift-kick leapfrog.
+ */
+
+/* Finest level a particle with acceleration (AX, AY) and radius R needs, so that its step is under the limit. */
+static uint32_t PickLevel(float ax, float ay, float r, float dt, uint32_t levels, float eta) {
+    // `sqrt(2 * eta * eps / |a|)` with softening length eps, the criterion of GADGET; radius is eps^2
+    float acc = hypotf(ax, ay);
+    float limit = sqrtf(2 * eta * sqrtf(r) / acc);  // +inf if acc is 0
+
+    uint32_t level = 0;
+    for (float step = dt; level < levels && step > limit; step *= 0.5f) {
+        level++;
+    }
+    return level;
+}
+
+/*
+ * Level a particle can switch to at substep S if it wants level WANT. Moving to a coarser level is
+ * only possible when the coarser step starts at S, otherwise the nearest finer level that does is used.
+ */
+static uint32_t AlignLevel(uint32_t want, uint32_t s, uint32_t levels) {
+    while (want < levels && s % (1u << (levels - want)) != 0) want++;
+    return want;
+}
+
+/* Arguments of the loops of block time steps. */
+typedef struct BlockLoop {
+    World *w;
+    AccelFn accel;
+    float dt, h, eta;       // big step, substep and accuracy parameter
+    uint32_t levels, substeps;
+    uint32_t sub;           // the current substep within the big step
+} BlockLoop;
+
+/* All particles start together, so any level can be picked. */
+static void PickChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const BlockLoop *l = ctx;
+    const ParticleSoA *soa = &l->w->soa;
+    (void)tid;
+
+    for (uint32_t i = from; i < to; i++) {
+        l->w->level[i] = (uint8_t)PickLevel(soa->ax[i], soa->ay[i], soa->r[i], l->dt, l->levels, l->eta);
+    }
+}
+
+/* Particles whose step starts get the first half-kick, then everyone drifts. */
+static void DriftChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const BlockLoop *l = ctx;
+    ParticleSoA *soa = &l->w->soa;
+    (void)tid;
+
+    for (uint32_t i = from; i < to; i++) {
+        uint32_t len = l->substeps >> l->w->level[i];   // own step in substeps
+        if (l->sub % len == 0) {
+            float half_kick = 0.5f * l->h * (float)len;
+            soa->vx[i] += soa->ax[i] * half_kick;
+            soa->vy[i] += soa->ay[i] * half_kick;
+        }
+        soa->x[i] += soa->vx[i] * l->h;
+        soa->y[i] += soa->vy[i] * l->h;
+    }
+}
+
+/* Active particles [FROM, TO) are scattered, so each is computed on its own. */
+static void ActiveAccelChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const BlockLoop *l = ctx;
+    (void)tid;
+
+    for (uint32_t k = from; k < to; k++) {
+        uint32_t i = l->w->active[k];
+        l->accel(&l->w->soa, l->w->mass_len, i, i + 1);
+    }
+}
+
+/* The second half-kick of active particles [FROM, TO), then the next step of each may use another level. */
+static void KickChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    const BlockLoop *l = ctx;
+    ParticleSoA *soa = &l->w->soa;
+    (void)tid;
+
+    for (uint32_t k = from; k < to; k++) {
+        uint32_t i = l->w->active[k];
+        float half_kick = 0.5f * l->h * (float)(l->substeps >> l->w->level[i]);
+        soa->vx[i] += soa->ax[i] * half_kick;
+        soa->vy[i] += soa->ay[i] * half_kick;
+
+        uint32_t want = PickLevel(soa->ax[i], soa->ay[i], soa->r[i], l->dt, l->levels, l->eta);
+        l->w->level[i] = (uint8_t)AlignLevel(want, (l->sub + 1) % l->substeps, l->levels);
+    }
+}
+
+void UpdateWorld_BlockSteps(World *w, float dt, uint32_t n, uint32_t levels, float eta) {
+    ASSERT(levels <= NB_MAX_BLOCK_LEVELS, "Block time steps support at most %d levels, got %u",
+           NB_MAX_BLOCK_LEVELS, levels);
+    if (n == 0) return;
+
+    MaybeReorder(w, n);
+    SyncSoA(w);
+    PinCaller(w);
+    if (w->level == NULL) {
+        w->level = ALLOC(w->total_len, uint8_t);
+        w->active = ALLOC(w->total_len, uint32_t);
+        ASSERT(w->level != NULL && w->active != NULL, "Failed to alloc block time step levels");
+    }
+
+    BlockLoop l = {
+            .w = w,
+            .accel = GetAccelFn(w),
+            .dt = dt,
+            .h = dt / (float)(1u << levels),    // exact because the number of substeps is a power of 2
+            .eta = eta,
+            .levels = levels,
+            .substeps = 1u << levels,
+            .sub = 0,
+    };
+
+    // the first kick needs acceleration at current positions
+    if (!w->acc_valid) {
+        AccelFirst(w, w->total_len);
+    }
+    PoolFor(w->pool, "pick levels", w->total_len, STREAM_CHUNK, PickChunk, &l);
+
+    for (uint32_t step = 0; step < n; step++) {
+        for (l.sub = 0; l.sub < l.substeps; l.sub++) {
+            uint64_t t0 = NowNs();
+            PoolFor(w->pool, "kick drift", w->total_len, STREAM_CHUNK, DriftChunk, &l);
+            uint64_t t1 = NowNs();
+
+            // collect particles whose step ends after this substep
+            uint32_t active_len = 0;
+            for (uint32_t i = 0; i < w->total_len; i++) {
+                if ((l.sub + 1) % (l.substeps >> w->level[i]) == 0) {
+                    w->active[active_len++] = i;
+                }
+            }
+
+            // substeps with few active particles run on the calling thread alone
+            PoolFor(w->pool, "accel", active_len, CPU_CHUNK, ActiveAccelChunk, &l);
+            uint64_t t2 = NowNs();
+
+            PoolFor(w->pool, "kick", active_len, STREAM_CHUNK, KickChunk, &l);
+            uint64_t t3 = NowNs();
+
+            ADD_PHASE(&w->stats.cpu_accel, t2 - t1);
+            ADD_PHASE(&w->stats.cpu_integrate, (t1 - t0) + (t3 - t2));
+        }
+    }
+
+    // every particle's step ends with a force evaluation at its final position
+    w->acc_valid = true;
+    w->arr_valid = false;
+    w->gpu_valid = false;
 }
 
 void UpdateWorld_GPU(World *w, float dt, uint32_t n) {
-    if (n > 0) {
-        SyncFromArrToGPU(w);
-        PerformSimUpdate(w->sim, n, dt);
-        w->gpu_sync = false;
+    WaitWorld(w, UpdateWorld_GPU_Async(w, dt, n));
+}
+
+uint64_t UpdateWorld_GPU_Async(World *w, float dt, uint32_t n) {
+    if (n == 0) return 0;   // nothing to wait for
+
+    MaybeReorder(w, n);
+    SyncGPU(w);
+    Schedule schedule = MakeSchedule(w->cfg.integrator, n, w->acc_valid);
+    uint64_t ticket = SubmitSimUpdate(w->sim, &schedule, dt);
+
+    w->acc_valid = ScheduleLeavesAccValid(&schedule);
+    w->arr_valid = false;
+    w->soa_valid = false;
+    return ticket;
+}
+
+void WaitWorld(World *w, uint64_t ticket) {
+    if (w->sim != NULL) {
+        WaitSimUpdate(w->sim, ticket);
     }
 }
+
+bool PollWorld(World *w, uint64_t ticket) {
+    return w->sim == NULL || PollSimUpdate(w->sim, ticket);
+}
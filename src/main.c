@@ -35,14 +35,14 @@ static const float STEPS[] = {0.1f, 0.25f, 0.5f, 1.f, 2.f, 4.f};    // fixed ste
 /* Create camera that will fit all particles on screen. */
 static Camera2D CreateCamera(const Particle *ps, uint32_t count);
 
-/* Draw all particles of WORLD. */
-static void DrawParticles(World *world, float min_radius);
+/* Draw COUNT particles of PS. */
+static void DrawParticles(const Particle *ps, uint32_t count, float min_radius);
 
 int main(void) {
-    srand((unsigned int)time(NULL));
-
-    Particle *particles = MakeGalaxies(PARTICLE_COUNT, 3);
-    World *world = CreateWorld(particles, PARTICLE_COUNT);
+    Particle *particles = MakeGalaxies(PARTICLE_COUNT, 3, (uint64_t)time(NULL));
+    // leapfrog costs the same as Euler per update, but stays stable with larger steps
+    WorldConfig cfg = {.integrator = INTEGRATOR_LEAPFROG};
+    World *world = CreateWorldEx(particles, PARTICLE_COUNT, &cfg);
 
     Camera2D camera = CreateCamera(particles, PARTICLE_COUNT);
     free(particles);
@@ -136,6 +136,10 @@ int main(void) {
             }
         }
 
+        // particles are taken before updating, so that GPU simulation runs while they are drawn
+        uint32_t particle_count;
+        const Particle *ps = GetWorldParticles(world, &particle_count);
+
         // update stuff
         if (!pause) {
             phys_time += SPEEDS[speed_idx] * GetFrameTime();
@@ -156,20 +160,21 @@ int main(void) {
 
             float step = PHYS_STEP * STEPS[step_idx];
             if (use_gpu) {
-                UpdateWorld_GPU(world, step, updates);
+                UpdateWorld_GPU_Async(world, step, updates);
             } else {
                 UpdateWorld_CPU(world, step, updates);
             }
         }
 
-        // draw stuff
+        // draw stuff; the span includes waiting for the buffer swap
+        uint64_t render_start = BeginTraceSpan();
         BeginDrawing();
         {
             ClearBackground(BG_COLOR);
             BeginMode2D(camera);
             {
                 float min_radius = 0.5f / camera.zoom;
-                DrawParticles(world, min_radius);
+                DrawParticles(ps, particle_count, min_radius);
             }
             EndMode2D();
 
@@ -189,6 +194,7 @@ int main(void) {
             }
         }
         EndDrawing();
+        EndTraceSpan("render", render_start);
     }
 
     CloseWindow();
@@ -234,12 +240,9 @@ static Color ColorForMass(float mass) {
     }
 }
 
-static void DrawParticles(World *world, float min_radius) {
-    uint32_t size;
-    const Particle *arr = GetWorldParticles(world, &size);
-
-    for (uint32_t i = 0; i < size; i++) {
-        Particle p = arr[i];
+static void DrawParticles(const Particle *ps, uint32_t count, float min_radius) {
+    for (uint32_t i = 0; i < count; i++) {
+        Particle p = ps[i];
         DrawCircle(
                 (int)p.pos.x,
                 (int)p.pos.y,
@@ -25,14 +25,21 @@ layout (local_size_x_id = 0) in;
 /* Gravitational constant; `g = NB_G * mass / dist^2`. */
 layout (constant_id = 1) const float G = 10;
 
+/* Integrator stage; see Stage in integrator.h. */
+layout (push_constant) uniform Stage {
+    float kick;     // velocity step as a fraction of dt
+    float drift;    // position step as a fraction of dt
+    uint accel;     // whether acceleration is computed; otherwise the stored one is used
+} stage;
+
 void main() {
     uint i = gl_GlobalInvocationID.x;
     if (i >= world.total_len) return;
 
     Particle p = old.arr[i];
-    p.acc = vec2(0);
+    if (stage.accel != 0) p.acc = vec2(0);
 
-    for (uint j = 0; j < world.mass_len; j++) {
+    for (uint j = 0; stage.accel != 0 && j < world.mass_len; j++) {
         Particle other = old.arr[j];
 
         vec2 radv = other.pos - p.pos;      // radius-vector
@@ -48,8 +55,8 @@ void main() {
         p.acc += radv * (G * other.mass / r3);
     }
 
-    p.vel += world.dt * p.acc;
-    p.pos += world.dt * p.vel;
+    p.vel += (stage.kick * world.dt) * p.acc;
+    p.pos += (stage.drift * world.dt) * p.vel;
 
     new.arr[i] = p;
 }
@@ -0,0 +1,89 @@
+#version 450
+
+struct Particle {
+    vec2 pos, vel, acc;
+    float mass, radius;
+};
+
+layout (std140, binding = 0) uniform WorldData {
+    uint total_len; // total number of particles
+    uint mass_len;  // number of particles with mass
+    float dt;       // time delta
+} world;
+
+layout (std140, binding = 1) readonly buffer FrameOld {
+    Particle arr[];
+} old;
+
+layout (std140, binding = 2) buffer FrameNew {
+    Particle arr[];
+} new;
+
+/* Local group size as specialization constant; also the size of a tile. */
+layout (local_size_x_id = 0) in;
+
+/* Gravitational constant; `g = NB_G * mass / dist^2`. */
+layout (constant_id = 1) const float G = 10;
+
+/* Integrator stage; see Stage in integrator.h. */
+layout (push_constant) uniform Stage {
+    float kick;     // velocity step as a fraction of dt
+    float drift;    // position step as a fraction of dt
+    uint accel;     // whether acceleration is computed; otherwise the stored one is used
+} stage;
+
+/* Positions (xy) and masses (z) of the current tile of particles with mass. */
+shared vec3 tile[gl_WorkGroupSize.x];
+
+void main() {
+    uint i = gl_GlobalInvocationID.x;
+    uint lid = gl_LocalInvocationID.x;
+
+    // invocations past the end can't return early because they help loading tiles
+    bool active = i < world.total_len;
+
+    Particle p;
+    if (active) {
+        p = old.arr[i];
+    } else {
+        p = Particle(vec2(0), vec2(0), vec2(0), 0, 0);
+    }
+    if (stage.accel != 0) p.acc = vec2(0);
+
+    // push constants are uniform, so the whole work group skips tiles together
+    for (uint base = 0; stage.accel != 0 && base < world.mass_len; base += gl_WorkGroupSize.x) {
+        // every invocation loads one particle of the tile
+        uint j = base + lid;
+        if (j < world.mass_len) {
+            tile[lid] = vec3(old.arr[j].pos, old.arr[j].mass);
+        } else {
+            tile[lid] = vec3(0);
+        }
+        barrier();
+
+        uint tile_len = min(gl_WorkGroupSize.x, world.mass_len - base);
+        for (uint k = 0; k < tile_len; k++) {
+            vec3 other = tile[k];
+
+            vec2 radv = other.xy - p.pos;       // radius-vector
+            float dist_sq = dot(radv, radv);    // distance^2
+
+            float r2 = dist_sq + p.radius;      // distance^2, softened
+            float r1 = sqrt(r2);                // distance^1, softened
+            float r3 = r1 * r2;                 // distance^3, softened
+
+            // acceleration == radv * (Gm / dist^3), see particle_cs.glsl
+            p.acc += radv * (G * other.z / r3);
+        }
+
+        // wait until everyone is done with the tile before loading the next one
+        barrier();
+    }
+
+    if (active) {
+        p.vel += (stage.kick * world.dt) * p.acc;
+        p.pos += (stage.drift * world.dt) * p.vel;
+
+        new.arr[i] = p;
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef NB_TEST_PARTICLES_H
+#define NB_TEST_PARTICLES_H
+
+/*
+ * Random particles and the direct-sum reference that tests of approximate solvers compare against.
+ * Everything is drawn from rand(), so tests pick their data with srand().
+ */
+
+#include <stdlib.h>
+#include <nbody.h>
+#include "sim_cpu.h"
+
+/* Random float in range [MIN, MAX). */
+static inline float RandFloat(float min, float max) {
+    return min + (max - min) * (float)rand() / (float)RAND_MAX;
+}
+
+/* Particle at (X, Y) with random radius, and random mass if WITH_MASS. */
+static inline Particle RandParticle(float x, float y, bool with_mass) {
+    return (Particle){
+            .pos = V2_FROM(x, y),
+            .radius = RandFloat(1, 10),
+            .mass = with_mass ? RandFloat(100, 10000) : 0,
+    };
+}
+
+/* COUNT particles spread evenly over a square of SIZE x SIZE around the origin; the first MASS_LEN of them have mass. */
+static inline Particle *UniformParticles(uint32_t count, uint32_t mass_len, float size) {
+    Particle *ps = malloc(count * sizeof(Particle));
+    for (uint32_t i = 0; i < count; i++) {
+        float x = RandFloat(-size / 2, size / 2);
+        float y = RandFloat(-size / 2, size / 2);
+        ps[i] = RandParticle(x, y, i < mass_len);
+    }
+    return ps;
+}
+
+/*
+ * COUNT particles in 15 clumps of SIZE x SIZE, 2000 apart horizontally and 1500 apart vertically, so that
+ * particles have close neighbours and trees are not uniform; the first MASS_LEN of them have mass.
+ */
+static inline Particle *ClumpedParticles(uint32_t count, uint32_t mass_len, float size) {
+    Particle *ps = malloc(count * sizeof(Particle));
+    for (uint32_t i = 0; i < count; i++) {
+        float x = (float)(i % 5) * 2000.f + RandFloat(-size / 2, size / 2);
+        float y = (float)(i % 3) * 1500.f + RandFloat(-size / 2, size / 2);
+        ps[i] = RandParticle(x, y, i < mass_len);
+    }
+    return ps;
+}
+
+/* Allocate SOA for COUNT particles of PS and pack them into it. */
+static inline void MakeSoA(ParticleSoA *soa, const Particle *ps, uint32_t count) {
+    AllocParticleSoA(soa, count);
+    PackParticles(ps, soa);
+}
+
+/*
+ * Mean relative error of acceleration of particles FROM to COUNT in APPROX, compared to direct summation
+ * over its first MASS_LEN particles by the scalar kernel.
+ */
+static inline double MeanRelError(const ParticleSoA *approx, uint32_t count, uint32_t mass_len, uint32_t from) {
+    ParticleSoA exact;
+    AllocParticleSoA(&exact, count);
+    for (uint32_t i = 0; i < count; i++) {
+        exact.x[i] = approx->x[i];
+        exact.y[i] = approx->y[i];
+        exact.m[i] = approx->m[i];
+        exact.r[i] = approx->r[i];
+    }
+    GetCpuKernel(CPU_SIMD_NONE)->accel(&exact, mass_len, from, count);
+
+    double sum = 0;
+    for (uint32_t i = from; i < count; i++) {
+        V2 e = V2_FROM(exact.ax[i], exact.ay[i]);
+        V2 a = V2_FROM(approx->ax[i], approx->ay[i]);
+        sum += MagV2(SubV2(a, e)) / MagV2(e);
+    }
+
+    FreeParticleSoA(&exact);
+    return sum / (count - from);
+}
+
+#endif //NB_TEST_PARTICLES_H
@@ -0,0 +1,66 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#   define _GNU_SOURCE  // sched_getaffinity and CPU_* macros
+#endif
+
+#include <acutest.h>
+
+#include <nbody.h>
+#include "affinity.h"
+
+#ifdef __linux__
+#   include <sched.h>
+#endif
+
+/* A pinned thread may only run on its CPU, which is one of those allowed at first. */
+void test_pin() {
+#ifdef __linux__
+    cpu_set_t allowed, pinned;
+    TEST_ASSERT(sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+    InitAffinity();
+
+    // wraps around to the second allowed CPU, or the only one
+    int count = CPU_COUNT(&allowed);
+    PinThread((uint32_t)count + 1);
+    TEST_ASSERT(sched_getaffinity(0, sizeof(pinned), &pinned) == 0);
+
+    TEST_CHECK_(CPU_COUNT(&pinned) == 1, "thread may run on %d CPUs", CPU_COUNT(&pinned));
+    int cpu = 0, seen = 0;
+    for (; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) seen++;
+        if (CPU_ISSET(cpu, &pinned)) break;
+    }
+    TEST_CHECK_(cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed), "pinned to CPU %d, which is not allowed", cpu);
+    TEST_CHECK_(seen == (count > 1 ? 2 : 1), "pinned to allowed CPU number %d", seen);
+#endif
+}
+
+/* Pinned threads simulate the same as unpinned ones. */
+void test_world() {
+    Particle ps[64];
+    for (int i = 0; i < 64; i++) {
+        ps[i] = (Particle){.pos = V2_FROM(i % 8 * 10.f, i / 8 * 10.f), .mass = 100, .radius = 1};
+    }
+    WorldConfig cfg = {.threads = 2};
+    World *free_world = CreateWorldEx(ps, 64, &cfg);
+    cfg.pin_threads = true;
+    World *pinned_world = CreateWorldEx(ps, 64, &cfg);
+
+    UpdateWorld_CPU(free_world, 1.f, 10);
+    UpdateWorld_CPU(pinned_world, 1.f, 10);
+
+    uint32_t len;
+    const Particle *a = GetWorldParticles(free_world, &len);
+    const Particle *b = GetWorldParticles(pinned_world, &len);
+    for (uint32_t i = 0; i < len; i++) {
+        TEST_CHECK_(a[i].pos.x == b[i].pos.x && a[i].pos.y == b[i].pos.y, "particle %u differs", i);
+    }
+
+    DestroyWorld(free_world);
+    DestroyWorld(pinned_world);
+}
+
+TEST_LIST = {
+        TEST(test_pin),
+        TEST(test_world),
+        TEST_LIST_END
+};
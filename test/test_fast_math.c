@@ -0,0 +1,68 @@
+#include <acutest.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <nbody.h>
+#include "sim_cpu.h"
+#include "particles.h"
+
+/* Not a multiple of any pack or block size, so that every code path of the kernels is used. */
+#define COUNT   1003
+
+/*
+ * Error of the fast path compared to the exact one. Single interactions are off by about 1e-6;
+ * the mean error of summed accelerations is around 2e-7 for every instruction set, while the worst
+ * particles (where forces mostly cancel out) reach 2e-5.
+ */
+
+/* Largest acceptable mean relative error of the fast path. */
+#define MAX_MEAN_ERROR  1e-5
+
+/* Largest acceptable relative error of the fast path for a single particle. */
+#define MAX_ERROR       1e-4
+
+/* Compare fast and exact kernels of every instruction set this CPU supports. */
+void test_error() {
+    Particle *ps = UniformParticles(COUNT, COUNT, 10000);
+    ParticleSoA soa;
+    MakeSoA(&soa, ps, COUNT);
+    free(ps);
+
+    float *ax = malloc(COUNT * sizeof(float));
+    float *ay = malloc(COUNT * sizeof(float));
+
+    for (CpuSimd simd = 0; simd < CPU_SIMD_COUNT; simd++) {
+        const CpuKernel *kernel = GetCpuKernel(simd);
+        if (kernel == NULL) continue;
+        TEST_CASE(GetCpuSimdName(simd));
+
+        kernel->accel(&soa, COUNT, 0, COUNT);
+        for (uint32_t i = 0; i < COUNT; i++) {
+            ax[i] = soa.ax[i];
+            ay[i] = soa.ay[i];
+        }
+        kernel->accel_fast(&soa, COUNT, 0, COUNT);
+
+        double sum = 0, max = 0;
+        for (uint32_t i = 0; i < COUNT; i++) {
+            V2 exact = V2_FROM(ax[i], ay[i]);
+            V2 fast = V2_FROM(soa.ax[i], soa.ay[i]);
+            double err = MagV2(SubV2(fast, exact)) / MagV2(exact);
+            sum += err;
+            if (err > max) max = err;
+        }
+        double mean = sum / COUNT;
+
+        TEST_CHECK_(mean < MAX_MEAN_ERROR, "mean relative error %g < %g", mean, MAX_MEAN_ERROR);
+        TEST_CHECK_(max < MAX_ERROR, "max relative error %g < %g", max, MAX_ERROR);
+    }
+
+    free(ax);
+    free(ay);
+    FreeParticleSoA(&soa);
+}
+
+TEST_LIST = {
+        TEST(test_error),
+        TEST_LIST_END
+};
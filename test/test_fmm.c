@@ -0,0 +1,142 @@
+#include <acutest.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <nbody.h>
+#include "fmm.h"
+#include "sim_cpu.h"
+#include "particles.h"
+
+#define COUNT       3000
+#define MASS_LEN    2200    // particles with mass among COUNT; the rest are massless
+#define THREADS     3       // workers of the pool the solver is given
+
+/* Mean relative error of FMM acceleration of ORDER and THETA compared to direct summation. */
+static double FmmError(Fmm *f, const Particle *ps, uint32_t order, float theta) {
+    ParticleSoA soa;
+    MakeSoA(&soa, ps, COUNT);
+    Pool *pool = CreatePool(THREADS, false);
+    BuildFmm(f, pool, &soa, COUNT, MASS_LEN, order);
+    FmmAccel(f, pool, &soa, theta);
+    DestroyPool(pool);
+
+    double err = MeanRelError(&soa, COUNT, MASS_LEN, 0);
+    FreeParticleSoA(&soa);
+    return err;
+}
+
+void test_exact_with_zero_theta() {
+    srand(1);
+    Particle *ps = ClumpedParticles(COUNT, MASS_LEN, 600);
+    Fmm f = {0};
+
+    double err = FmmError(&f, ps, 4, 0.f);
+    TEST_CHECK_(err < 1e-5, "mean relative error %g", err);
+
+    FreeFmm(&f);
+    free(ps);
+}
+
+/* Error must fall with higher order; builds of different orders reuse the same memory. */
+void test_order() {
+    srand(2);
+    Particle *ps = ClumpedParticles(COUNT, MASS_LEN, 600);
+    Fmm f = {0};
+
+    double err2 = FmmError(&f, ps, 2, 0.5f);
+    double err4 = FmmError(&f, ps, 4, 0.5f);
+    double err8 = FmmError(&f, ps, 8, 0.5f);
+
+    TEST_CHECK_(err2 < 5e-3, "order 2: mean relative error %g", err2);
+    TEST_CHECK_(err4 < err2 / 5, "order 4: mean relative error %g, order 2: %g", err4, err2);
+    TEST_CHECK_(err8 < 1e-5, "order 8: mean relative error %g", err8);
+
+    // lower order after higher one
+    double again = FmmError(&f, ps, 2, 0.5f);
+    TEST_CHECK_(again == err2, "order 2 again: mean relative error %g, first time %g", again, err2);
+
+    FreeFmm(&f);
+    free(ps);
+}
+
+/* FMM World must stay close to the direct one. */
+void test_world() {
+    srand(3);
+    Particle *ps = ClumpedParticles(COUNT, MASS_LEN, 600);
+
+    World *direct = CreateWorld(ps, COUNT);
+    World *fmm = CreateWorld(ps, COUNT);
+
+    // a single update, because particles in clumps have close encounters that amplify any difference
+    UpdateWorld_CPU(direct, 0.1f, 1);
+    UpdateWorld_FMM(fmm, 0.1f, 1, 6, 0.5f);
+
+    const Particle *a = GetWorldParticles(direct, NULL);
+    const Particle *b = GetWorldParticles(fmm, NULL);
+
+    double sum = 0;
+    for (uint32_t i = 0; i < COUNT; i++) {
+        sum += MagV2(SubV2(a[i].acc, b[i].acc)) / MagV2(a[i].acc);
+    }
+    double mean = sum / COUNT;
+    TEST_CHECK_(mean < 1e-5, "mean relative difference of acceleration %g", mean);
+
+    DestroyWorld(direct);
+    DestroyWorld(fmm);
+    free(ps);
+}
+
+/* Every node is computed by a single worker, so how the work is shared does not change the result. */
+void test_workers() {
+    srand(4);
+    Particle *ps = ClumpedParticles(COUNT, MASS_LEN, 600);
+    ParticleSoA one, many;
+    MakeSoA(&one, ps, COUNT);
+    MakeSoA(&many, ps, COUNT);
+    Fmm f = {0};
+
+    Pool *pool = CreatePool(1, false);
+    BuildFmm(&f, pool, &one, COUNT, MASS_LEN, 4);
+    FmmAccel(&f, pool, &one, 0.5f);
+    DestroyPool(pool);
+
+    pool = CreatePool(4, false);
+    BuildFmm(&f, pool, &many, COUNT, MASS_LEN, 4);
+    FmmAccel(&f, pool, &many, 0.5f);
+    DestroyPool(pool);
+
+    uint32_t differ = 0;
+    for (uint32_t i = 0; i < COUNT; i++) {
+        if (one.ax[i] != many.ax[i] || one.ay[i] != many.ay[i]) differ++;
+    }
+    TEST_CHECK_(differ == 0, "%u of %u particles differ", differ, COUNT);
+
+    FreeFmm(&f);
+    FreeParticleSoA(&one);
+    FreeParticleSoA(&many);
+    free(ps);
+}
+
+void test_empty() {
+    ParticleSoA soa;
+    AllocParticleSoA(&soa, 0);
+    Fmm f = {0};
+    Pool *pool = CreatePool(THREADS, false);
+
+    BuildFmm(&f, pool, &soa, 0, 0, 4);
+    FmmAccel(&f, pool, &soa, 0.5f);
+    TEST_CHECK(f.tree.node_len == 1);
+
+    DestroyPool(pool);
+    FreeFmm(&f);
+    FreeParticleSoA(&soa);
+}
+
+TEST_LIST = {
+        TEST(test_exact_with_zero_theta),
+        TEST(test_order),
+        TEST(test_world),
+        TEST(test_workers),
+        TEST(test_empty),
+        TEST_LIST_END
+};
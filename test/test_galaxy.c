@@ -0,0 +1,120 @@
+#include <acutest.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <nbody.h>
+#include <galaxy.h>
+
+#define COUNT       5000
+#define GALAXIES    3
+
+/* The same seed gives the same particles on any number of threads. */
+void test_threads() {
+    Particle *one = MakeGalaxiesEx(COUNT, GALAXIES, 42, 1);
+    Particle *two = MakeGalaxiesEx(COUNT, GALAXIES, 42, 2);
+    Particle *five = MakeGalaxiesEx(COUNT, GALAXIES, 42, 5);
+
+    TEST_CHECK(memcmp(one, two, COUNT * sizeof(Particle)) == 0);
+    TEST_CHECK(memcmp(one, five, COUNT * sizeof(Particle)) == 0);
+
+    free(one);
+    free(two);
+    free(five);
+}
+
+/* Many small galaxies split between chunks of the loop get the same particles on any number of threads. */
+void test_threads_many() {
+    const uint32_t count = 300 * MIN_PARTICLES_PER_GALAXY + 77;
+    Particle *one = MakeGalaxiesEx(count, 300, 43, 1);
+    Particle *three = MakeGalaxiesEx(count, 300, 43, 3);
+
+    TEST_CHECK(memcmp(one, three, count * sizeof(Particle)) == 0);
+
+    free(one);
+    free(three);
+}
+
+/* Different seeds give different galaxies, each of which has particles with mass and without it. */
+void test_seeds() {
+    Particle *a = MakeGalaxies(COUNT, GALAXIES, 1);
+    Particle *b = MakeGalaxies(COUNT, GALAXIES, 2);
+
+    // the core of the first galaxy is always at the origin
+    uint32_t same = 0, massless = 0;
+    for (uint32_t i = 1; i < COUNT; i++) {
+        if (a[i].pos.x == b[i].pos.x && a[i].pos.y == b[i].pos.y) same++;
+        if (a[i].mass == 0) massless++;
+    }
+    TEST_CHECK_(same == 0, "%u particles are at the same positions", same);
+    TEST_CHECK_(massless > 0 && massless < COUNT, "%u of %u particles are massless", massless, COUNT);
+
+    free(a);
+    free(b);
+}
+
+#define MANY        300     // number of galaxies in tests of many of them
+
+/* Cores of MANY galaxies of the least size, which are every MIN_PARTICLES_PER_GALAXY-th particle of PS. */
+static Particle *ManyCores(Particle *ps) {
+    Particle *cores = malloc(MANY * sizeof(Particle));
+    for (uint32_t i = 0; i < MANY; i++) {
+        cores[i] = ps[i * MIN_PARTICLES_PER_GALAXY];
+    }
+    return cores;
+}
+
+/* No two galaxies are closer than their separation allows, see MIN_GALAXY_SEPARATION. */
+void test_separation() {
+    Particle *ps = MakeGalaxies(MANY * MIN_PARTICLES_PER_GALAXY, MANY, 3);
+    Particle *cores = ManyCores(ps);
+
+    uint32_t close = 0;
+    for (uint32_t i = 0; i < MANY; i++) {
+        float max_i = cores[i].radius * MAX_PARTICLE_DIST_CR_F + sqrtf(MIN_PARTICLES_PER_GALAXY) * MAX_PARTICLE_DIST_PC_F;
+        for (uint32_t j = 0; j < i; j++) {
+            float max_j = cores[j].radius * MAX_PARTICLE_DIST_CR_F + sqrtf(MIN_PARTICLES_PER_GALAXY) * MAX_PARTICLE_DIST_PC_F;
+            float min_sep = MIN_GALAXY_SEPARATION * (max_i + max_j);
+
+            // a galaxy is placed at least as far from its parent as any other, up to rounding
+            if (MagV2(SubV2(cores[i].pos, cores[j].pos)) < min_sep * (1 - 1e-5f)) close++;
+        }
+    }
+    TEST_CHECK_(close == 0, "%u pairs of galaxies are too close", close);
+
+    free(cores);
+    free(ps);
+}
+
+/* Velocities of galaxy cores are close to those summed over every pair of them. */
+void test_kick() {
+    Particle *ps = MakeGalaxies(MANY * MIN_PARTICLES_PER_GALAXY, MANY, 4);
+    Particle *cores = ManyCores(ps);
+
+    double err = 0, sum = 0;
+    for (uint32_t i = 0; i < MANY; i++) {
+        V2 vel = V2_ZERO;
+        for (uint32_t j = 0; j < MANY; j++) {
+            if (i == j) continue;
+            V2 a_to_b = SubV2(cores[j].pos, cores[i].pos);
+            float dist = MagV2(a_to_b);
+            float speed = 0.3f * sqrtf(NB_G * cores[j].mass / dist);
+            vel = AddV2(vel, ScaleV2(V2_FROM(a_to_b.y / dist, -a_to_b.x / dist), speed));
+        }
+        err += MagV2(SubV2(vel, cores[i].vel));
+        sum += MagV2(vel);
+    }
+    TEST_CHECK_(err / sum < 1e-2, "mean error %g of mean velocity", err / sum);
+
+    free(cores);
+    free(ps);
+}
+
+TEST_LIST = {
+        TEST(test_threads),
+        TEST(test_threads_many),
+        TEST(test_seeds),
+        TEST(test_separation),
+        TEST(test_kick),
+        TEST_LIST_END
+};
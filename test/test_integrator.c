@@ -0,0 +1,148 @@
+#include <acutest.h>
+#include <math.h>
+
+#include <nbody.h>
+
+#define MASS    1000.f  // mass of both bodies
+#define DIST    100.f   // distance between bodies
+#define SOFT    1e-3f   // softening, i.e. radius of both bodies
+#define STEPS   200     // updates per orbital period
+
+#define BLOCK_ETA   0.01f   // accuracy parameter of block time steps
+
+/* Two bodies of equal mass on an eccentric orbit around their center of mass. */
+static void MakeBinary(Particle ps[2]) {
+    float v = 0.7f * sqrtf(NB_G * MASS / (2 * DIST));   // circular orbit is too easy
+    ps[0] = (Particle){.pos = V2_FROM(-DIST / 2, 0), .vel = V2_FROM(0, -v), .mass = MASS, .radius = SOFT};
+    ps[1] = (Particle){.pos = V2_FROM(DIST / 2, 0), .vel = V2_FROM(0, v), .mass = MASS, .radius = SOFT};
+}
+
+/* Orbital period of the binary if its orbit was circular. */
+static float Period(void) {
+    float v = sqrtf(NB_G * MASS / (2 * DIST));
+    return 2 * 3.14159265f * (DIST / 2) / v;
+}
+
+/* Total energy of the binary, including softening. */
+static double Energy(const Particle *ps) {
+    double kinetic = 0;
+    for (int i = 0; i < 2; i++) {
+        kinetic += 0.5 * ps[i].mass * SqMagV2(ps[i].vel);
+    }
+    double r2 = SqMagV2(SubV2(ps[1].pos, ps[0].pos)) + SOFT;
+    return kinetic - NB_G * (double)ps[0].mass * ps[1].mass / sqrt(r2);
+}
+
+/*
+ * The largest relative energy error over 2 periods of STEPS updates each.
+ * Block time steps with LEVELS are used if LEVELS is not 0.
+ */
+static double EnergyError(Integrator integrator, uint32_t steps, uint32_t levels) {
+    Particle ps[2];
+    MakeBinary(ps);
+
+    WorldConfig cfg = {.integrator = integrator, .threads = 1};
+    World *w = CreateWorldEx(ps, 2, &cfg);
+
+    double e0 = Energy(ps), max_err = 0;
+    float dt = Period() / (float)steps;
+
+    for (uint32_t i = 0; i < 2 * steps; i++) {
+        if (levels > 0) {
+            UpdateWorld_BlockSteps(w, dt, 1, levels, BLOCK_ETA);
+        } else {
+            UpdateWorld_CPU(w, dt, 1);
+        }
+
+        double err = fabs(Energy(GetWorldParticles(w, NULL)) - e0) / fabs(e0);
+        if (err > max_err) max_err = err;
+    }
+    DestroyWorld(w);
+    return max_err;
+}
+
+/* Halving the step must reduce energy error about 2^order times. */
+void test_order() {
+    struct {
+        Integrator integrator;
+        const char *name;
+        double min_ratio;
+    } cases[] = {
+            {INTEGRATOR_EULER, "Euler", 1.5},
+            {INTEGRATOR_LEAPFROG, "leapfrog", 3},
+            {INTEGRATOR_FOREST_RUTH, "Forest-Ruth", 8},   // 16 is out of reach because of float precision
+    };
+
+    for (int k = 0; k < 3; k++) {
+        double coarse = EnergyError(cases[k].integrator, STEPS, 0);
+        double fine = EnergyError(cases[k].integrator, 2 * STEPS, 0);
+
+        TEST_CHECK_(coarse / fine > cases[k].min_ratio, "%s: error %g with step dt, %g with step dt/2",
+                    cases[k].name, coarse, fine);
+    }
+}
+
+/* Block time steps must refine the step of a close binary, and do nothing with 0 levels. */
+void test_block_steps() {
+    double leapfrog = EnergyError(INTEGRATOR_LEAPFROG, STEPS / 8, 0);
+    double block = EnergyError(INTEGRATOR_LEAPFROG, STEPS / 8, 4);
+    TEST_CHECK_(block < leapfrog / 10, "leapfrog error %g, block time steps error %g", leapfrog, block);
+
+    Particle ps[2];
+    MakeBinary(ps);
+
+    WorldConfig cfg = {.integrator = INTEGRATOR_LEAPFROG, .threads = 1};
+    World *a = CreateWorldEx(ps, 2, &cfg);
+    World *b = CreateWorldEx(ps, 2, &cfg);
+    float dt = Period() / STEPS;
+
+    UpdateWorld_CPU(a, dt, STEPS);
+    UpdateWorld_BlockSteps(b, dt, STEPS, 0, BLOCK_ETA);
+
+    const Particle *pa = GetWorldParticles(a, NULL);
+    const Particle *pb = GetWorldParticles(b, NULL);
+    for (int i = 0; i < 2; i++) {
+        float diff = MagV2(SubV2(pa[i].pos, pb[i].pos));
+        TEST_CHECK_(diff < 1e-3f * DIST, "body %d: positions differ by %g", i, diff);
+    }
+
+    DestroyWorld(a);
+    DestroyWorld(b);
+}
+
+/* Merging stages of consecutive updates must not change the result. */
+void test_split_calls() {
+    Integrator integrators[] = {INTEGRATOR_EULER, INTEGRATOR_LEAPFROG, INTEGRATOR_FOREST_RUTH};
+
+    for (int k = 0; k < 3; k++) {
+        Particle ps[2];
+        MakeBinary(ps);
+
+        WorldConfig cfg = {.integrator = integrators[k], .threads = 1};
+        World *one = CreateWorldEx(ps, 2, &cfg);
+        World *many = CreateWorldEx(ps, 2, &cfg);
+        float dt = Period() / STEPS;
+
+        UpdateWorld_CPU(one, dt, STEPS);
+        for (int i = 0; i < STEPS; i++) {
+            UpdateWorld_CPU(many, dt, 1);
+        }
+
+        const Particle *a = GetWorldParticles(one, NULL);
+        const Particle *b = GetWorldParticles(many, NULL);
+        for (int i = 0; i < 2; i++) {
+            float diff = MagV2(SubV2(a[i].pos, b[i].pos));
+            TEST_CHECK_(diff < 1e-3f * DIST, "integrator %d, body %d: positions differ by %g", k, i, diff);
+        }
+
+        DestroyWorld(one);
+        DestroyWorld(many);
+    }
+}
+
+TEST_LIST = {
+        TEST(test_order),
+        TEST(test_split_calls),
+        TEST(test_block_steps),
+        TEST_LIST_END
+};
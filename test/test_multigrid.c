@@ -0,0 +1,86 @@
+#include <acutest.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <nbody.h>
+#include "multigrid.h"
+#include "sim_cpu.h"
+#include "particles.h"
+
+#define COUNT       2000
+#define MASS_LEN    1000    // particles with mass among COUNT, in clumps; the rest are massless and far from them
+#define GRID        64
+#define THREADS     3       // workers of the pool the solver is given
+
+/* Two clumps of particles with mass, and particles without mass around them. */
+static void MakeParticles(ParticleSoA *soa) {
+    Particle *ps = malloc(COUNT * sizeof(Particle));
+    for (uint32_t i = 0; i < COUNT; i++) {
+        float angle = RandFloat(0, 6.2831853f);
+        float dist = i < MASS_LEN ? RandFloat(0, 200) : RandFloat(3000, 5000);
+        float cx = i < MASS_LEN / 2 ? -1000.f : 1000.f;
+        ps[i] = RandParticle(cx + dist * cosf(angle), 300 + dist * sinf(angle), i < MASS_LEN);
+    }
+    PackParticles(ps, soa);
+    free(ps);
+}
+
+void test_far_force() {
+    srand(1);
+    ParticleSoA soa;
+    AllocParticleSoA(&soa, COUNT);
+    MakeParticles(&soa);
+    Multigrid mg = {0};
+    Pool *pool = CreatePool(THREADS, false);
+
+    MultigridAccel(&mg, pool, &soa, COUNT, MASS_LEN, GRID);
+    double err = MeanRelError(&soa, COUNT, MASS_LEN, MASS_LEN);
+    TEST_CHECK_(err < 1e-2, "mean relative error %g", err);
+    TEST_CHECK_(mg.cycles < 16, "%u V-cycles", mg.cycles);
+
+    DestroyPool(pool);
+    FreeMultigrid(&mg);
+    FreeParticleSoA(&soa);
+}
+
+/* A solve after particles moved a little starts from the previous one and needs fewer cycles. */
+void test_warm_start() {
+    srand(2);
+    ParticleSoA soa;
+    AllocParticleSoA(&soa, COUNT);
+    MakeParticles(&soa);
+    Multigrid mg = {0};
+    Pool *pool = CreatePool(THREADS, false);
+
+    MultigridAccel(&mg, pool, &soa, COUNT, MASS_LEN, GRID);
+    uint32_t cold = mg.cycles;
+    float x0 = mg.x0, y0 = mg.y0;
+
+    for (uint32_t i = 0; i < COUNT; i++) {
+        soa.x[i] += RandFloat(-1, 1);
+        soa.y[i] += RandFloat(-1, 1);
+    }
+    MultigridAccel(&mg, pool, &soa, COUNT, MASS_LEN, GRID);
+    uint32_t warm = mg.cycles;
+
+    TEST_CHECK_(mg.x0 == x0 && mg.y0 == y0, "grid moved from (%g, %g) to (%g, %g)", x0, y0, mg.x0, mg.y0);
+    TEST_CHECK_(warm < cold, "%u V-cycles from scratch, %u from the previous solution", cold, warm);
+
+    double err = MeanRelError(&soa, COUNT, MASS_LEN, MASS_LEN);
+    TEST_CHECK_(err < 1e-2, "mean relative error %g", err);
+
+    // particles far outside move the grid
+    soa.x[COUNT - 1] += 1e5f;
+    MultigridAccel(&mg, pool, &soa, COUNT, MASS_LEN, GRID);
+    TEST_CHECK_(mg.x0 != x0, "grid stayed at (%g, %g)", mg.x0, mg.y0);
+
+    DestroyPool(pool);
+    FreeMultigrid(&mg);
+    FreeParticleSoA(&soa);
+}
+
+TEST_LIST = {
+        TEST(test_far_force),
+        TEST(test_warm_start),
+        TEST_LIST_END
+};
@@ -0,0 +1,114 @@
+#include <acutest.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <nbody.h>
+#include "p3m.h"
+#include "sim_cpu.h"
+#include "particles.h"
+
+#define COUNT       3000
+#define MASS_LEN    2200    // particles with mass among COUNT; the rest are massless
+#define GRID        128
+#define THREADS     3       // workers of the pool the solver is given
+
+/* Short-range correction must fix what the mesh alone blurs. */
+void test_accuracy() {
+    srand(1);
+    Particle *ps = ClumpedParticles(COUNT, MASS_LEN, 200);
+    ParticleSoA soa;
+    MakeSoA(&soa, ps, COUNT);
+    free(ps);
+
+    Pool *pool = CreatePool(THREADS, false);
+    Pm pm = {0};
+    PmAccel(&pm, pool, &soa, COUNT, MASS_LEN, GRID, 0);
+    double pm_err = MeanRelError(&soa, COUNT, MASS_LEN, 0);
+
+    P3m p = {0};
+    P3mAccel(&p, pool, &soa, COUNT, MASS_LEN, GRID, GetDefaultCpuKernel()->accel);
+    double p3m_err = MeanRelError(&soa, COUNT, MASS_LEN, 0);
+    DestroyPool(pool);
+
+    TEST_CHECK_(p3m_err < 5e-3, "mean relative error %g", p3m_err);
+    TEST_CHECK_(p3m_err < pm_err / 10, "mean relative error %g, without short-range part %g", p3m_err, pm_err);
+
+    FreeP3m(&p);
+    FreePm(&pm);
+    FreeParticleSoA(&soa);
+}
+
+/* Every particle is hashed exactly once, and those with mass come first in every cell. */
+void test_hash() {
+    srand(2);
+    Particle *ps = ClumpedParticles(COUNT, MASS_LEN, 200);
+    ParticleSoA soa;
+    MakeSoA(&soa, ps, COUNT);
+    free(ps);
+
+    P3m p = {0};
+    Pool *pool = CreatePool(THREADS, false);
+    P3mAccel(&p, pool, &soa, COUNT, MASS_LEN, GRID, GetDefaultCpuKernel()->accel);
+    DestroyPool(pool);
+
+    uint32_t *seen = calloc(COUNT, sizeof(uint32_t));
+    uint32_t len = p.cells * p.cells;
+    TEST_CHECK(p.cell_start[0] == 0 && p.cell_start[len] == COUNT);
+
+    for (uint32_t c = 0; c < len; c++) {
+        for (uint32_t q = p.cell_start[c]; q < p.cell_start[c + 1]; q++) {
+            uint32_t i = p.order[q];
+            seen[i]++;
+            TEST_CHECK_(p.cell_of[i] == c, "particle %u is in cell %u, not %u", i, p.cell_of[i], c);
+            TEST_CHECK_((i < MASS_LEN) == (q < p.mass_end[c]), "particle %u at %u, mass ends at %u", i, q, p.mass_end[c]);
+        }
+    }
+    for (uint32_t i = 0; i < COUNT; i++) {
+        TEST_CHECK_(seen[i] == 1, "particle %u is hashed %u times", i, seen[i]);
+    }
+
+    free(seen);
+    FreeP3m(&p);
+    FreeParticleSoA(&soa);
+}
+
+/* The smallest grid is narrower than a hash cell, so all pairs are summed directly in one cell. */
+void test_small_grid() {
+    srand(3);
+    Particle *ps = ClumpedParticles(COUNT, MASS_LEN, 200);
+    ParticleSoA soa;
+    MakeSoA(&soa, ps, COUNT);
+    free(ps);
+
+    P3m p = {0};
+    Pool *pool = CreatePool(THREADS, false);
+    P3mAccel(&p, pool, &soa, COUNT, MASS_LEN, 8, GetDefaultCpuKernel()->accel);
+    DestroyPool(pool);
+    double err = MeanRelError(&soa, COUNT, MASS_LEN, 0);
+
+    TEST_CHECK_(p.cells == 1, "%u x %u hash cells", p.cells, p.cells);
+    TEST_CHECK_(err < 5e-3, "mean relative error %g", err);
+
+    FreeP3m(&p);
+    FreeParticleSoA(&soa);
+
+    ps = UniformParticles(64, 64, 1000);
+    World *w = CreateWorld(ps, 64);
+    free(ps);
+    UpdateWorld_P3M(w, 0.1f, 1, 8);
+
+    uint32_t size;
+    const Particle *out = GetWorldParticles(w, &size);
+    for (uint32_t i = 0; i < size; i++) {
+        TEST_CHECK_(isfinite(out[i].pos.x) && isfinite(out[i].pos.y), "particle %u at (%g, %g)",
+                    i, out[i].pos.x, out[i].pos.y);
+    }
+    DestroyWorld(w);
+}
+
+TEST_LIST = {
+        TEST(test_accuracy),
+        TEST(test_hash),
+        TEST(test_small_grid),
+        TEST_LIST_END
+};
@@ -0,0 +1,157 @@
+#include <acutest.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <nbody.h>
+#include "fft.h"
+#include "pm.h"
+#include "sim_cpu.h"
+#include "particles.h"
+
+#define PI  3.14159265358979323846
+
+/* Naive discrete Fourier transform of N points of (RE, IM), which are STRIDE apart, into (OUT_RE, OUT_IM). */
+static void Dft(const float *re, const float *im, uint32_t n, uint32_t stride, double *out_re, double *out_im) {
+    for (uint32_t k = 0; k < n; k++) {
+        double sr = 0, si = 0;
+        for (uint32_t j = 0; j < n; j++) {
+            double a = -2 * PI * (double)j * k / n;
+            sr += re[j * stride] * cos(a) - im[j * stride] * sin(a);
+            si += re[j * stride] * sin(a) + im[j * stride] * cos(a);
+        }
+        out_re[k] = sr;
+        out_im[k] = si;
+    }
+}
+
+#define FFT_LEN     128
+#define FFT_COUNT   3
+
+void test_fft() {
+    srand(1);
+    float re[FFT_LEN * FFT_COUNT], im[FFT_LEN * FFT_COUNT];
+    float orig_re[FFT_LEN * FFT_COUNT], orig_im[FFT_LEN * FFT_COUNT];
+    for (uint32_t i = 0; i < FFT_LEN * FFT_COUNT; i++) {
+        orig_re[i] = re[i] = RandFloat(-1, 1);
+        orig_im[i] = im[i] = RandFloat(-1, 1);
+    }
+
+    FftPlan p;
+    MakeFftPlan(&p, FFT_LEN);
+    Fft(&p, re, im, FFT_COUNT, FFT_COUNT, false);
+
+    double max_err = 0;
+    for (uint32_t c = 0; c < FFT_COUNT; c++) {
+        double want_re[FFT_LEN], want_im[FFT_LEN];
+        Dft(orig_re + c, orig_im + c, FFT_LEN, FFT_COUNT, want_re, want_im);
+        for (uint32_t k = 0; k < FFT_LEN; k++) {
+            double err = hypot(re[k * FFT_COUNT + c] - want_re[k], im[k * FFT_COUNT + c] - want_im[k]);
+            max_err = fmax(max_err, err);
+        }
+    }
+    TEST_CHECK_(max_err < 1e-4, "max error of forward transform %g", max_err);
+
+    Fft(&p, re, im, FFT_COUNT, FFT_COUNT, true);
+    max_err = 0;
+    for (uint32_t i = 0; i < FFT_LEN * FFT_COUNT; i++) {
+        double err = hypot(re[i] / FFT_LEN - orig_re[i], im[i] / FFT_LEN - orig_im[i]);
+        max_err = fmax(max_err, err);
+    }
+    TEST_CHECK_(max_err < 1e-6, "max error of round trip %g", max_err);
+
+    FreeFftPlan(&p);
+}
+
+void test_fft_real() {
+    srand(2);
+    float x[2 * FFT_LEN], zero[2 * FFT_LEN] = {0};
+    float re[FFT_LEN + 1], im[FFT_LEN + 1];
+    for (uint32_t i = 0; i < FFT_LEN; i++) {
+        re[i] = x[2 * i] = RandFloat(-1, 1);
+        im[i] = x[2 * i + 1] = RandFloat(-1, 1);
+    }
+
+    FftPlan p;
+    MakeFftPlan(&p, FFT_LEN);
+    FftReal(&p, re, im);
+
+    double want_re[2 * FFT_LEN], want_im[2 * FFT_LEN];
+    Dft(x, zero, 2 * FFT_LEN, 1, want_re, want_im);
+
+    double max_err = 0;
+    for (uint32_t k = 0; k <= FFT_LEN; k++) {
+        max_err = fmax(max_err, hypot(re[k] - want_re[k], im[k] - want_im[k]));
+    }
+    TEST_CHECK_(max_err < 1e-4, "max error of forward transform %g", max_err);
+
+    FftRealInverse(&p, re, im);
+    max_err = 0;
+    for (uint32_t i = 0; i < FFT_LEN; i++) {
+        max_err = fmax(max_err, fabs(re[i] / (2 * FFT_LEN) - x[2 * i]));
+        max_err = fmax(max_err, fabs(im[i] / (2 * FFT_LEN) - x[2 * i + 1]));
+    }
+    TEST_CHECK_(max_err < 1e-6, "max error of round trip %g", max_err);
+
+    FreeFftPlan(&p);
+}
+
+#define COUNT       2000
+#define MASS_LEN    1000    // particles with mass among COUNT, in a clump; the rest are massless and far from it
+#define GRID        128
+#define THREADS     3       // workers of the pool the solver is given
+
+/* Far from the clump, PM gravity must be close to the direct one, whatever the grid covers. */
+void test_far_force() {
+    srand(3);
+    Particle *ps = malloc(COUNT * sizeof(Particle));
+    for (uint32_t i = 0; i < COUNT; i++) {
+        float angle = RandFloat(0, 2 * (float)PI);
+        float dist = i < MASS_LEN ? RandFloat(0, 200) : RandFloat(3000, 5000);
+        ps[i] = RandParticle(1000 + dist * cosf(angle), -500 + dist * sinf(angle), i < MASS_LEN);
+    }
+    ParticleSoA soa;
+    MakeSoA(&soa, ps, COUNT);
+
+    Pm pm = {0};
+    Pool *pool = CreatePool(THREADS, false);
+    PmAccel(&pm, pool, &soa, COUNT, MASS_LEN, GRID, 0);
+    double err = MeanRelError(&soa, COUNT, MASS_LEN, MASS_LEN);
+    TEST_CHECK_(err < 2e-3, "mean relative error %g", err);
+
+    // another grid size reallocates everything
+    PmAccel(&pm, pool, &soa, COUNT, MASS_LEN, GRID / 2, 0);
+    TEST_CHECK(pm.grid == GRID / 2);
+
+    DestroyPool(pool);
+    FreePm(&pm);
+    FreeParticleSoA(&soa);
+    free(ps);
+}
+
+/* A single particle feels no force, and no particles at all are fine. */
+void test_degenerate() {
+    ParticleSoA soa;
+    AllocParticleSoA(&soa, 1);
+    soa.x[0] = 10;
+    soa.y[0] = 20;
+    soa.m[0] = 1000;
+    Pm pm = {0};
+    Pool *pool = CreatePool(THREADS, false);
+
+    PmAccel(&pm, pool, &soa, 1, 1, 16, 0);
+    TEST_CHECK_(fabsf(soa.ax[0]) < 1e-3f && fabsf(soa.ay[0]) < 1e-3f, "acceleration (%g, %g)", soa.ax[0], soa.ay[0]);
+
+    PmAccel(&pm, pool, &soa, 0, 0, 16, 0);
+
+    DestroyPool(pool);
+    FreePm(&pm);
+    FreeParticleSoA(&soa);
+}
+
+TEST_LIST = {
+        TEST(test_fft),
+        TEST(test_fft_real),
+        TEST(test_far_force),
+        TEST(test_degenerate),
+        TEST_LIST_END
+};
@@ -0,0 +1,120 @@
+#include <acutest.h>
+#include <stdlib.h>
+
+#include "pool.h"
+
+/* Loop that counts how many times every item was run, and checks what workers were given. */
+typedef struct Count {
+    uint32_t *runs;     // times every item was run
+    uint32_t threads;   // workers of the pool
+    uint32_t chunk;     // items per chunk of the loop
+    bool bad_tid;       // whether any chunk was run with a worker id out of range
+    bool bad_chunk;     // whether any chunk did not start at a multiple of CHUNK or was longer than it
+} Count;
+
+static void CountChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    Count *c = ctx;
+    if (tid >= c->threads) c->bad_tid = true;
+    if (from % c->chunk != 0 || to - from > c->chunk || to <= from) c->bad_chunk = true;
+
+    for (uint32_t i = from; i < to; i++) {
+        c->runs[i]++;
+    }
+}
+
+/* Run a counting loop of LEN items in chunks of CHUNK on P, and check that every item ran exactly once. */
+static void CheckLoop(Pool *p, uint32_t threads, uint32_t len, uint32_t chunk) {
+    Count c = {
+            .runs = calloc(len > 0 ? len : 1, sizeof(uint32_t)),
+            .threads = threads,
+            .chunk = chunk,
+            .bad_tid = false,
+            .bad_chunk = false,
+    };
+    PoolFor(p, "count", len, chunk, CountChunk, &c);
+
+    uint32_t wrong = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        if (c.runs[i] != 1) wrong++;
+    }
+    TEST_CHECK(wrong == 0 && !c.bad_tid && !c.bad_chunk);
+    TEST_MSG("%u threads, %u items in chunks of %u: %u items not run once, bad tid %d, bad chunk %d",
+             threads, len, chunk, wrong, c.bad_tid, c.bad_chunk);
+
+    free(c.runs);
+}
+
+void test_every_item_once() {
+    const uint32_t lens[] = {0, 1, 15, 16, 17, 1000, 4097};
+    const uint32_t chunks[] = {1, 16, 1024};
+
+    for (uint32_t threads = 1; threads <= 5; threads++) {
+        Pool *p = CreatePool(threads, false);
+        for (size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+            for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+                CheckLoop(p, threads, lens[l], chunks[c]);
+            }
+        }
+        DestroyPool(p);
+    }
+}
+
+/* Loop whose items cost more towards the end, the way rows of a tree walk or of pairs do. */
+typedef struct Irregular {
+    double *out;
+} Irregular;
+
+static void IrregularChunk(void *ctx, uint32_t from, uint32_t to, uint32_t tid) {
+    Irregular *l = ctx;
+    (void)tid;
+
+    for (uint32_t i = from; i < to; i++) {
+        double sum = 0;
+        for (uint32_t k = 0; k < i * 20; k++) {
+            sum += 1.0 / (k + 1);
+        }
+        l->out[i] = sum;
+    }
+}
+
+void test_irregular() {
+    const uint32_t len = 2000;
+    Irregular l = {.out = malloc(len * sizeof(double))};
+    double *serial = malloc(len * sizeof(double));
+
+    Pool *one = CreatePool(1, false);
+    Irregular s = {.out = serial};
+    PoolFor(one, "irregular", len, 1, IrregularChunk, &s);
+    DestroyPool(one);
+
+    Pool *p = CreatePool(4, false);
+    PoolFor(p, "irregular", len, 1, IrregularChunk, &l);
+    DestroyPool(p);
+
+    uint32_t wrong = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        if (l.out[i] != serial[i]) wrong++;
+    }
+    TEST_CHECK(wrong == 0);
+    TEST_MSG("%u of %u items differ from a single worker", wrong, len);
+
+    free(serial);
+    free(l.out);
+}
+
+void test_many_loops() {
+    // loops that finish before other workers wake up must not lose or repeat any of them
+    const uint32_t threads = 3;
+    Pool *p = CreatePool(threads, false);
+    for (uint32_t n = 0; n < 2000; n++) {
+        CheckLoop(p, threads, n % 7 + 2, 1);
+    }
+    DestroyPool(p);
+}
+
+TEST_LIST = {
+        TEST(test_every_item_once),
+        TEST(test_irregular),
+        TEST(test_many_loops),
+        TEST_LIST_END
+};
@@ -0,0 +1,113 @@
+#include <acutest.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <nbody.h>
+#include "quadtree.h"
+#include "particles.h"
+
+#define COUNT   3000
+
+/* Build T over COUNT particles of PS. */
+static void Build(Quadtree *t, const Particle *ps, uint32_t count) {
+    ParticleSoA soa;
+    MakeSoA(&soa, ps, count);
+    BuildQuadtree(t, &soa, count);
+    FreeParticleSoA(&soa);
+}
+
+/* Mean relative error of T with THETA at every particle of PS, compared to direct summation. */
+static double QuadtreeError(const Quadtree *t, const Particle *ps, uint32_t count, float theta) {
+    ParticleSoA soa;
+    MakeSoA(&soa, ps, count);
+    for (uint32_t i = 0; i < count; i++) {
+        V2 acc = QuadtreeAcc(t, ps[i].pos, ps[i].radius, theta);
+        soa.ax[i] = acc.x;
+        soa.ay[i] = acc.y;
+    }
+
+    double err = MeanRelError(&soa, count, count, 0);
+    FreeParticleSoA(&soa);
+    return err;
+}
+
+void test_structure() {
+    srand(1);
+    Particle *ps = ClumpedParticles(COUNT, COUNT, 600);
+    Quadtree t = {0};
+    Build(&t, ps, COUNT);
+
+    float total_mass = 0;
+    for (uint32_t i = 0; i < COUNT; i++) {
+        total_mass += ps[i].mass;
+    }
+    TEST_CHECK(t.nodes[0].count == COUNT);
+    TEST_CHECK(fabsf(t.nodes[0].mass - total_mass) <= 1e-4f * total_mass);
+
+    // every body is in exactly one leaf, and leaves are not too big
+    uint32_t in_leaves = 0;
+    for (uint32_t i = 0; i < t.node_len; i++) {
+        if (t.nodes[i].child == 0) {
+            in_leaves += t.nodes[i].count;
+            TEST_CHECK(t.nodes[i].count <= QT_LEAF_CAPACITY);
+        }
+    }
+    TEST_CHECK(in_leaves == COUNT);
+
+    FreeQuadtree(&t);
+    free(ps);
+}
+
+void test_exact_with_zero_theta() {
+    srand(2);
+    Particle *ps = ClumpedParticles(COUNT, COUNT, 600);
+    Quadtree t = {0};
+    Build(&t, ps, COUNT);
+
+    double err = QuadtreeError(&t, ps, COUNT, 0.f);
+    TEST_CHECK(err < 1e-5);
+    TEST_MSG("mean relative error = %g", err);
+
+    FreeQuadtree(&t);
+    free(ps);
+}
+
+void test_approximation() {
+    srand(3);
+    Particle *ps = ClumpedParticles(COUNT, COUNT, 600);
+    Quadtree t = {0};
+
+    // build twice to make sure reused memory works
+    Build(&t, ps, COUNT / 2);
+    Build(&t, ps, COUNT);
+
+    double err_small = QuadtreeError(&t, ps, COUNT, 0.3f);
+    double err_large = QuadtreeError(&t, ps, COUNT, 0.8f);
+
+    TEST_CHECK(err_small < 2e-3);
+    TEST_MSG("theta = 0.3: mean relative error = %g", err_small);
+    TEST_CHECK(err_large < 5e-2);
+    TEST_MSG("theta = 0.8: mean relative error = %g", err_large);
+    TEST_CHECK(err_small < err_large);
+
+    FreeQuadtree(&t);
+    free(ps);
+}
+
+void test_empty() {
+    Quadtree t = {0};
+    Build(&t, NULL, 0);
+
+    V2 acc = QuadtreeAcc(&t, V2_ZERO, 1.f, 0.5f);
+    TEST_CHECK(acc.x == 0 && acc.y == 0);
+
+    FreeQuadtree(&t);
+}
+
+TEST_LIST = {
+        TEST(test_structure),
+        TEST(test_exact_with_zero_theta),
+        TEST(test_approximation),
+        TEST(test_empty),
+        TEST_LIST_END
+};
@@ -0,0 +1,118 @@
+#include <acutest.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <nbody.h>
+#include <galaxy.h>
+#include "morton.h"
+
+#define COUNT   2000
+
+/* Sum of distances between consecutive particles; lower means better locality. */
+static double PathLength(const Particle *ps, uint32_t from, uint32_t to) {
+    double sum = 0;
+    for (uint32_t i = from + 1; i < to; i++) {
+        sum += MagV2(SubV2(ps[i].pos, ps[i - 1].pos));
+    }
+    return sum;
+}
+
+/* Number of particles with mass at the start of PS. */
+static uint32_t MassLen(const Particle *ps, uint32_t count) {
+    uint32_t len = 0;
+    while (len < count && ps[len].mass > 0) len++;
+    return len;
+}
+
+void test_morton_code() {
+    TEST_CHECK(MortonCode(0, 0) == 0);
+    TEST_CHECK(MortonCode(1, 0) == 1);
+    TEST_CHECK(MortonCode(0, 1) == 2);
+    TEST_CHECK(MortonCode(3, 3) == 15);
+    TEST_CHECK(MortonCode(0xFFFF, 0) == 0x55555555);
+    TEST_CHECK(MortonCode(0xFFFF, 0xFFFF) == 0xFFFFFFFF);
+}
+
+void test_reorder() {
+    Particle *ps = MakeGalaxies(COUNT, 3, 7);
+
+    World *w = CreateWorld(ps, COUNT);
+    uint32_t size;
+    const Particle *before = GetWorldParticles(w, &size);
+    uint32_t mass_len = MassLen(before, size);
+    double path_before = PathLength(before, 0, mass_len) + PathLength(before, mass_len, size);
+
+    ReorderWorld(w);
+    const Particle *after = GetWorldParticles(w, NULL);
+    const uint32_t *ids = GetWorldParticleIds(w, NULL);
+
+    // particles with mass still come first
+    TEST_CHECK(MassLen(after, size) == mass_len);
+
+    // ids are a permutation that maps every particle to its original
+    bool *seen = calloc(size, sizeof(bool));
+    for (uint32_t i = 0; i < size; i++) {
+        TEST_CHECK_(ids[i] < size && !seen[ids[i]], "id %u of particle %u", ids[i], i);
+        if (ids[i] >= size) continue;
+        seen[ids[i]] = true;
+        TEST_CHECK_(memcmp(&after[i], &ps[ids[i]], sizeof(Particle)) == 0, "particle %u is not its original", i);
+    }
+    free(seen);
+
+    double path_after = PathLength(after, 0, mass_len) + PathLength(after, mass_len, size);
+    TEST_CHECK_(path_after < path_before / 4, "path length %g before reordering, %g after", path_before, path_after);
+
+    DestroyWorld(w);
+    free(ps);
+}
+
+/*
+ * Periodic reordering must not change the simulation beyond summation order. Rounding differences grow
+ * quickly in close encounters, so particles are compared after a few steps relative to how far they moved.
+ */
+void test_periodic() {
+    Particle *ps = MakeGalaxies(COUNT, 2, 11);
+
+    WorldConfig cfg = {.reorder_interval = 1};
+    World *plain = CreateWorld(ps, COUNT);
+    World *sorted = CreateWorldEx(ps, COUNT, &cfg);
+
+    for (int i = 0; i < 3; i++) {
+        UpdateWorld_CPU(plain, 0.1f, 1);
+        UpdateWorld_CPU(sorted, 0.1f, 1);
+    }
+
+    const Particle *a = GetWorldParticles(plain, NULL);
+    const uint32_t *a_ids = GetWorldParticleIds(plain, NULL);
+    const Particle *b = GetWorldParticles(sorted, NULL);
+    const uint32_t *b_ids = GetWorldParticleIds(sorted, NULL);
+
+    // position of every particle by its original index
+    V2 *pos = malloc(COUNT * sizeof(V2));
+    for (uint32_t i = 0; i < COUNT; i++) {
+        pos[a_ids[i]] = a[i].pos;
+    }
+
+    bool moved = false;
+    double max = 0;
+    for (uint32_t i = 0; i < COUNT; i++) {
+        double diff = MagV2(SubV2(b[i].pos, pos[b_ids[i]]));
+        double path = MagV2(SubV2(b[i].pos, ps[b_ids[i]].pos));
+        if (diff > max * path) max = diff / path;
+        if (b_ids[i] != a_ids[i]) moved = true;
+    }
+    TEST_CHECK(moved);
+    TEST_CHECK_(max < 1e-3, "max position difference %g of displacement", max);
+
+    free(pos);
+    DestroyWorld(plain);
+    DestroyWorld(sorted);
+    free(ps);
+}
+
+TEST_LIST = {
+        TEST(test_morton_code),
+        TEST(test_reorder),
+        TEST(test_periodic),
+        TEST_LIST_END
+};
@@ -0,0 +1,108 @@
+#include <acutest.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <nbody.h>
+#include <galaxy.h>
+
+#define COUNT       3000
+#define PATH        "test_snapshot.bin"
+
+/* World of galaxies with leapfrog, so that stored acceleration matters, after a few updates and a reordering. */
+static World *MakeWorld(void) {
+    Particle *ps = MakeGalaxies(COUNT, 2, 9);
+    WorldConfig cfg = {.integrator = INTEGRATOR_LEAPFROG};
+    World *w = CreateWorldEx(ps, COUNT, &cfg);
+    free(ps);
+
+    UpdateWorld_CPU(w, 0.1f, 3);
+    ReorderWorld(w);
+    UpdateWorld_CPU(w, 0.1f, 2);
+    return w;
+}
+
+/* Whether A and B have the same particles with the same ids. */
+static bool SameWorlds(World *a, World *b) {
+    uint32_t len_a, len_b;
+    const Particle *pa = GetWorldParticles(a, &len_a);
+    const Particle *pb = GetWorldParticles(b, &len_b);
+    const uint32_t *ids_a = GetWorldParticleIds(a, NULL);
+    const uint32_t *ids_b = GetWorldParticleIds(b, NULL);
+
+    return len_a == len_b
+           && memcmp(pa, pb, len_a * sizeof(Particle)) == 0
+           && memcmp(ids_a, ids_b, len_a * sizeof(uint32_t)) == 0;
+}
+
+/* A loaded world is the saved one, and continues exactly the same way. */
+void test_round_trip() {
+    World *saved = MakeWorld();
+    SaveWorld(saved, PATH, 12.5, 0.1f);
+
+    double time = 0;
+    float dt = 0;
+    WorldConfig cfg = {.integrator = INTEGRATOR_LEAPFROG};
+    World *loaded = LoadWorld(PATH, &cfg, &time, &dt);
+
+    TEST_CHECK_(time == 12.5 && dt == 0.1f, "time %g and step %g", time, dt);
+    TEST_CHECK(SameWorlds(saved, loaded));
+
+    UpdateWorld_CPU(saved, 0.1f, 4);
+    UpdateWorld_CPU(loaded, 0.1f, 4);
+    TEST_CHECK(SameWorlds(saved, loaded));
+
+    DestroyWorld(saved);
+    DestroyWorld(loaded);
+    remove(PATH);
+}
+
+/* Updates of a loaded world never reach the file. */
+void test_file_unchanged() {
+    World *saved = MakeWorld();
+    SaveWorld(saved, PATH, 0, 0.1f);
+
+    World *first = LoadWorld(PATH, NULL, NULL, NULL);
+    UpdateWorld_CPU(first, 0.1f, 3);
+    ReorderWorld(first);
+    DestroyWorld(first);
+
+    World *second = LoadWorld(PATH, NULL, NULL, NULL);
+    TEST_CHECK(SameWorlds(saved, second));
+
+    DestroyWorld(saved);
+    DestroyWorld(second);
+    remove(PATH);
+}
+
+/* A loaded world can be saved back over the file it was loaded from, the way periodic checkpoints are. */
+void test_save_over_loaded() {
+    World *saved = MakeWorld();
+    SaveWorld(saved, PATH, 0, 0.1f);
+    DestroyWorld(saved);
+
+    World *w = LoadWorld(PATH, NULL, NULL, NULL);
+    UpdateWorld_CPU(w, 0.1f, 3);
+    SaveWorld(w, PATH, 0.3, 0.1f);
+
+    World *again = LoadWorld(PATH, NULL, NULL, NULL);
+    TEST_CHECK(SameWorlds(w, again));
+
+    // and over a file mapped by another world
+    UpdateWorld_CPU(again, 0.1f, 2);
+    SaveWorld(again, PATH, 0.5, 0.1f);
+    World *last = LoadWorld(PATH, NULL, NULL, NULL);
+    TEST_CHECK(SameWorlds(again, last));
+
+    DestroyWorld(w);
+    DestroyWorld(again);
+    DestroyWorld(last);
+    remove(PATH);
+}
+
+TEST_LIST = {
+        TEST(test_round_trip),
+        TEST(test_file_unchanged),
+        TEST(test_save_over_loaded),
+        TEST_LIST_END
+};
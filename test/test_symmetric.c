@@ -0,0 +1,90 @@
+#include <acutest.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <nbody.h>
+#include "sim_cpu.h"
+#include "particles.h"
+
+/* Not a multiple of any pack or block size, so that every code path of the kernels is used. */
+#define COUNT       1003
+
+/* Particles with mass among COUNT; the rest are massless. */
+#define MASS_LEN    757
+
+/* Largest acceptable relative error of symmetric kernel compared to the one-sided one; only summation order differs. */
+#define MAX_ERROR   1e-4
+
+/* Pairs computed once must give the same acceleration as every target summing all of its sources. */
+void test_pairs() {
+    Particle *ps = UniformParticles(COUNT, MASS_LEN, 10000);
+    ParticleSoA soa;
+    MakeSoA(&soa, ps, COUNT);
+    free(ps);
+
+    float *ax = calloc(MASS_LEN, sizeof(float));
+    float *ay = calloc(MASS_LEN, sizeof(float));
+
+    for (CpuSimd simd = 0; simd < CPU_SIMD_COUNT; simd++) {
+        const CpuKernel *kernel = GetCpuKernel(simd);
+        if (kernel == NULL) continue;
+        TEST_CASE(GetCpuSimdName(simd));
+
+        for (uint32_t i = 0; i < MASS_LEN; i++) {
+            ax[i] = ay[i] = 0;
+        }
+        // split rows in uneven ranges, the same way threads do
+        kernel->pairs(&soa, MASS_LEN, 0, 5, ax, ay);
+        kernel->pairs(&soa, MASS_LEN, 5, 500, ax, ay);
+        kernel->pairs(&soa, MASS_LEN, 500, MASS_LEN, ax, ay);
+
+        kernel->accel_sym(&soa, MASS_LEN, 0, MASS_LEN);
+
+        double max = 0;
+        for (uint32_t i = 0; i < MASS_LEN; i++) {
+            V2 one_sided = V2_FROM(soa.ax[i], soa.ay[i]);
+            V2 pairs = V2_FROM(ax[i], ay[i]);
+
+            double err = MagV2(SubV2(pairs, one_sided)) / MagV2(one_sided);
+            if (err > max) max = err;
+        }
+        TEST_CHECK_(max < MAX_ERROR, "max relative error %g < %g", max, MAX_ERROR);
+    }
+
+    free(ax);
+    free(ay);
+    FreeParticleSoA(&soa);
+}
+
+/* Symmetric World must stay close to the default one; softening differs only a little at these distances. */
+void test_world() {
+    Particle *ps = UniformParticles(COUNT, MASS_LEN, 10000);
+
+    WorldConfig sym_cfg = {.symmetric = true};
+    World *def = CreateWorld(ps, COUNT);
+    World *sym = CreateWorldEx(ps, COUNT, &sym_cfg);
+
+    // a single update, because random particles have close encounters that amplify any difference
+    UpdateWorld_CPU(def, 0.1f, 1);
+    UpdateWorld_CPU(sym, 0.1f, 1);
+
+    const Particle *a = GetWorldParticles(def, NULL);
+    const Particle *b = GetWorldParticles(sym, NULL);
+
+    double sum = 0;
+    for (uint32_t i = 0; i < COUNT; i++) {
+        sum += MagV2(SubV2(a[i].acc, b[i].acc)) / MagV2(a[i].acc);
+    }
+    double mean = sum / COUNT;
+    TEST_CHECK_(mean < 1e-3, "mean relative difference of acceleration %g", mean);
+
+    DestroyWorld(def);
+    DestroyWorld(sym);
+    free(ps);
+}
+
+TEST_LIST = {
+        TEST(test_pairs),
+        TEST(test_world),
+        TEST_LIST_END
+};
@@ -0,0 +1,83 @@
+#include <acutest.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <nbody.h>
+#include "particles.h"
+
+/* Not a multiple of any pack or tile size, so that partial tiles are advanced too. */
+#define COUNT       1003
+
+/* Particles with mass among COUNT; the rest are massless. */
+#define MASS_LEN    301
+
+#define STEPS       7       // updates per call
+#define BLOCK       3       // force evaluations per tracer block; does not divide the number of them
+
+/* Largest acceptable difference of positions relative to the size of the world; only kernel paths may differ. */
+#define MAX_ERROR   1e-5
+
+/* COUNT random particles with random velocity, the first MASS_LEN of them with mass. */
+static Particle *MakeParticles(void) {
+    Particle *ps = UniformParticles(COUNT, MASS_LEN, 2000);
+    for (uint32_t i = 0; i < COUNT; i++) {
+        ps[i].vel = V2_FROM(RandFloat(-1, 1), RandFloat(-1, 1));
+    }
+    return ps;
+}
+
+/* Largest distance between the same particles of A and B divided by the size of the world. */
+static double MaxError(World *a, World *b) {
+    uint32_t len;
+    const Particle *pa = GetWorldParticles(a, &len);
+    const Particle *pb = GetWorldParticles(b, &len);
+
+    double max = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        double err = MagV2(SubV2(pa[i].pos, pb[i].pos)) / 2000;
+        if (err > max) max = err;
+    }
+    return max;
+}
+
+/* Tracer blocks must follow UpdateWorld_CPU with CFG, across several calls. */
+static void CheckConfig(const WorldConfig *cfg) {
+    srand(1);
+    Particle *ps = MakeParticles();
+    World *cpu = CreateWorldEx(ps, COUNT, cfg);
+    World *tracers = CreateWorldEx(ps, COUNT, cfg);
+
+    for (int call = 0; call < 3; call++) {
+        UpdateWorld_CPU(cpu, 1.f, STEPS);
+        UpdateWorld_TracerBlocks(tracers, 1.f, STEPS, BLOCK);
+
+        double err = MaxError(cpu, tracers);
+        TEST_CHECK_(err < MAX_ERROR, "call %d: max relative error %g < %g", call, err, MAX_ERROR);
+    }
+
+    DestroyWorld(cpu);
+    DestroyWorld(tracers);
+    free(ps);
+}
+
+void test_integrators() {
+    const Integrator integrators[] = {INTEGRATOR_EULER, INTEGRATOR_LEAPFROG, INTEGRATOR_FOREST_RUTH};
+    const char *names[] = {"euler", "leapfrog", "forest-ruth"};
+
+    for (int i = 0; i < 3; i++) {
+        TEST_CASE(names[i]);
+        WorldConfig cfg = {.integrator = integrators[i]};
+        CheckConfig(&cfg);
+    }
+}
+
+void test_symmetric() {
+    WorldConfig cfg = {.integrator = INTEGRATOR_LEAPFROG, .symmetric = true};
+    CheckConfig(&cfg);
+}
+
+TEST_LIST = {
+        TEST(test_integrators),
+        TEST(test_symmetric),
+        TEST_LIST_END
+};